@@ -1,6 +1,8 @@
 #include "cppld.hpp"
 #include "statusreport.hpp"
 #include <algorithm>
+#include <bit>
+#include <charconv>
 #include <cstring>
 #include <filesystem>
 #include <unordered_map>
@@ -24,6 +26,31 @@ struct Option {
         disableEhFrameHdr,
         buildID,
         keyword,
+        setOptimizationLevel,
+        enableGcMergedPieces,
+        disableGcMergedPieces,
+        enableGcSections,
+        disableGcSections,
+        setIdenticalCodeFolding,
+        printStatistics,
+        setSymbolOrderingFile,
+        enableCallGraphSort,
+        disableCallGraphSort,
+        setCallGraphProfileFile,
+        enableHugePageText,
+        disableHugePageText,
+        enableReadOnlySegment,
+        disableReadOnlySegment,
+        setSortSection,
+        enableReproducible,
+        disableReproducible,
+        setCacheDirectory,
+        enableIncremental,
+        disableIncremental,
+        setServerSocket,
+        setConnectSocket,
+        addOutputSpec,
+        enableRelocatable,
         unrecognized
     } type{Type::ignore};
 
@@ -40,6 +67,7 @@ const std::unordered_map<char, Option> shortOptions{
     {'l', {Option::Type::searchForLibrary, hasArg}},
     {'L', {Option::Type::addLibrarySearchPath, hasArg}},
     {'z', {Option::Type::keyword, hasArg}},
+    {'O', {Option::Type::setOptimizationLevel, hasArg}},
     {'m', {Option::Type::ignore, noArg}}};
 
 // It would be so neat to have a constexpr map, but that is not (yet) available
@@ -60,6 +88,32 @@ const std::unordered_map<std::string_view, Option> longOptionStrings{
     {"eh-frame-hdr"sv, {Option::Type::enableEhFrameHdr, noArg}},
     {"no-eh-frame-hdr"sv, {Option::Type::disableEhFrameHdr, noArg}},
     {"build-id"sv, {Option::Type::buildID, hasArg}},
+    {"gc-merged-pieces"sv, {Option::Type::enableGcMergedPieces, noArg}},
+    {"no-gc-merged-pieces"sv, {Option::Type::disableGcMergedPieces, noArg}},
+    {"gc-sections"sv, {Option::Type::enableGcSections, noArg}},
+    {"no-gc-sections"sv, {Option::Type::disableGcSections, noArg}},
+    {"icf"sv, {Option::Type::setIdenticalCodeFolding, hasArg}},
+    {"stats"sv, {Option::Type::printStatistics, noArg}},
+    {"symbol-ordering-file"sv, {Option::Type::setSymbolOrderingFile, hasArg}},
+    {"call-graph-profile-sort"sv, {Option::Type::enableCallGraphSort, noArg}},
+    {"no-call-graph-profile-sort"sv, {Option::Type::disableCallGraphSort, noArg}},
+    {"call-graph-ordering-file"sv, {Option::Type::setCallGraphProfileFile, hasArg}},
+    {"huge-page-text"sv, {Option::Type::enableHugePageText, noArg}},
+    {"no-huge-page-text"sv, {Option::Type::disableHugePageText, noArg}},
+    {"rosegment"sv, {Option::Type::enableReadOnlySegment, noArg}},
+    {"no-rosegment"sv, {Option::Type::disableReadOnlySegment, noArg}},
+    {"sort-section"sv, {Option::Type::setSortSection, hasArg}},
+    {"reproducible"sv, {Option::Type::enableReproducible, noArg}},
+    {"no-reproducible"sv, {Option::Type::disableReproducible, noArg}},
+    {"cache-dir"sv, {Option::Type::setCacheDirectory, hasArg}},
+    {"incremental"sv, {Option::Type::enableIncremental, noArg}},
+    {"no-incremental"sv, {Option::Type::disableIncremental, noArg}},
+    {"relocatable"sv, {Option::Type::enableRelocatable, noArg}},
+    // Only exactly -r, options like -rpath or -rdynamic must not turn into it. Not a short option for that reason
+    {"r"sv, {Option::Type::enableRelocatable, noArg}},
+    {"server"sv, {Option::Type::setServerSocket, hasArg}},
+    {"connect"sv, {Option::Type::setConnectSocket, hasArg}},
+    {"output-spec"sv, {Option::Type::addOutputSpec, hasArg}},
     {"start-group"sv, {Option::Type::ignore, noArg}},
     {"end-group"sv, {Option::Type::ignore, noArg}},
     {"plugin"sv, {Option::Type::ignore, hasArg}},
@@ -134,12 +188,26 @@ auto splitArgIntoOptionAndParam(SplitArgIntoOptionAndParam p) -> void {
     if (arg.length() > 2) {
         param = arg.substr(2);
     } else {
-        param = argv[argIndex + 1];
+        // A short option without an argument may be the last one
+        param = (argIndex + 1) < argv.size() ? std::string_view{argv[argIndex + 1]} : ""sv;
         numArgsConsumedByParameter = 1;
     }
     return;
 }
 
+constexpr size_t defaultPageSize{0x1000};
+
+// Page sizes are powers of two, given in decimal or hexadecimal with 0x
+auto parsePageSize(std::string_view text, size_t& pageSize) -> bool {
+    auto base = 10;
+    if (text.starts_with("0x"sv) || text.starts_with("0X"sv)) {
+        text.remove_prefix(2);
+        base = 16;
+    }
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), pageSize, base);
+    return error == std::errc{} && end == text.data() + text.size() && std::has_single_bit(pageSize);
+}
+
 } // namespace
 
 auto argumentsToLinkerParameters(parametersFor::ArgumentsToLinkerParameters p) -> StatusCode {
@@ -153,6 +221,28 @@ auto argumentsToLinkerParameters(parametersFor::ArgumentsToLinkerParameters p) -
     linkerOptions.outputFileName = "a.out";
     linkerOptions.entrySymbolName = "_start";
     linkerOptions.createEhFrameHeader = false;
+    linkerOptions.optimizationLevel = 0;
+    linkerOptions.gcMergedPieces = false;
+    linkerOptions.gcSections = false;
+    linkerOptions.identicalCodeFolding = IdenticalCodeFolding::none;
+    linkerOptions.printStatistics = false;
+    linkerOptions.symbolOrderingFile = {};
+    linkerOptions.callGraphSort = false;
+    linkerOptions.callGraphProfileFile = {};
+    linkerOptions.maxPageSize = defaultPageSize;
+    linkerOptions.commonPageSize = defaultPageSize;
+    linkerOptions.hugePageText = false;
+    linkerOptions.separateCode = true;
+    linkerOptions.separateReadOnlySegment = true;
+    linkerOptions.sortSectionsByAlignment = false;
+    linkerOptions.reproducible = false;
+    linkerOptions.cacheDirectory = {};
+    linkerOptions.incremental = false;
+    linkerOptions.serverSocket = {};
+    linkerOptions.connectSocket = {};
+    linkerOptions.relocatable = false;
+    linkerOptions.outputSpecs = {};
+    linkerOptions.memoryResource = std::pmr::get_default_resource();
 
     enum class BState : uint8_t {
         bDynamic = 0,
@@ -228,13 +318,131 @@ auto argumentsToLinkerParameters(parametersFor::ArgumentsToLinkerParameters p) -
                     return report(StatusCode::not_ok, "unsupported build id: ", param);
             } break;
             case keyword: {
-                if (param != "now"sv && param != "noexecstack" && param != "relro")
+                if (param.starts_with("max-page-size="sv)) {
+                    if (!parsePageSize(param.substr("max-page-size="sv.size()), linkerOptions.maxPageSize))
+                        return report(StatusCode::not_ok, "invalid max page size: ", param);
+                } else if (param.starts_with("common-page-size="sv)) {
+                    if (!parsePageSize(param.substr("common-page-size="sv.size()), linkerOptions.commonPageSize))
+                        return report(StatusCode::not_ok, "invalid common page size: ", param);
+                } else if (param == "separate-code"sv) {
+                    linkerOptions.separateCode = true;
+                } else if (param == "noseparate-code"sv) {
+                    linkerOptions.separateCode = false;
+                } else if (param != "now"sv && param != "noexecstack" && param != "relro") {
                     return report(StatusCode::not_ok, "unsupported keyword: ", param);
+                }
+            } break;
+            case enableGcMergedPieces: {
+                linkerOptions.gcMergedPieces = true;
+            } break;
+            case disableGcMergedPieces: {
+                linkerOptions.gcMergedPieces = false;
+            } break;
+            case enableGcSections: {
+                linkerOptions.gcSections = true;
+                linkerOptions.gcMergedPieces = true;
+            } break;
+            case disableGcSections: {
+                linkerOptions.gcSections = false;
+            } break;
+            case setIdenticalCodeFolding: {
+                if (param == "all"sv) {
+                    linkerOptions.identicalCodeFolding = IdenticalCodeFolding::all;
+                } else if (param == "safe"sv) {
+                    linkerOptions.identicalCodeFolding = IdenticalCodeFolding::safe;
+                } else if (param == "none"sv) {
+                    linkerOptions.identicalCodeFolding = IdenticalCodeFolding::none;
+                } else {
+                    return report(StatusCode::not_ok, "unsupported identical code folding mode: ", param);
+                }
+            } break;
+            case printStatistics: {
+                linkerOptions.printStatistics = true;
+            } break;
+            case setSymbolOrderingFile: {
+                linkerOptions.symbolOrderingFile = param;
+            } break;
+            case enableCallGraphSort: {
+                linkerOptions.callGraphSort = true;
+            } break;
+            case disableCallGraphSort: {
+                linkerOptions.callGraphSort = false;
+            } break;
+            case setCallGraphProfileFile: {
+                linkerOptions.callGraphProfileFile = param;
+                linkerOptions.callGraphSort = true;
+            } break;
+            case enableHugePageText: {
+                linkerOptions.hugePageText = true;
+            } break;
+            case disableHugePageText: {
+                linkerOptions.hugePageText = false;
+            } break;
+            case enableReadOnlySegment: {
+                linkerOptions.separateReadOnlySegment = true;
+            } break;
+            case disableReadOnlySegment: {
+                linkerOptions.separateReadOnlySegment = false;
+            } break;
+            case setSortSection: {
+                if (param != "alignment"sv)
+                    return report(StatusCode::not_ok, "unsupported section sorting: ", param);
+                linkerOptions.sortSectionsByAlignment = true;
+            } break;
+            case enableReproducible: {
+                linkerOptions.reproducible = true;
+            } break;
+            case disableReproducible: {
+                linkerOptions.reproducible = false;
+            } break;
+            case setCacheDirectory: {
+                linkerOptions.cacheDirectory = param;
+            } break;
+            case enableIncremental: {
+                linkerOptions.incremental = true;
+            } break;
+            case disableIncremental: {
+                linkerOptions.incremental = false;
+            } break;
+            case setServerSocket: {
+                linkerOptions.serverSocket = param;
+            } break;
+            case setConnectSocket: {
+                linkerOptions.connectSocket = param;
+            } break;
+            case addOutputSpec: {
+                auto entryEnd = param.find(':');
+                auto objectsEnd = param.rfind(':');
+                if (entryEnd == param.npos || entryEnd == objectsEnd || entryEnd == 0 || objectsEnd + 1 == param.size())
+                    return report(StatusCode::not_ok, "expected --output-spec=<entry>:<object>,...:<output> but got: ", param);
+                auto& spec = linkerOptions.outputSpecs.emplace_back(OutputSpec{.entrySymbolName = param.substr(0, entryEnd),
+                                                                               .extraFilePaths = {},
+                                                                               .outputFileName = param.substr(objectsEnd + 1)});
+                // Input files are opened by name, so the paths need a terminating zero which the views into the argument don't have
+                for (auto objects = param.substr(entryEnd + 1, objectsEnd - entryEnd - 1); !objects.empty();) {
+                    auto path = objects.substr(0, objects.find(','));
+                    objects.remove_prefix(std::min(objects.size(), path.size() + 1));
+                    if (path.empty()) continue;
+                    auto backingMemory = static_cast<char*>(libraryPathMemory.allocate(path.size() + 1));
+                    std::memcpy(backingMemory, path.data(), path.size());
+                    backingMemory[path.size()] = '\0';
+                    spec.extraFilePaths.emplace_back(backingMemory, path.size());
+                }
+            } break;
+            case enableRelocatable: {
+                linkerOptions.relocatable = true;
+            } break;
+            case setOptimizationLevel: {
+                auto [end, error] = std::from_chars(param.data(), param.data() + param.size(), linkerOptions.optimizationLevel);
+                if (error != std::errc{} || end != param.data() + param.size())
+                    return report(StatusCode::not_ok, "invalid optimization level: ", param);
             } break;
             case unrecognized: return report(StatusCode::not_ok, "unrecognized option: ", arg, " ", param);
             default: /*ignored option*/ break;
         }
     }
+    if (linkerOptions.commonPageSize > linkerOptions.maxPageSize)
+        return report(StatusCode::not_ok, "common page size ", linkerOptions.commonPageSize, " is larger than the max page size ", linkerOptions.maxPageSize);
 
     // The string needs to be preserved in a vector such that the string_view always points to valid memory
     // Reserving enough space will make sure that view to strings with small buffer optimization
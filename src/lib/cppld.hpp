@@ -1,13 +1,45 @@
 #pragma once
 
+#include <cstddef>
+#include <map>
 #include <memory_resource>
+#include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "cppld_api_types.hpp"
 
 namespace cppld {
 
+// Which sections may be folded into an identical one
+enum class IdenticalCodeFolding : uint8_t {
+    none,
+    safe, // only functions that are never used as an address, only called
+    all // functions and read only data
+};
+
+/**
+ * @brief --output-spec=<entry>:<object>,...:<output>, one of several executables that are linked from the same inputs
+ * The objects are only linked into this executable, the entry point and output name replace the ones of the options
+ */
+struct OutputSpec {
+    std::string_view entrySymbolName{};
+    std::vector<std::string_view> extraFilePaths{};
+    std::string_view outputFileName{};
+};
+
+/**
+ * @brief The symbol table of an archive, decoded once and kept as long as the archive is mapped (see MappedArchiveCache)
+ * Members are numbered within the archive, every link renumbers them among all of its archives. The names point into the archive
+ */
+struct ArchiveIndex {
+    // File offsets of the members that define symbols, in the order of the symbol table. The headers of these members are checked
+    std::vector<uint32_t> memberOffsets{};
+    // Every symbol of the archive with the position of its member in memberOffsets
+    std::vector<std::pair<std::string_view, uint32_t>> symbols{};
+};
+
 /**
  * @brief User specific options for the linker
  * 
@@ -16,6 +48,66 @@ struct LinkerOptions {
     std::string_view outputFileName = "a.out";
     std::string_view entrySymbolName = "_start";
     bool createEhFrameHeader = false;
+    // -O<level>, from 2 on suffixes of merged strings share the storage of the longer string
+    unsigned optimizationLevel = 0;
+    // Drop merged strings and constants from allocated sections if no relocation or symbol points to them
+    bool gcMergedPieces = false;
+    // Discard allocated sections that can't be reached from the entry point or other roots, implies gcMergedPieces
+    bool gcSections = false;
+    IdenticalCodeFolding identicalCodeFolding = IdenticalCodeFolding::none;
+    // Print some numbers about what the linker did
+    bool printStatistics = false;
+    // File with one symbol per line, their sections get placed first within their output sections, in the order the names first appear
+    std::string_view symbolOrderingFile{};
+    // Lay out executable sections by their call graph, unless there is a symbol ordering file
+    bool callGraphSort = false;
+    // Lines of "caller callee count" that weight the call graph instead of the relocations, implies callGraphSort
+    std::string_view callGraphProfileFile{};
+    // Segments are aligned to the max page size, -z max-page-size
+    size_t maxPageSize = 0x1000;
+    // -z common-page-size, accepted for compatibility and checked against maxPageSize, but the layout doesn't use it
+    size_t commonPageSize = 0x1000;
+    // Put the executable segment on its own 2 MiB aligned huge pages
+    bool hugePageText = false;
+    // -z separate-code, pad the file so that no page holds code and data. -z noseparate-code packs the segments instead
+    bool separateCode = true;
+    // --rosegment, read only data gets its own segment instead of sharing the executable one
+    bool separateReadOnlySegment = true;
+    // --sort-section=alignment, place the inputs of data sections by descending alignment to save padding
+    bool sortSectionsByAlignment = false;
+    // Order output sections by name and global symbols by resolution instead of by hash map iteration, so the output is the same everywhere
+    bool reproducible = false;
+    // Directory of earlier link results by a hash of their inputs and options. A link with the same hash copies the result instead.
+    // New options that change the output have to be added to the hash, see hashLinkInputs
+    std::string_view cacheDirectory{};
+    // Leave room behind every input section and record the layout next to the output, so the next --incremental link can patch changed objects in place
+    bool incremental = false;
+    // --server=<socket>, stay resident and link whatever clients send to the socket
+    std::string_view serverSocket{};
+    // --connect=<socket>, let the server at the socket do the link
+    std::string_view connectSocket{};
+    // -r, merge the inputs into one relocatable object instead of an executable. Relocations are kept for the final link instead of being applied
+    bool relocatable = false;
+    // Link one executable per spec instead of one from all inputs, the inputs are parsed once for all of them
+    std::vector<OutputSpec> outputSpecs{};
+    // Decoded archive symbol tables by input file index, e.g. from a MappedArchiveCache. Archives without one are decoded by the link
+    readonly_span<ArchiveIndex const*> archiveIndices{};
+    // Upstream of the arenas for the symbol table, extracted archive members and merged sections, and of the archive symbol table of --output-spec links.
+    // Only those use it, the std::vectors of the steps in between still come from the global heap. It has to be thread safe, like the default resource
+    std::pmr::memory_resource* memoryResource = std::pmr::get_default_resource();
+};
+
+/**
+ * @brief Where linkSourcesToExecutableElfImage() puts the executable
+ */
+struct OutputTarget {
+    enum class Kind : uint8_t {
+        file, // fileName, created or truncated
+        buffer, // the buffer of the caller, it has to hold the whole executable
+        memoryFile // a new memfd named fileName, the caller owns the descriptor and can e.g. fexecve() it
+    } kind = Kind::file;
+    std::string_view fileName{"a.out"};
+    std::span<std::byte> buffer{};
 };
 
 /**
@@ -28,11 +120,36 @@ struct MemoryMappings {
     ~MemoryMappings();
 };
 
+/**
+ * @brief Archives that stay mapped between links, for a linker that stays resident
+ * Archives are identified by device and inode, an archive with another size or modification time is mapped again.
+ * An archive whose path resolves to another file than before (e.g. it was rebuilt) is unmapped, unless the current link uses it through another path
+ */
+struct MappedArchiveCache {
+    struct Entry {
+        uint64_t size;
+        int64_t modificationSeconds;
+        int64_t modificationNanoseconds;
+        void* address;
+        // Decoded when the archive is mapped, links only renumber the members
+        ArchiveIndex index;
+    };
+    std::map<std::pair<uint64_t, uint64_t>, Entry> entries;
+    // The file each resolved path pointed to the last time it was linked
+    std::map<std::string, std::pair<uint64_t, uint64_t>, std::less<>> identitiesOfPaths;
+    ~MappedArchiveCache();
+};
+
 //
 namespace parametersFor {
 struct ArgumentsToLinkerParameters;
 struct FilePathsToMemoryMappings;
+struct FilePathsToCachedMemoryMappings;
+struct RunLinkServer;
+struct ForwardToLinkServer;
 struct LinkSourcesToExecutableElfFile;
+struct LinkSourcesToExecutableElfImage;
+struct LinkSourcesToExecutableElfFiles;
 } // namespace parametersFor
 
 /**
@@ -69,6 +186,56 @@ struct parametersFor::FilePathsToMemoryMappings {
     } out;
 };
 
+/**
+ * @brief Like filePathsToMemoryMappings, but archives come from the cache or are added to it
+ * Object files are mapped into memoryMappings as usual, addresses and memSizes have all files in the order of the paths.
+ * archiveIndices has the decoded symbol table of every archive and nullptr for object files, it goes into LinkerOptions::archiveIndices
+ */
+auto filePathsToCachedMemoryMappings(parametersFor::FilePathsToCachedMemoryMappings) -> StatusCode;
+struct parametersFor::FilePathsToCachedMemoryMappings {
+    struct {
+        readonly_span<std::string_view> filePaths;
+    } in;
+    struct {
+        inout<MappedArchiveCache> archiveCache;
+    } inout;
+    struct {
+        out<MemoryMappings> memoryMappings;
+        out<std::vector<void*>> addresses;
+        out<std::vector<size_t>> memSizes;
+        out<std::vector<ArchiveIndex const*>> archiveIndices;
+        out<size_t> numReusedArchives;
+    } out;
+};
+
+/**
+ * @brief Listens on a unix domain socket and links what forwardToLinkServer() sends
+ *
+ * Archives stay mapped in a MappedArchiveCache from one link to the next, so links against the same system archives skip opening, mapping and decoding them and their pages stay resident.
+ * Links are done one after another, each with the working directory of the client and with the diagnostics going to the stderr of the client.
+ * Only returns if the socket can't be used
+ */
+auto runLinkServer(parametersFor::RunLinkServer) -> StatusCode;
+struct parametersFor::RunLinkServer {
+    struct {
+        std::string_view socketPath;
+    } in;
+};
+
+/**
+ * @brief Sends the arguments and the working directory to the link server and waits for the status of the link
+ */
+auto forwardToLinkServer(parametersFor::ForwardToLinkServer) -> StatusCode;
+struct parametersFor::ForwardToLinkServer {
+    struct {
+        std::string_view socketPath;
+        readonly_span<char*> arguments;
+    } in;
+    struct {
+        out<StatusCode> linkStatus;
+    } out;
+};
+
 auto linkSourcesToExecutableElfFile(parametersFor::LinkSourcesToExecutableElfFile) -> StatusCode;
 struct parametersFor::LinkSourcesToExecutableElfFile {
     struct {
@@ -78,4 +245,43 @@ struct parametersFor::LinkSourcesToExecutableElfFile {
     } in;
 };
 
-} // namespace cppld
\ No newline at end of file
+/**
+ * @brief Like linkSourcesToExecutableElfFile(), but the executable goes to the target and options.outputFileName is not used
+ *
+ * outputSize is the size of the executable, also if the buffer of the target is too small for it, so the caller can link again with a larger one.
+ * memoryFileDescriptor is -1 unless a memory file was created.
+ * Buffers and memory files don't touch the file system, --cache-dir and --incremental need a file to work with.
+ * options.memoryResource only backs the arenas of the link, the other allocations of the link still go to the global heap
+ */
+auto linkSourcesToExecutableElfImage(parametersFor::LinkSourcesToExecutableElfImage) -> StatusCode;
+struct parametersFor::LinkSourcesToExecutableElfImage {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+        in<LinkerOptions> options;
+        in<OutputTarget> target;
+    } in;
+    struct {
+        out<size_t> outputSize;
+        out<int> memoryFileDescriptor;
+    } out;
+};
+
+/**
+ * @brief Links one executable per options.outputSpecs, each from the sources and the extra files of its spec
+ *
+ * extraAddresses holds the extra files of all specs, in the order of the specs. They have to be object files and come after the sources of every output.
+ * The sources are parsed once and only read after that. Symbol resolution, layout and writing are done for all outputs in parallel
+ */
+auto linkSourcesToExecutableElfFiles(parametersFor::LinkSourcesToExecutableElfFiles) -> StatusCode;
+struct parametersFor::LinkSourcesToExecutableElfFiles {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+        readonly_span<void*> extraAddresses;
+        readonly_span<size_t> extraMemorySizes;
+        in<LinkerOptions> options;
+    } in;
+};
+
+} // namespace cppld
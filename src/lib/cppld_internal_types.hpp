@@ -3,6 +3,7 @@
 #include "cppld_api_types.hpp"
 #include "reference_types.hpp"
 
+#include <limits>
 #include <variant>
 
 namespace cppld {
@@ -15,12 +16,22 @@ using Vector2D = std::vector<std::vector<T>>;
 // Section ID, since there are only a couple of possible output sections, a smaller integer type can be used
 using OutSectionID = uint16_t;
 
+// Whether an input section makes it to the output. No boolean, so the states can be written concurrently
+enum class InputSectionState : uint8_t {
+    live = 0,
+    discarded, // e.g. unreachable with --gc-sections
+    folded // identical to another section that takes its place (--icf)
+};
+
 // For Section merges different parts of a section get moved to different locations.
 // This information is saved to find addresses of symbols
 struct PartCopy {
     size_t size; // How much is copied.
     size_t dstOffset; // Where it is copied to relative to an output section
 };
+// Merged pieces that nothing refers to can be dropped after the relocations are known.
+// They keep their place in the copy commands, so the input offsets still add up, but are not copied
+constexpr size_t droppedPieceOffset{std::numeric_limits<size_t>::max()};
 
 // Probably the most useful construct for std::variant.
 // See https://en.cppreference.com/w/cpp/utility/variant/visit
@@ -45,7 +56,7 @@ struct ProcessedRela {
     enum class Note : uint16_t { // Would be in the padding bytes
         none = 0,
         undefinedWeak,
-        absoluteValue
+        absoluteValue // symbolValue is S itself (SHN_ABS or a discarded section), not relative to symbolSectionID
     } note;
 };
 static_assert(sizeof(ProcessedRela) == 4 * sizeof(size_t)); // Not much larger than an ELF64_Rela
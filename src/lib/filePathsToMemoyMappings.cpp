@@ -1,7 +1,14 @@
 #include "cppld.hpp"
+#include "parseInputAndCreateSymbolTable.hpp"
 #include "statusreport.hpp"
 #include "convenient_functions.hpp"
 
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <set>
+
+#include <ar.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -15,6 +22,11 @@ MemoryMappings::~MemoryMappings() {
     });
 }
 
+MappedArchiveCache::~MappedArchiveCache() {
+    for (auto& [identity, entry] : entries)
+        ::munmap(entry.address, entry.size);
+}
+
 auto filePathsToMemoryMappings(parametersFor::FilePathsToMemoryMappings p) -> StatusCode {
     auto& [filenames] = p.in;
     auto& [mappings] = p.out;
@@ -45,4 +57,93 @@ auto filePathsToMemoryMappings(parametersFor::FilePathsToMemoryMappings p) -> St
     }
     return StatusCode::ok;
 }
+
+auto filePathsToCachedMemoryMappings(parametersFor::FilePathsToCachedMemoryMappings p) -> StatusCode {
+    auto& [filenames] = p.in;
+    auto& [archiveCache] = p.inout;
+    auto& [mappings, addresses, memSizes, archiveIndices, numReusedArchives] = p.out;
+
+    addresses.reserve(filenames.size());
+    memSizes.reserve(filenames.size());
+    archiveIndices.reserve(filenames.size());
+    numReusedArchives = 0;
+
+    std::set<std::pair<uint64_t, uint64_t>> identitiesInThisLink;
+    auto evict = [&](std::pair<uint64_t, uint64_t> identity) {
+        auto evicted = archiveCache.entries.find(identity);
+        if (evicted == archiveCache.entries.end()) return;
+        ::munmap(evicted->second.address, evicted->second.size);
+        archiveCache.entries.erase(evicted);
+    };
+
+    for (auto& filename : filenames) {
+        struct CloseFDOnExit {
+            int fd;
+            operator int() const { return fd; }
+            ~CloseFDOnExit() {
+                if (fd >= 0) ::close(fd);
+            }
+        } fd{::open(filename.data(), O_RDONLY)};
+        if (fd == -1) return report(StatusCode::not_ok, "could not open file: ", filename);
+
+        struct stat mstat {};
+        if (::fstat(fd, &mstat) == -1) return report(StatusCode::not_ok, "can't read file stats for: ", filename);
+        if (!S_ISREG(mstat.st_mode)) return report(StatusCode::not_ok, "file is not regular: ", filename);
+        size_t memSize = static_cast<size_t>(mstat.st_size);
+        std::pair<uint64_t, uint64_t> identity{mstat.st_dev, mstat.st_ino};
+        identitiesInThisLink.insert(identity);
+
+        // Relative paths depend on the working directory of the client
+        std::unique_ptr<char, decltype(&::free)> resolvedPath{::realpath(filename.data(), nullptr), &::free};
+        std::string_view path = resolvedPath ? std::string_view{resolvedPath.get()} : filename;
+        if (auto known = archiveCache.identitiesOfPaths.find(path); known != archiveCache.identitiesOfPaths.end() && known->second != identity) {
+            if (!identitiesInThisLink.contains(known->second)) evict(known->second);
+            archiveCache.identitiesOfPaths.erase(known);
+        }
+
+        auto cached = archiveCache.entries.find(identity);
+        if (cached != archiveCache.entries.end()) {
+            auto& entry = cached->second;
+            if (entry.size == memSize && entry.modificationSeconds == mstat.st_mtim.tv_sec && entry.modificationNanoseconds == mstat.st_mtim.tv_nsec) {
+                archiveCache.identitiesOfPaths.insert_or_assign(std::string{path}, identity);
+                addresses.push_back(entry.address);
+                memSizes.push_back(memSize);
+                archiveIndices.push_back(&entry.index);
+                ++numReusedArchives;
+                continue;
+            }
+            evict(identity);
+        }
+
+        auto address = ::mmap(nullptr, memSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) return report(StatusCode::not_ok, "unable to memory map file: ", filename);
+
+        if (memSize >= SARMAG && std::memcmp(address, ARMAG, SARMAG) == 0) {
+            // The symbol table is decoded once, the next links only renumber the members
+            ArchiveIndex index;
+            if (auto status = decodeArchiveIndex({.in{static_cast<std::byte*>(address), memSize, addresses.size()}, .out{index}}); status != StatusCode::ok) {
+                ::munmap(address, memSize);
+                return status;
+            }
+            // The next links find the archive mapped and its pages resident
+            ::madvise(address, memSize, MADV_WILLNEED);
+            archiveCache.identitiesOfPaths.insert_or_assign(std::string{path}, identity);
+            auto entry = archiveCache.entries.emplace(identity,
+                                                      MappedArchiveCache::Entry{.size = memSize,
+                                                                                .modificationSeconds = mstat.st_mtim.tv_sec,
+                                                                                .modificationNanoseconds = mstat.st_mtim.tv_nsec,
+                                                                                .address = address,
+                                                                                .index = std::move(index)})
+                             .first;
+            archiveIndices.push_back(&entry->second.index);
+        } else {
+            mappings.addresses.push_back(address);
+            mappings.memSizes.push_back(memSize);
+            archiveIndices.push_back(nullptr);
+        }
+        addresses.push_back(address);
+        memSizes.push_back(memSize);
+    }
+    return StatusCode::ok;
+}
 } // namespace cppld
\ No newline at end of file
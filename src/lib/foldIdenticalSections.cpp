@@ -0,0 +1,308 @@
+#include "foldIdenticalSections.hpp"
+#include "convenient_functions.hpp"
+#include "splitSectionIntoPieces.hpp"
+#include "statusreport.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <numeric>
+using namespace std::literals;
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+constexpr uint32_t notACandidate{std::numeric_limits<uint32_t>::max()};
+// Below this number of sections, spawning threads costs more than hashing
+constexpr size_t minCandidatesForParallelHashing{256};
+
+// A relocation reduced to what decides whether two sections behave the same
+struct FoldRela {
+    uint64_t offset;
+    int64_t addend;
+    uint64_t targetValue;
+    SectionRef target; // Only meaningful if the target is not a candidate itself
+    uint32_t type;
+    uint32_t targetCandidate;
+};
+
+struct FoldCandidate {
+    SectionRef secRef;
+    std::vector<FoldRela> relas;
+    uint64_t constantHash;
+};
+
+constexpr auto combineHash(uint64_t h, uint64_t value) -> uint64_t {
+    return h ^ (value + 0x9e3779b97f4a7c15ull + (h << 6u) + (h >> 2u));
+}
+
+auto isFoldable(Elf64_Shdr const& header, std::string_view name, IdenticalCodeFolding mode) -> bool {
+    if (header.sh_type != SHT_PROGBITS || header.sh_size == 0) return false;
+    if (!(header.sh_flags & SHF_ALLOC) || (header.sh_flags & (SHF_WRITE | SHF_MERGE | SHF_TLS))) return false;
+    // The pieces of .init and .fini only work together as a single function
+    if (name == ".init"sv || name == ".fini"sv || name == ".eh_frame"sv) return false;
+    if (mode == IdenticalCodeFolding::safe) return header.sh_flags & SHF_EXECINSTR;
+    return true;
+}
+
+// Calls to local functions get a plain pc relative relocation, so the opcode in front of it decides
+auto isCall(Elf64_Shdr const& header, readonly_span<char> content, Elf64_Rela const& rela) -> bool {
+    constexpr unsigned char callOpcode{0xe8};
+    constexpr unsigned char jmpOpcode{0xe9};
+    auto type = ELF64_R_TYPE(rela.r_info);
+    if (type == R_X86_64_PLT32) return true;
+    if (type != R_X86_64_PC32 || !(header.sh_flags & SHF_EXECINSTR)) return false;
+    if (rela.r_offset == 0 || rela.r_offset > content.size()) return false;
+    auto opcode = static_cast<unsigned char>(content[rela.r_offset - 1]);
+    return opcode == callOpcode || opcode == jmpOpcode;
+}
+
+} // namespace
+
+auto foldIdenticalSections(parametersFor::FoldIdenticalSections p) -> StatusCode {
+    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, mode] = p.in;
+    auto& [sectionStates] = p.inout;
+    auto& [foldedSections, numIterations] = p.out;
+    foldedSections.clear();
+    numIterations = 0;
+    if (mode == IdenticalCodeFolding::none) return StatusCode::ok;
+
+    auto headerOf = [&](SectionRef const& secRef) -> Elf64_Shdr const& {
+        return sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+    };
+    auto nameOf = [&](SectionRef const& secRef) {
+        return std::string_view{sectionStringTables[secRef.elfIndex] + headerOf(secRef).sh_name};
+    };
+    auto contentOf = [&](SectionRef const& secRef) {
+        auto& header = headerOf(secRef);
+        return view_as_span<char>(elfAddresses[secRef.elfIndex] + header.sh_offset, header.sh_size);
+    };
+
+    // The relocation section that applies to a section, zero if there is none
+    Vector2D<uint32_t> relaSections(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        relaSections[elfID].resize(headers.size(), 0);
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (header.sh_type == SHT_RELA && header.sh_entsize == sizeof(Elf64_Rela) && header.sh_info < headers.size())
+                relaSections[elfID][header.sh_info] = static_cast<uint32_t>(headerID);
+        });
+    });
+
+    // Calls f(rela, target section, symbol value) for every relocation of a section
+    auto forEachRela = [&](SectionRef const& secRef, auto f) {
+        auto elfID = secRef.elfIndex;
+        auto relaSectionID = relaSections[elfID][secRef.headerIndex];
+        if (relaSectionID == 0) return;
+        auto& headers = sectionHeaders[elfID];
+        auto address = elfAddresses[elfID];
+        auto& relaHeader = headers[relaSectionID];
+        auto relas = view_as_span<Elf64_Rela>(address + relaHeader.sh_offset, relaHeader.sh_size / sizeof(Elf64_Rela));
+        auto& symTabHeader = headers[relaHeader.sh_link];
+        auto symbols = view_as_span<Elf64_Sym>(address + symTabHeader.sh_offset, symTabHeader.sh_size / sizeof(Elf64_Sym));
+        auto& symStrTabHeader = headers[symTabHeader.sh_link];
+        auto symStrings = estd::start_lifetime_as_array<char>(address + symStrTabHeader.sh_offset, symStrTabHeader.sh_size);
+
+        for (auto& rela : relas) {
+            auto& sym = symbols[ELF64_R_SYM(rela.r_info)];
+            if (ELF64_ST_BIND(sym.st_info) == STB_LOCAL) {
+                f(rela, SectionRef{elfID, sym.st_shndx}, sym.st_value);
+                continue;
+            }
+            auto it = symbolTable.find(std::string_view{symStrings + sym.st_name});
+            if (it == symbolTable.end() || !it->second.firstLoad.symbol) {
+                f(rela, SectionRef{0, SHN_UNDEF}, uint64_t{0});
+                continue;
+            }
+            auto& definition = it->second.firstLoad;
+            f(rela, SectionRef{definition.elfID, definition.symbol->st_shndx}, definition.symbol->st_value);
+        }
+    };
+    auto isInputSection = [&](SectionRef const& secRef) {
+        return secRef.headerIndex != SHN_UNDEF && secRef.headerIndex < sectionHeaders[secRef.elfIndex].size();
+    };
+
+    // With safe folding, only functions that are exclusively called may be folded. Everything else might get compared by address
+    Vector2D<uint8_t> addressTaken(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        addressTaken[elfID].resize(headers.size(), 0);
+    });
+    if (mode == IdenticalCodeFolding::safe) {
+        parallel_for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+            for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+                SectionRef secRef{elfID, headerID};
+                // Unwind information and debug info refer to every function, but don't use the address in the program
+                if (!(header.sh_flags & SHF_ALLOC) || sectionStates[elfID][headerID] != InputSectionState::live || nameOf(secRef) == ".eh_frame"sv) return;
+                auto content = contentOf(secRef);
+                forEachRela(secRef, [&](Elf64_Rela const& rela, SectionRef target, uint64_t) {
+                    if (!isInputSection(target) || isCall(header, content, rela)) return;
+                    std::atomic_ref{addressTaken[target.elfIndex][target.headerIndex]}.store(1);
+                });
+            });
+        });
+    }
+
+    std::vector<FoldCandidate> candidates;
+    Vector2D<uint32_t> candidateIndices(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        candidateIndices[elfID].resize(headers.size(), notACandidate);
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            SectionRef secRef{elfID, headerID};
+            if (sectionStates[elfID][headerID] != InputSectionState::live || addressTaken[elfID][headerID] || !isFoldable(header, nameOf(secRef), mode)) return;
+            candidateIndices[elfID][headerID] = static_cast<uint32_t>(candidates.size());
+            candidates.push_back({.secRef = secRef, .relas = {}, .constantHash = 0});
+        });
+    });
+    if (candidates.size() < 2) return StatusCode::ok;
+
+    auto forEachCandidate = [&](auto f) {
+        if (candidates.size() >= minCandidatesForParallelHashing) {
+            parallel_for_each_indexed(candidates, f);
+        } else {
+            for_each_indexed(candidates, f);
+        }
+    };
+
+    // Everything that doesn't depend on other candidates is hashed once
+    forEachCandidate([&](FoldCandidate& candidate, size_t) {
+        forEachRela(candidate.secRef, [&](Elf64_Rela const& rela, SectionRef target, uint64_t targetValue) {
+            auto targetCandidate = isInputSection(target) ? candidateIndices[target.elfIndex][target.headerIndex] : notACandidate;
+            candidate.relas.push_back({.offset = rela.r_offset,
+                                       .addend = rela.r_addend,
+                                       .targetValue = targetValue,
+                                       .target = targetCandidate == notACandidate ? target : SectionRef{0, 0},
+                                       .type = static_cast<uint32_t>(ELF64_R_TYPE(rela.r_info)),
+                                       .targetCandidate = targetCandidate});
+        });
+        std::sort(candidate.relas.begin(), candidate.relas.end(), [](FoldRela const& a, FoldRela const& b) { return a.offset < b.offset; });
+
+        auto& header = headerOf(candidate.secRef);
+        auto h = hashPiece(contentOf(candidate.secRef));
+        h = combineHash(h, header.sh_flags);
+        h = combineHash(h, header.sh_addralign);
+        for (auto& rela : candidate.relas) {
+            h = combineHash(h, rela.offset);
+            h = combineHash(h, rela.type);
+            h = combineHash(h, static_cast<uint64_t>(rela.addend));
+            h = combineHash(h, rela.targetValue);
+            if (rela.targetCandidate == notACandidate) {
+                h = combineHash(h, rela.target.elfIndex);
+                h = combineHash(h, rela.target.headerIndex);
+            }
+        }
+        candidate.constantHash = h;
+    });
+
+    auto equalsConstant = [&](FoldCandidate const& a, FoldCandidate const& b) {
+        auto& headerA = headerOf(a.secRef);
+        auto& headerB = headerOf(b.secRef);
+        if (headerA.sh_size != headerB.sh_size || headerA.sh_flags != headerB.sh_flags || headerA.sh_addralign != headerB.sh_addralign)
+            return false;
+        if (a.relas.size() != b.relas.size()) return false;
+        auto contentA = contentOf(a.secRef);
+        if (std::memcmp(contentA.data(), contentOf(b.secRef).data(), contentA.size()) != 0) return false;
+        return std::equal(a.relas.begin(), a.relas.end(), b.relas.begin(), [](FoldRela const& x, FoldRela const& y) {
+            if (x.offset != y.offset || x.type != y.type || x.addend != y.addend || x.targetValue != y.targetValue) return false;
+            if ((x.targetCandidate == notACandidate) != (y.targetCandidate == notACandidate)) return false;
+            return x.targetCandidate != notACandidate ||
+                   (x.target.elfIndex == y.target.elfIndex && x.target.headerIndex == y.target.headerIndex);
+        });
+    };
+
+    // Splits every class into new classes of members that are equal. Members are sorted by key, so only members with equal keys get compared.
+    // The new class IDs only depend on the old classes and the keys, so the result is deterministic
+    auto refine = [&](std::vector<uint32_t> const& classOf, std::vector<uint64_t> const& keys, auto equals,
+                      std::vector<uint32_t>& newClassOf) -> size_t {
+        std::vector<uint32_t> order(candidates.size());
+        std::iota(order.begin(), order.end(), uint32_t{0});
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return std::tie(classOf[a], keys[a], a) < std::tie(classOf[b], keys[b], b);
+        });
+
+        std::vector<std::pair<size_t, size_t>> runs;
+        for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+            for (end = begin + 1; end < order.size() && classOf[order[end]] == classOf[order[begin]]; ++end) {}
+            runs.emplace_back(begin, end);
+        }
+
+        std::vector<uint32_t> localClassOf(candidates.size());
+        std::vector<size_t> numLocalClasses(runs.size());
+        auto splitRun = [&](std::pair<size_t, size_t> const& run, size_t runIndex) {
+            std::vector<uint32_t> representatives;
+            size_t firstWithKey{0};
+            for (auto i = run.first; i < run.second; ++i) {
+                auto member = order[i];
+                if (representatives.empty() || keys[representatives.back()] != keys[member]) firstWithKey = representatives.size();
+                auto repIt = std::find_if(representatives.begin() + static_cast<std::ptrdiff_t>(firstWithKey), representatives.end(),
+                                          [&](uint32_t rep) { return equals(candidates[rep], candidates[member]); });
+                localClassOf[member] = static_cast<uint32_t>(repIt - representatives.begin());
+                if (repIt == representatives.end()) representatives.push_back(member);
+            }
+            numLocalClasses[runIndex] = representatives.size();
+        };
+        if (runs.size() >= minCandidatesForParallelHashing) {
+            parallel_for_each_indexed(runs, splitRun);
+        } else {
+            for_each_indexed(runs, splitRun);
+        }
+
+        std::vector<size_t> firstClassOfRun(runs.size());
+        std::exclusive_scan(numLocalClasses.begin(), numLocalClasses.end(), firstClassOfRun.begin(), size_t{0});
+        newClassOf.resize(candidates.size());
+        for_each_indexed(runs, [&](std::pair<size_t, size_t> const& run, size_t runIndex) {
+            for (auto i = run.first; i < run.second; ++i)
+                newClassOf[order[i]] = static_cast<uint32_t>(firstClassOfRun[runIndex] + localClassOf[order[i]]);
+        });
+        return firstClassOfRun.back() + numLocalClasses.back();
+    };
+
+    std::vector<uint32_t> classOf(candidates.size(), 0);
+    std::vector<uint32_t> newClassOf;
+    std::vector<uint64_t> keys(candidates.size());
+    for_each_indexed(candidates, [&](FoldCandidate const& candidate, size_t i) { keys[i] = candidate.constantHash; });
+    auto numClasses = refine(classOf, keys, equalsConstant, newClassOf);
+    classOf.swap(newClassOf);
+
+    // Now the relocations to other candidates have to point to the same classes, which might split classes further
+    auto equalsVariable = [&](FoldCandidate const& a, FoldCandidate const& b) {
+        return std::equal(a.relas.begin(), a.relas.end(), b.relas.begin(), [&](FoldRela const& x, FoldRela const& y) {
+            return x.targetCandidate == notACandidate || classOf[x.targetCandidate] == classOf[y.targetCandidate];
+        });
+    };
+    while (numClasses != candidates.size()) {
+        ++numIterations;
+        forEachCandidate([&](FoldCandidate const& candidate, size_t i) {
+            uint64_t h{0};
+            for (auto& rela : candidate.relas) {
+                if (rela.targetCandidate != notACandidate) h = combineHash(h, classOf[rela.targetCandidate]);
+            }
+            keys[i] = h;
+        });
+        auto numRefinedClasses = refine(classOf, keys, equalsVariable, newClassOf);
+        classOf.swap(newClassOf);
+        if (numRefinedClasses == numClasses) break;
+        numClasses = numRefinedClasses;
+    }
+
+    // The first member in output order is kept, all others are folded into it
+    std::vector<uint32_t> order(candidates.size());
+    std::iota(order.begin(), order.end(), uint32_t{0});
+    auto outputOrder = [&](uint32_t i) {
+        auto& secRef = candidates[i].secRef;
+        return std::tuple{classOf[i], sortKeys[secRef.elfIndex], secRef.headerIndex};
+    };
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return outputOrder(a) < outputOrder(b); });
+    auto keeper = order.front();
+    for (size_t i = 1; i < order.size(); ++i) {
+        if (classOf[order[i]] != classOf[keeper]) {
+            keeper = order[i];
+            continue;
+        }
+        auto& folded = candidates[order[i]].secRef;
+        sectionStates[folded.elfIndex][folded.headerIndex] = InputSectionState::folded;
+        foldedSections.push_back({.folded = folded, .keptSection = candidates[keeper].secRef});
+    }
+    return StatusCode::ok;
+}
+
+} // namespace cppld
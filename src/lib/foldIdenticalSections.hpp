@@ -0,0 +1,42 @@
+#pragma once
+#include "cppld.hpp"
+#include "cppld_internal_types.hpp"
+
+namespace cppld {
+
+namespace parametersFor {
+struct FoldIdenticalSections;
+} // namespace parametersFor
+
+struct FoldedSection {
+    SectionRef folded;
+    SectionRef keptSection; // Takes the place of the folded one
+};
+
+/**
+ * @brief Finds live read only sections with equal content and equal relocations (--icf) and marks all but one of them as folded
+ *
+ * Sections are first grouped by a hash of everything that doesn't depend on other sections (content, relocation types, addends, targets outside the candidates).
+ * Those groups are then refined by the groups of the candidate sections the relocations point to, until the number of groups stops changing.
+ * Hashing and refining run in parallel. The section that comes first in the output is kept
+ */
+auto foldIdenticalSections(parametersFor::FoldIdenticalSections) -> StatusCode;
+struct parametersFor::FoldIdenticalSections {
+    struct {
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<SortKey> sortKeys;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+        in<SymbolTable> symbolTable;
+        IdenticalCodeFolding mode;
+    } in;
+    struct {
+        inout<Vector2D<InputSectionState>> sectionStates;
+    } inout;
+    struct {
+        out<std::vector<FoldedSection>> foldedSections;
+        out<size_t> numIterations;
+    } out;
+};
+
+} // namespace cppld
@@ -0,0 +1,160 @@
+#include "garbageCollectSections.hpp"
+#include "convenient_functions.hpp"
+#include "statusreport.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+using namespace std::literals;
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+// Below this number of sections in one level of the mark phase, spawning threads costs more than scanning
+constexpr size_t minSectionsForParallelMark{256};
+
+// Sections the startup code or the loader use without a relocation pointing to them
+auto isRootSection(Elf64_Shdr const& header, std::string_view name) -> bool {
+    switch (header.sh_type) {
+        case SHT_INIT_ARRAY:
+        case SHT_FINI_ARRAY:
+        case SHT_PREINIT_ARRAY:
+        case SHT_NOTE:
+            return true;
+    }
+    if (header.sh_flags & SHF_GNU_RETAIN) return true;
+    if (name == ".init"sv || name == ".fini"sv) return true;
+
+    constexpr std::array<std::string_view, 6> rootPrefixes{
+        ".init_array",
+        ".fini_array",
+        ".preinit_array",
+        ".ctors",
+        ".dtors",
+        ".jcr"};
+    return std::any_of(rootPrefixes.begin(), rootPrefixes.end(), [&](std::string_view prefix) { return name.starts_with(prefix); });
+}
+
+auto isEhFrame(Elf64_Shdr const& header, std::string_view name) -> bool {
+    return header.sh_type == SHT_X86_64_UNWIND || name == ".eh_frame"sv;
+}
+
+// Same as in initOutputSections, these never reach the output anyway
+auto isCollectable(Elf64_Shdr const& header) -> bool {
+    switch (header.sh_type) {
+        case SHT_NULL:
+        case SHT_STRTAB:
+        case SHT_SYMTAB:
+        case SHT_GROUP:
+        case SHT_REL:
+        case SHT_RELA:
+            return false;
+    }
+    return header.sh_flags & SHF_ALLOC;
+}
+
+} // namespace
+
+auto garbageCollectSections(parametersFor::GarbageCollectSections p) -> StatusCode {
+    auto& [elfAddresses, sectionHeaders, sectionStringTables, symbolTable, entrySymbolInfo] = p.in;
+    auto& [sectionStates] = p.inout;
+
+    auto nameOf = [&](size_t elfID, Elf64_Shdr const& header) {
+        return std::string_view{sectionStringTables[elfID] + header.sh_name};
+    };
+
+    // Visited flags as bytes, so they can be claimed with an atomic exchange
+    Vector2D<uint8_t> visited(sectionHeaders.size());
+    // The relocation section that applies to a section, zero if there is none
+    Vector2D<uint32_t> relaSections(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        visited[elfID].resize(headers.size(), 0);
+        relaSections[elfID].resize(headers.size(), 0);
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (header.sh_type == SHT_RELA && header.sh_info < headers.size())
+                relaSections[elfID][header.sh_info] = static_cast<uint32_t>(headerID);
+        });
+    });
+
+    auto markLive = [&](size_t elfID, size_t headerID, std::vector<SectionRef>& next) {
+        // Also covers SHN_ABS and SHN_COMMON
+        if (headerID == SHN_UNDEF || headerID >= sectionHeaders[elfID].size()) return;
+        if (sectionStates[elfID][headerID] != InputSectionState::live) return;
+        if (std::atomic_ref{visited[elfID][headerID]}.exchange(1) == 0)
+            next.push_back({.elfIndex = elfID, .headerIndex = headerID});
+    };
+
+    std::vector<SectionRef> frontier;
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (!isCollectable(header)) return;
+            auto name = nameOf(elfID, header);
+            if (isRootSection(header, name) || isEhFrame(header, name))
+                markLive(elfID, headerID, frontier);
+        });
+    });
+    if (entrySymbolInfo.firstLoad.symbol)
+        markLive(entrySymbolInfo.firstLoad.elfID, entrySymbolInfo.firstLoad.symbol->st_shndx, frontier);
+
+    StatusCode status{StatusCode::ok};
+    auto scan = [&](SectionRef const& secRef, std::vector<SectionRef>& next) {
+        auto elfID = secRef.elfIndex;
+        auto& headers = sectionHeaders[elfID];
+        auto relaSectionID = relaSections[elfID][secRef.headerIndex];
+        if (relaSectionID == 0) return;
+
+        auto& relaHeader = headers[relaSectionID];
+        if (relaHeader.sh_entsize != sizeof(Elf64_Rela)) {
+            std::atomic_ref{status}.store(report(StatusCode::not_ok, "relocation not of the right size"));
+            return;
+        }
+        auto address = elfAddresses[elfID];
+        auto relas = view_as_span<Elf64_Rela>(address + relaHeader.sh_offset, relaHeader.sh_size / sizeof(Elf64_Rela));
+        auto& symTabHeader = headers[relaHeader.sh_link];
+        auto symbols = view_as_span<Elf64_Sym>(address + symTabHeader.sh_offset, symTabHeader.sh_size / sizeof(Elf64_Sym));
+        auto& symStrTabHeader = headers[symTabHeader.sh_link];
+        auto symStrings = estd::start_lifetime_as_array<char>(address + symStrTabHeader.sh_offset, symStrTabHeader.sh_size);
+
+        // Unwind information refers to every function it describes, only the personality routines and LSDAs are followed
+        auto followsCode = !isEhFrame(headers[secRef.headerIndex], nameOf(elfID, headers[secRef.headerIndex]));
+
+        for (auto& rela : relas) {
+            auto& sym = symbols[ELF64_R_SYM(rela.r_info)];
+            SectionRef target{elfID, sym.st_shndx};
+            if (ELF64_ST_BIND(sym.st_info) != STB_LOCAL) {
+                auto it = symbolTable.find(std::string_view{symStrings + sym.st_name});
+                if (it == symbolTable.end() || !it->second.firstLoad.symbol) continue;
+                target = {it->second.firstLoad.elfID, it->second.firstLoad.symbol->st_shndx};
+            }
+            if (target.headerIndex == SHN_UNDEF || target.headerIndex >= sectionHeaders[target.elfIndex].size()) continue;
+            if (!followsCode && (sectionHeaders[target.elfIndex][target.headerIndex].sh_flags & SHF_EXECINSTR)) continue;
+            markLive(target.elfIndex, target.headerIndex, next);
+        }
+    };
+
+    // Mark level by level
+    while (!frontier.empty()) {
+        Vector2D<SectionRef> nextPerSection(frontier.size());
+        auto scanIndexed = [&](SectionRef const& secRef, size_t index) { scan(secRef, nextPerSection[index]); };
+        if (frontier.size() >= minSectionsForParallelMark) {
+            parallel_for_each_indexed(frontier, scanIndexed);
+        } else {
+            for_each_indexed(frontier, scanIndexed);
+        }
+        frontier.clear();
+        for (auto& next : nextPerSection)
+            frontier.insert(frontier.end(), next.begin(), next.end());
+    }
+    if (status != StatusCode::ok) return status;
+
+    // Sweep. Only allocated sections can be discarded
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (isCollectable(header) && !visited[elfID][headerID])
+                sectionStates[elfID][headerID] = InputSectionState::discarded;
+        });
+    });
+    return StatusCode::ok;
+}
+
+} // namespace cppld
@@ -0,0 +1,34 @@
+#pragma once
+#include "cppld_internal_types.hpp"
+
+namespace cppld {
+
+namespace parametersFor {
+struct GarbageCollectSections;
+} // namespace parametersFor
+
+/**
+ * @brief Discards allocated input sections that can't be reached from the roots via relocations (--gc-sections)
+ *
+ * Roots are the section of the entry symbol, constructor and destructor arrays, .init/.fini, notes and sections with SHF_GNU_RETAIN.
+ * Unloaded sections (e.g. debug info) are always kept, but don't keep anything alive.
+ * .eh_frame is kept as well, but only keeps non-executable sections alive, otherwise every function with unwind info would be reachable.
+ * The FDEs of collected sections are dropped after the output sections are built, see removeDeadFrameDescriptions
+ * Sections that are already discarded (e.g. duplicate COMDAT groups) stay discarded and keep nothing alive.
+ * The reachability is marked level by level, sections of one level are scanned in parallel and claimed with atomic visited flags
+ */
+auto garbageCollectSections(parametersFor::GarbageCollectSections) -> StatusCode;
+struct parametersFor::GarbageCollectSections {
+    struct {
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+        in<SymbolTable> symbolTable;
+        in<GlobalSymbolTableEntry> entrySymbolInfo;
+    } in;
+    struct {
+        inout<Vector2D<InputSectionState>> sectionStates;
+    } inout;
+};
+
+} // namespace cppld
@@ -0,0 +1,767 @@
+#include "incrementalLink.hpp"
+#include "convenient_functions.hpp"
+#include "linkResultCache.hpp"
+#include "mapInputSectionsToOutputSections.hpp"
+#include "parseInputAndCreateSymbolTable.hpp"
+#include "statusreport.hpp"
+#include "writeLinkingResultsToFile.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+constexpr std::array<char, 8> stateMagic{'c', 'p', 'p', 'l', 'd', 'i', 'n', 'c'};
+// Has to change whenever the layout of the state file or the placement rules change
+constexpr uint64_t stateVersion{1};
+
+// Where a section of an input object ended up in the output
+struct SectionPlacement {
+    LinkCacheKey shapeKey; // Name, type, flags, alignment and the sections it links to
+    LinkCacheKey contentKey; // Only for merged sections, those have to stay the same
+    OutSectionID outSectionID;
+    SectionMemCopies copyCommands;
+    size_t slotSize; // How large a concatenated section may grow
+};
+
+struct InputRecord {
+    LinkCacheKey fileKey;
+    bool isObject; // Archives are only compared
+    LinkCacheKey symbolsKey;
+    size_t firstLocalSymbolIndex; // In the output symbol table
+    std::vector<SectionPlacement> sections;
+};
+
+// Identifies one version of the output file
+struct OutputStamp {
+    uint64_t size;
+    uint64_t inode;
+    int64_t modificationSeconds;
+    int64_t modificationNanoseconds;
+    auto operator==(OutputStamp const&) const -> bool = default;
+};
+
+struct IncrementalLinkState {
+    LinkCacheKey optionsKey;
+    OutputStamp outputStamp;
+    std::vector<InputRecord> inputs;
+};
+
+struct FileDescriptor {
+    int fd;
+    operator int() const { return fd; }
+    ~FileDescriptor() {
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+template <typename T>
+auto bytesOf(T const& value) -> readonly_span<std::byte> {
+    return {reinterpret_cast<std::byte const*>(&value), sizeof(T)};
+}
+
+auto combineKeys(LinkCacheKey const& first, LinkCacheKey const& second) -> LinkCacheKey {
+    std::array<LinkCacheKey, 2> keys{first, second};
+    return hashBytes(bytesOf(keys));
+}
+
+auto sectionShapeKey(Elf64_Shdr const& header, const char* sectionStringTable) -> LinkCacheKey {
+    std::string_view name{sectionStringTable + header.sh_name};
+    std::array<uint64_t, 6> fields{header.sh_type, header.sh_flags, header.sh_addralign, header.sh_entsize, header.sh_link, header.sh_info};
+    return combineKeys(hashBytes({reinterpret_cast<std::byte const*>(name.data()), name.size()}), hashBytes(bytesOf(fields)));
+}
+
+// Names, bindings and sections of all symbols. Global definitions have to keep their values, too: other inputs were relocated against them
+auto symbolsKey(std::byte* elfAddress, readonly_span<Elf64_Shdr> headers) -> LinkCacheKey {
+    std::vector<std::byte> shape;
+    for (auto& header : headers) {
+        if (header.sh_type != SHT_SYMTAB) continue;
+        auto symbols = view_as_span<Elf64_Sym>(elfAddress + header.sh_offset, header.sh_size / sizeof(Elf64_Sym));
+        auto symStrings = estd::start_lifetime_as_array<char>(elfAddress + headers[header.sh_link].sh_offset, headers[header.sh_link].sh_size);
+        for (size_t i{1}; i < symbols.size(); ++i) {
+            auto& sym = symbols[i];
+            std::string_view name{symStrings + sym.st_name};
+            auto nameBytes = reinterpret_cast<std::byte const*>(name.data());
+            shape.insert(shape.end(), nameBytes, nameBytes + name.size() + 1);
+            bool isGlobalDefinition = ELF64_ST_BIND(sym.st_info) != STB_LOCAL && sym.st_shndx != SHN_UNDEF;
+            std::array<uint64_t, 4> fields{sym.st_info, sym.st_other, sym.st_shndx, isGlobalDefinition ? sym.st_value : 0};
+            auto fieldBytes = bytesOf(fields);
+            shape.insert(shape.end(), fieldBytes.begin(), fieldBytes.end());
+        }
+    }
+    return hashBytes(shape);
+}
+
+// The same rule synthesizeSyntheticSections follows: local symbols of sections that are not loaded are left out
+template <typename OutSectionOf>
+auto isLocalSymbolInOutput(Elf64_Sym const& sym, size_t numInputSections, OutSectionOf outSectionOf, readonly_span<Elf64_Shdr> outputSectionHeaders) -> bool {
+    if (sym.st_shndx == SHN_ABS) return true;
+    if (sym.st_shndx >= numInputSections) return false;
+    OutSectionID outSectionID = outSectionOf(sym.st_shndx);
+    return outSectionID != meta::notAnOutputSection && (outputSectionHeaders[outSectionID + 1].sh_flags & SHF_ALLOC);
+}
+
+// The linker that runs is part of the key, another build may lay out the output differently
+auto computeOptionsKey(LinkerOptions const& options, LinkCacheKey& key) -> StatusCode {
+    std::array<std::string_view, 1> linkerPath{"/proc/self/exe"};
+    MemoryMappings linker;
+    if (auto status = filePathsToMemoryMappings({.in{linkerPath}, .out{linker}}); status != StatusCode::ok) return status;
+    std::vector<LinkCacheKey> linkerKey;
+    if (auto status = hashFileContents({.in{linker.addresses, linker.memSizes}, .out{linkerKey}}); status != StatusCode::ok) return status;
+    key = combineKeys(hashLinkOptions(options), linkerKey.front());
+    return StatusCode::ok;
+}
+
+auto stampOf(int fd, OutputStamp& stamp) -> bool {
+    struct stat fileStat {};
+    if (::fstat(fd, &fileStat) == -1) return false;
+    stamp = {.size = static_cast<uint64_t>(fileStat.st_size),
+             .inode = fileStat.st_ino,
+             .modificationSeconds = fileStat.st_mtim.tv_sec,
+             .modificationNanoseconds = fileStat.st_mtim.tv_nsec};
+    return true;
+}
+
+auto serializeState(IncrementalLinkState const& state) -> std::vector<std::byte> {
+    std::vector<std::byte> bytes;
+    auto append = [&](auto const& value) {
+        auto valueBytes = bytesOf(value);
+        bytes.insert(bytes.end(), valueBytes.begin(), valueBytes.end());
+    };
+    append(stateMagic);
+    append(stateVersion);
+    append(state.optionsKey);
+    append(state.outputStamp);
+    append(uint64_t{state.inputs.size()});
+    for (auto& input : state.inputs) {
+        append(input.fileKey);
+        append(uint8_t{input.isObject});
+        if (!input.isObject) continue;
+        append(input.symbolsKey);
+        append(uint64_t{input.firstLocalSymbolIndex});
+        append(uint64_t{input.sections.size()});
+        for (auto& section : input.sections) {
+            append(section.shapeKey);
+            append(section.outSectionID);
+            append(static_cast<uint8_t>(section.copyCommands.index()));
+            std::visit(overloaded{
+                           [&](PartCopy const& cmd) {
+                               append(cmd);
+                               append(uint64_t{section.slotSize});
+                           },
+                           [&](std::vector<PartCopy> const& cmds) {
+                               append(section.contentKey);
+                               append(uint64_t{cmds.size()});
+                               for (auto& cmd : cmds) append(cmd);
+                           },
+                           [](std::monostate) {}},
+                       section.copyCommands);
+        }
+    }
+    return bytes;
+}
+
+auto deserializeState(readonly_span<std::byte> bytes, IncrementalLinkState& state) -> bool {
+    size_t position{0};
+    bool isComplete{true};
+    auto read = [&]<typename T>(T& value) {
+        if (bytes.size() - position < sizeof(T)) {
+            isComplete = false;
+            return;
+        }
+        std::memcpy(&value, bytes.data() + position, sizeof(T));
+        position += sizeof(T);
+    };
+    // Counts are checked against what is left, so a damaged file can't request huge allocations
+    auto readCount = [&](size_t elementSize) -> size_t {
+        uint64_t count{0};
+        read(count);
+        if (count > (bytes.size() - position) / elementSize) isComplete = false;
+        return isComplete ? count : 0;
+    };
+
+    std::array<char, 8> magic{};
+    uint64_t version{0};
+    read(magic);
+    read(version);
+    if (!isComplete || magic != stateMagic || version != stateVersion) return false;
+    read(state.optionsKey);
+    read(state.outputStamp);
+    state.inputs.resize(readCount(sizeof(LinkCacheKey) + 1));
+    for (auto& input : state.inputs) {
+        uint8_t isObject{0};
+        read(input.fileKey);
+        read(isObject);
+        input.isObject = isObject != 0;
+        if (!input.isObject) continue;
+        uint64_t firstLocalSymbolIndex{0};
+        read(input.symbolsKey);
+        read(firstLocalSymbolIndex);
+        input.firstLocalSymbolIndex = firstLocalSymbolIndex;
+        input.sections.resize(readCount(sizeof(LinkCacheKey) + sizeof(OutSectionID) + 1));
+        for (auto& section : input.sections) {
+            uint8_t kind{0};
+            read(section.shapeKey);
+            read(section.outSectionID);
+            read(kind);
+            if (kind == 1) {
+                PartCopy cmd{};
+                uint64_t slotSize{0};
+                read(cmd);
+                read(slotSize);
+                section.copyCommands = cmd;
+                section.slotSize = slotSize;
+            } else if (kind == 2) {
+                read(section.contentKey);
+                std::vector<PartCopy> cmds(readCount(sizeof(PartCopy)));
+                for (auto& cmd : cmds) read(cmd);
+                section.copyCommands = std::move(cmds);
+            } else if (kind != 0) {
+                // Not a kind serializeState writes, the file is damaged
+                return false;
+            }
+        }
+        if (!isComplete) return false;
+    }
+    return isComplete && position == bytes.size();
+}
+
+auto readStateFile(std::string const& path, std::vector<std::byte>& bytes) -> bool {
+    FileDescriptor file{::open(path.c_str(), O_RDONLY)};
+    if (file == -1) return false;
+    struct stat fileStat {};
+    if (::fstat(file, &fileStat) == -1) return false;
+    bytes.resize(static_cast<size_t>(fileStat.st_size));
+    for (size_t position{0}; position < bytes.size();) {
+        auto numRead = ::read(file, bytes.data() + position, bytes.size() - position);
+        if (numRead <= 0) return false;
+        position += static_cast<size_t>(numRead);
+    }
+    return true;
+}
+
+// Written under a temporary name first, an interrupted link leaves the old state or none
+auto writeStateFile(std::string const& path, readonly_span<std::byte> bytes) -> StatusCode {
+    auto temporaryPath = path + ".tmp." + std::to_string(::getpid());
+    {
+        FileDescriptor file{::open(temporaryPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)};
+        if (file == -1) return report(StatusCode::system_failure, "could not open \"", temporaryPath, "\" to write the incremental link state");
+        for (size_t position{0}; position < bytes.size();) {
+            auto numWritten = ::write(file, bytes.data() + position, bytes.size() - position);
+            if (numWritten <= 0) {
+                ::unlink(temporaryPath.c_str());
+                return report(StatusCode::system_failure, "could not write the incremental link state to \"", temporaryPath, "\"");
+            }
+            position += static_cast<size_t>(numWritten);
+        }
+    }
+    if (::rename(temporaryPath.c_str(), path.c_str()) == -1) {
+        ::unlink(temporaryPath.c_str());
+        return report(StatusCode::system_failure, "could not move the incremental link state to \"", path, "\"");
+    }
+    return StatusCode::ok;
+}
+
+// What the patch needs to know about the output, read from its headers
+struct OutputView {
+    std::byte* mem;
+    size_t size;
+    readonly_span<Elf64_Shdr> sectionHeaders{}; // Starting with the null header, output section i has header i + 1
+    std::vector<size_t> sectionAddresses{};
+    size_t gotAddress{0};
+    size_t gotFileOffset{0};
+    size_t gotSize{0};
+    readonly_span<Elf64_Sym> symbols{};
+    size_t firstGlobalSymbol{0};
+    size_t symbolTableFileOffset{0};
+    readonly_span<char> symbolStrings{};
+};
+
+// Writes are only collected while checking, so the output stays untouched if the changes don't fit
+struct SectionCopy {
+    size_t filePos;
+    std::byte const* source;
+    size_t size;
+    size_t slotSize;
+};
+struct ValueWrite {
+    size_t filePos;
+    size_t value;
+    size_t size;
+};
+
+struct PlanObjectPatch {
+    struct {
+        std::byte* elfAddress;
+        readonly_span<Elf64_Shdr> headers;
+        const char* sectionStringTable;
+        in<OutputView> output;
+        in<std::unordered_map<std::string_view, size_t>> globalSymbolIndices;
+        in<std::unordered_map<size_t, size_t>> gotSlotsByAddress;
+    } in;
+    struct {
+        inout<InputRecord> record;
+    } inout;
+    struct {
+        out<std::vector<SectionCopy>> sectionCopies;
+        out<std::vector<ValueWrite>> valueWrites;
+        out<size_t> numPatchedSections;
+        out<std::string_view> fallbackReason;
+    } out;
+};
+
+auto planObjectPatch(PlanObjectPatch p) -> StatusCode {
+    auto& [elfAddress, headers, sectionStringTable, output, globalSymbolIndices, gotSlotsByAddress] = p.in;
+    auto& [record] = p.inout;
+    auto& [sectionCopies, valueWrites, numPatchedSections, fallbackReason] = p.out;
+    auto fallBack = [&](std::string_view reason) {
+        fallbackReason = reason;
+        return StatusCode::ok;
+    };
+
+    if (headers.size() != record.sections.size()) return fallBack("the sections of a changed object changed");
+    for (size_t headerIndex{0}; headerIndex < headers.size(); ++headerIndex) {
+        if (sectionShapeKey(headers[headerIndex], sectionStringTable) != record.sections[headerIndex].shapeKey)
+            return fallBack("the sections of a changed object changed");
+    }
+    if (symbolsKey(elfAddress, headers) != record.symbolsKey) return fallBack("the symbols of a changed object changed");
+
+    auto outSectionOf = [&](size_t headerIndex) { return record.sections[headerIndex].outSectionID; };
+    auto outputTypeOf = [&](OutSectionID outSectionID) { return output.sectionHeaders[outSectionID + 1].sh_type; };
+    auto fileOffsetOf = [&](OutSectionID outSectionID) { return output.sectionHeaders[outSectionID + 1].sh_offset; };
+    // The same mapping as inputToOutputSectionOffset, but a dropped merged piece is an error: nothing referred to it before
+    auto offsetInOutput = [&](size_t headerIndex, size_t offsetInInput, size_t& offset) -> bool {
+        return std::visit(overloaded{
+                              [&](PartCopy const& cmd) {
+                                  offset = offsetInInput + cmd.dstOffset;
+                                  return true;
+                              },
+                              [&](std::vector<PartCopy> const& cmds) {
+                                  for (size_t start{0}; auto& cmd : cmds) {
+                                      if (offsetInInput < start + cmd.size) {
+                                          offset = offsetInInput - start + cmd.dstOffset;
+                                          return cmd.dstOffset != droppedPieceOffset;
+                                      }
+                                      start += cmd.size;
+                                  }
+                                  return false;
+                              },
+                              [](std::monostate) { return false; }},
+                          record.sections[headerIndex].copyCommands);
+    };
+
+    // Section contents
+    for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerIndex) {
+        auto& placement = record.sections[headerIndex];
+        std::visit(overloaded{
+                       [&](PartCopy& cmd) {
+                           if (header.sh_size > placement.slotSize) {
+                               fallbackReason = "a changed section outgrew its slot";
+                               return;
+                           }
+                           // The rest of the slot is cleared, which would end a list early
+                           if (header.sh_size != placement.slotSize && !hasIncrementalSlot(header, sectionStringTable + header.sh_name)) {
+                               fallbackReason = "a changed list section changed its size";
+                               return;
+                           }
+                           cmd.size = header.sh_size;
+                           ++numPatchedSections;
+                           if (header.sh_type == SHT_NOBITS || outputTypeOf(placement.outSectionID) == SHT_NOBITS) return;
+                           if (fileOffsetOf(placement.outSectionID) + cmd.dstOffset + placement.slotSize > output.size) {
+                               fallbackReason = "a slot lies outside of the output";
+                               return;
+                           }
+                           sectionCopies.push_back({.filePos = fileOffsetOf(placement.outSectionID) + cmd.dstOffset,
+                                                    .source = elfAddress + header.sh_offset,
+                                                    .size = header.sh_size,
+                                                    .slotSize = placement.slotSize});
+                       },
+                       [&](std::vector<PartCopy> const&) {
+                           if (hashBytes({elfAddress + header.sh_offset, header.sh_size}) != placement.contentKey)
+                               fallbackReason = "a merged section changed";
+                       },
+                       [](std::monostate) {}},
+                   placement.copyCommands);
+    });
+    if (!fallbackReason.empty()) return StatusCode::ok;
+
+    // Relocations, resolved like processRelas does
+    auto needsGOTEntry = [](uint32_t type) {
+        switch (type) {
+            case R_X86_64_GOT32:
+            case R_X86_64_GOT64:
+            case R_X86_64_GOTPCREL:
+            case R_X86_64_GOTPCREL64:
+            case R_X86_64_GOTPCRELX:
+            case R_X86_64_REX_GOTPCRELX:
+                return true;
+        }
+        return false;
+    };
+    for (auto& header : headers) {
+        if (header.sh_type != SHT_RELA) continue;
+        if (header.sh_entsize != sizeof(Elf64_Rela) || header.sh_info >= headers.size() || header.sh_link >= headers.size())
+            return fallBack("a changed object has unusual relocations");
+        auto targetIndex = header.sh_info;
+        auto& target = record.sections[targetIndex];
+        if (std::holds_alternative<std::monostate>(target.copyCommands)) continue;
+        if (!std::holds_alternative<PartCopy>(target.copyCommands)) return fallBack("a merged section of a changed object has relocations");
+        bool targetIsLoaded = (headers[targetIndex].sh_flags & SHF_ALLOC) != 0;
+
+        auto& symTabHdr = headers[header.sh_link];
+        auto linkedSymbols = view_as_span<Elf64_Sym>(elfAddress + symTabHdr.sh_offset, symTabHdr.sh_size / sizeof(Elf64_Sym));
+        auto symStrings = estd::start_lifetime_as_array<char>(elfAddress + headers[symTabHdr.sh_link].sh_offset, headers[symTabHdr.sh_link].sh_size);
+        auto relas = view_as_span<Elf64_Rela>(elfAddress + header.sh_offset, header.sh_size / sizeof(Elf64_Rela));
+
+        for (auto& rela : relas) {
+            if (ELF64_R_SYM(rela.r_info) >= linkedSymbols.size()) return fallBack("a changed object has unusual relocations");
+            auto& sym = linkedSymbols[ELF64_R_SYM(rela.r_info)];
+            ProcessedRela resRela{.addend = rela.r_addend,
+                                  .outputSectionOffset = 0,
+                                  .symbolValue = 0,
+                                  .type = static_cast<uint32_t>(ELF64_R_TYPE(rela.r_info)),
+                                  .symbolSectionID = 0,
+                                  .note = ProcessedRela::Note::none};
+            std::ignore = offsetInOutput(targetIndex, rela.r_offset, resRela.outputSectionOffset);
+
+            if (sym.st_shndx == SHN_ABS) {
+                resRela.symbolValue = sym.st_value;
+                resRela.note = ProcessedRela::Note::absoluteValue;
+            } else if (ELF64_ST_BIND(sym.st_info) == STB_LOCAL) {
+                if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= headers.size()) return fallBack("a changed object has unusual symbols");
+                if (outSectionOf(sym.st_shndx) == meta::notAnOutputSection) {
+                    // Debug info may refer to discarded sections, loaded sections must not
+                    if (targetIsLoaded) return fallBack("a changed section refers to a discarded section");
+                    resRela.addend = 0;
+                    resRela.note = ProcessedRela::Note::absoluteValue;
+                } else {
+                    auto symbolOffset = sym.st_value;
+                    if (ELF64_ST_TYPE(sym.st_info) == STT_SECTION && std::holds_alternative<std::vector<PartCopy>>(record.sections[sym.st_shndx].copyCommands)) {
+                        symbolOffset = static_cast<size_t>(static_cast<int64_t>(symbolOffset) + resRela.addend);
+                        resRela.addend = 0;
+                    }
+                    if (!offsetInOutput(sym.st_shndx, symbolOffset, resRela.symbolValue))
+                        return fallBack("a changed section refers to a merged piece that was dropped");
+                    resRela.symbolSectionID = outSectionOf(sym.st_shndx);
+                }
+            } else {
+                std::string_view symName{symStrings + sym.st_name};
+                auto it = globalSymbolIndices.find(symName);
+                if (it == globalSymbolIndices.end() || it->second >= output.symbols.size())
+                    return fallBack("a changed object refers to a global symbol that is not in the output");
+                auto& definition = output.symbols[it->second];
+                auto address = definition.st_value;
+                if (definition.st_shndx == SHN_ABS) {
+                    resRela.symbolValue = definition.st_value;
+                    resRela.note = ProcessedRela::Note::absoluteValue;
+                } else {
+                    resRela.symbolSectionID = static_cast<OutSectionID>(definition.st_shndx - 1);
+                    resRela.symbolValue = definition.st_value - output.sectionAddresses[resRela.symbolSectionID];
+                }
+                if (needsGOTEntry(resRela.type)) {
+                    auto slot = gotSlotsByAddress.find(address);
+                    if (slot == gotSlotsByAddress.end()) return fallBack("a changed object needs a new GOT entry");
+                    resRela.symbolSectionID = 0;
+                    resRela.symbolValue = slot->second * sizeof(Elf64_Addr);
+                    resRela.note = ProcessedRela::Note::none;
+                } else if (resRela.type == R_X86_64_SIZE32 || resRela.type == R_X86_64_SIZE64) {
+                    resRela.symbolValue = sym.st_size;
+                }
+            }
+
+            size_t relaValue{};
+            size_t relaValueSize{};
+            off_t relaFilePos{};
+            auto relaStatus = prepareRelaWrite({.in{resRela,
+                                                    output.gotAddress,
+                                                    output.sectionAddresses,
+                                                    output.sectionAddresses[target.outSectionID],
+                                                    static_cast<off_t>(fileOffsetOf(target.outSectionID))},
+                                                .out{relaValue, relaValueSize, relaFilePos}});
+            if (relaStatus != StatusCode::ok) return relaStatus;
+            if (relaValueSize == 0) continue;
+            if (static_cast<size_t>(relaFilePos) + relaValueSize > output.size) return fallBack("a relocation points outside of the output");
+            valueWrites.push_back({.filePos = static_cast<size_t>(relaFilePos), .value = relaValue, .size = relaValueSize});
+        }
+    }
+
+    // Symbol values and sizes
+    auto writeSymbolField = [&](size_t symbolIndex, size_t fieldOffset, uint64_t value) {
+        valueWrites.push_back({.filePos = output.symbolTableFileOffset + symbolIndex * sizeof(Elf64_Sym) + fieldOffset, .value = value, .size = sizeof(uint64_t)});
+    };
+    auto symbolAddress = [&](Elf64_Sym const& sym) -> size_t {
+        if (sym.st_shndx == SHN_ABS) return sym.st_value;
+        size_t offset{0};
+        std::ignore = offsetInOutput(sym.st_shndx, sym.st_value, offset);
+        return output.sectionAddresses[outSectionOf(sym.st_shndx)] + offset;
+    };
+    auto outputSymbolName = [&](Elf64_Sym const& sym) -> std::string_view {
+        if (sym.st_name >= output.symbolStrings.size()) return {};
+        return {output.symbolStrings.data() + sym.st_name};
+    };
+    auto symbolIndex = record.firstLocalSymbolIndex;
+    for (auto& header : headers) {
+        if (header.sh_type != SHT_SYMTAB) continue;
+        auto symbols = view_as_span<Elf64_Sym>(elfAddress + header.sh_offset, header.sh_size / sizeof(Elf64_Sym));
+        auto symStrings = estd::start_lifetime_as_array<char>(elfAddress + headers[header.sh_link].sh_offset, headers[header.sh_link].sh_size);
+        for (size_t i{1}; i < symbols.size(); ++i) {
+            auto& sym = symbols[i];
+            std::string_view symName{symStrings + sym.st_name};
+            if (i < header.sh_info) {
+                if (!isLocalSymbolInOutput(sym, headers.size(), outSectionOf, output.sectionHeaders)) continue;
+                if (symbolIndex >= output.firstGlobalSymbol || outputSymbolName(output.symbols[symbolIndex]) != symName)
+                    return fallBack("the symbol table of the output doesn't match the state");
+                writeSymbolField(symbolIndex, offsetof(Elf64_Sym, st_value), symbolAddress(sym));
+                writeSymbolField(symbolIndex, offsetof(Elf64_Sym, st_size), sym.st_size);
+                ++symbolIndex;
+                continue;
+            }
+            // Global definitions keep their address. If it is still the one in the output, this object provides the symbol
+            if (sym.st_shndx == SHN_UNDEF || sym.st_shndx == SHN_COMMON || (sym.st_shndx >= headers.size() && sym.st_shndx != SHN_ABS)) continue;
+            if (sym.st_shndx != SHN_ABS && outSectionOf(sym.st_shndx) == meta::notAnOutputSection) continue;
+            auto it = globalSymbolIndices.find(symName);
+            if (it == globalSymbolIndices.end() || it->second >= output.symbols.size()) continue;
+            if (output.symbols[it->second].st_value == symbolAddress(sym))
+                writeSymbolField(it->second, offsetof(Elf64_Sym, st_size), sym.st_size);
+        }
+    }
+    return StatusCode::ok;
+}
+
+} // namespace
+
+auto incrementalLinkStatePath(std::string_view outputFileName) -> std::string {
+    return std::string{outputFileName} + ".cppld-state";
+}
+
+auto storeIncrementalLinkState(parametersFor::StoreIncrementalLinkState p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, options, elfAddresses, sectionHeaders, sectionStringTables,
+           inputToOutputSection, inputSectionCopyCommands, materializedViews, outputSectionHeaders] = p.in;
+
+    IncrementalLinkState state{};
+    if (auto status = computeOptionsKey(options, state.optionsKey); status != StatusCode::ok) return status;
+    std::vector<LinkCacheKey> fileKeys;
+    if (auto status = hashFileContents({.in{sourceAddresses, sourceMemorySizes}, .out{fileKeys}}); status != StatusCode::ok) return status;
+
+    // Object files given directly are used in place, so their elf address is the source address. Archive members are somewhere else
+    std::unordered_map<std::byte const*, size_t> elfIDOfAddress;
+    for_each_indexed(elfAddresses, [&](std::byte* address, size_t elfID) { elfIDOfAddress.emplace(address, elfID); });
+
+    // Local symbols are written per file, in the order of the elf IDs
+    std::vector<size_t> firstLocalSymbolIndices(elfAddresses.size());
+    size_t symbolIndex{1};
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        firstLocalSymbolIndices[elfID] = symbolIndex;
+        auto outSectionOf = [&](size_t headerIndex) { return inputToOutputSection[elfID][headerIndex]; };
+        for (auto& header : headers) {
+            if (header.sh_type != SHT_SYMTAB) continue;
+            auto symbols = view_as_span<Elf64_Sym>(elfAddresses[elfID] + header.sh_offset, header.sh_size / sizeof(Elf64_Sym));
+            for (size_t i{1}; i < header.sh_info && i < symbols.size(); ++i) {
+                if (isLocalSymbolInOutput(symbols[i], headers.size(), outSectionOf, outputSectionHeaders)) ++symbolIndex;
+            }
+        }
+    });
+
+    state.inputs.resize(sourceAddresses.size());
+    parallel_for_each_indexed(state.inputs, [&](InputRecord& record, size_t fileIndex) {
+        record.fileKey = fileKeys[fileIndex];
+        auto elfIDIt = elfIDOfAddress.find(static_cast<std::byte const*>(sourceAddresses[fileIndex]));
+        record.isObject = elfIDIt != elfIDOfAddress.end();
+        if (!record.isObject) return;
+
+        auto elfID = elfIDIt->second;
+        auto elfAddress = elfAddresses[elfID];
+        auto headers = sectionHeaders[elfID];
+        record.symbolsKey = symbolsKey(elfAddress, headers);
+        record.firstLocalSymbolIndex = firstLocalSymbolIndices[elfID];
+        record.sections.resize(headers.size());
+        for_each_indexed(record.sections, [&](SectionPlacement& section, size_t headerIndex) {
+            auto& header = headers[headerIndex];
+            section.shapeKey = sectionShapeKey(header, sectionStringTables[elfID]);
+            section.outSectionID = inputToOutputSection[elfID][headerIndex];
+            section.copyCommands = inputSectionCopyCommands[elfID][headerIndex];
+            if (auto cmd = std::get_if<PartCopy>(&section.copyCommands)) {
+                // Only concatenated output sections have slack, plain inputs of merged output sections have to stay within their size, and so do lists
+                auto hasSlot = !materializedViews[section.outSectionID] && hasIncrementalSlot(header, sectionStringTables[elfID] + header.sh_name);
+                section.slotSize = hasSlot ? incrementalSlotSize(cmd->size) : cmd->size;
+            } else if (std::holds_alternative<std::vector<PartCopy>>(section.copyCommands)) {
+                section.contentKey = hashBytes({elfAddress + header.sh_offset, header.sh_size});
+            }
+        });
+    });
+
+    {
+        FileDescriptor output{::open(std::string{options.outputFileName}.c_str(), O_RDONLY)};
+        if (output == -1 || !stampOf(output, state.outputStamp))
+            return report(StatusCode::system_failure, "can't read file stats for: ", options.outputFileName);
+    }
+    return writeStateFile(incrementalLinkStatePath(options.outputFileName), serializeState(state));
+}
+
+auto patchPreviousLinkResult(parametersFor::PatchPreviousLinkResult p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, options] = p.in;
+    auto& [isPatched, numChangedFiles, numPatchedSections, fallbackReason] = p.out;
+    isPatched = false;
+    numChangedFiles = 0;
+    numPatchedSections = 0;
+    fallbackReason = {};
+    auto fallBack = [&](std::string_view reason) {
+        fallbackReason = reason;
+        return StatusCode::ok;
+    };
+
+    // Folded sections share their bytes, a change to one of them is a change to all
+    if (options.identicalCodeFolding != IdenticalCodeFolding::none) return fallBack("identical code folding is enabled");
+
+    auto statePath = incrementalLinkStatePath(options.outputFileName);
+    std::vector<std::byte> stateBytes;
+    if (!readStateFile(statePath, stateBytes)) return fallBack("there is no state of an earlier incremental link");
+    IncrementalLinkState state{};
+    if (!deserializeState(stateBytes, state)) return fallBack("the state of the earlier link can't be read");
+
+    LinkCacheKey optionsKey{};
+    if (auto status = computeOptionsKey(options, optionsKey); status != StatusCode::ok) return status;
+    if (optionsKey != state.optionsKey) return fallBack("the options or the linker changed");
+    if (state.inputs.size() != sourceAddresses.size()) return fallBack("the number of inputs changed");
+
+    FileDescriptor outFD{::open(std::string{options.outputFileName}.c_str(), O_RDWR)};
+    OutputStamp stamp{};
+    if (outFD == -1 || !stampOf(outFD, stamp)) return fallBack("there is no earlier output");
+    if (stamp != state.outputStamp) return fallBack("the output was changed by something else");
+
+    std::vector<LinkCacheKey> fileKeys;
+    if (auto status = hashFileContents({.in{sourceAddresses, sourceMemorySizes}, .out{fileKeys}}); status != StatusCode::ok) return status;
+    std::vector<uint32_t> changedFileIndices;
+    for (size_t fileIndex{0}; fileIndex < fileKeys.size(); ++fileIndex) {
+        if (fileKeys[fileIndex] == state.inputs[fileIndex].fileKey) continue;
+        if (!state.inputs[fileIndex].isObject) return fallBack("an archive changed");
+        changedFileIndices.push_back(static_cast<uint32_t>(fileIndex));
+    }
+    numChangedFiles = changedFileIndices.size();
+    if (changedFileIndices.empty()) {
+        isPatched = true;
+        return StatusCode::ok;
+    }
+
+    std::vector<std::byte*> elfAddresses;
+    std::vector<SortKey> sortKeys;
+    std::vector<readonly_span<Elf64_Shdr>> sectionHeaders;
+    std::vector<const char*> sectionStringTables;
+    if (auto status = parseElfFiles({.in{sourceAddresses, sourceMemorySizes, changedFileIndices},
+                                     .out{elfAddresses, sortKeys, sectionHeaders, sectionStringTables}});
+        status != StatusCode::ok)
+        return status;
+    if (std::ranges::any_of(elfAddresses, [](std::byte* address) { return !address; }))
+        return fallBack("a changed input is not a relocatable object file");
+
+    struct UnMapOnExit {
+        std::byte* mem;
+        size_t size;
+        ~UnMapOnExit() {
+            if (mem) ::munmap(mem, size);
+        }
+    } mapping{nullptr, stamp.size};
+    auto mem = ::mmap(nullptr, stamp.size, PROT_READ | PROT_WRITE, MAP_SHARED, outFD, 0);
+    if (mem == MAP_FAILED) return report(StatusCode::system_failure, "Could not map \"", options.outputFileName, "\" to patch it");
+    mapping.mem = static_cast<std::byte*>(mem);
+
+    OutputView output{.mem = mapping.mem, .size = stamp.size};
+    {
+        Elf64_Ehdr elfHeader;
+        if (output.size < sizeof(Elf64_Ehdr)) return fallBack("the output is damaged");
+        std::memcpy(&elfHeader, output.mem, sizeof(Elf64_Ehdr));
+        if (elfHeader.e_shoff + elfHeader.e_shnum * sizeof(Elf64_Shdr) > output.size || elfHeader.e_shstrndx >= elfHeader.e_shnum)
+            return fallBack("the output is damaged");
+        output.sectionHeaders = view_as_span<Elf64_Shdr>(output.mem + elfHeader.e_shoff, elfHeader.e_shnum);
+
+        auto& shstrtab = output.sectionHeaders[elfHeader.e_shstrndx];
+        for (size_t headerIndex{1}; headerIndex < output.sectionHeaders.size(); ++headerIndex) {
+            auto& header = output.sectionHeaders[headerIndex];
+            output.sectionAddresses.push_back(header.sh_addr);
+            if (header.sh_offset + (header.sh_type == SHT_NOBITS ? 0 : header.sh_size) > output.size) return fallBack("the output is damaged");
+            if (header.sh_type == SHT_SYMTAB && header.sh_link < output.sectionHeaders.size()) {
+                auto& strtab = output.sectionHeaders[header.sh_link];
+                output.symbols = view_as_span<Elf64_Sym>(output.mem + header.sh_offset, header.sh_size / sizeof(Elf64_Sym));
+                output.firstGlobalSymbol = header.sh_info;
+                output.symbolTableFileOffset = header.sh_offset;
+                output.symbolStrings = {estd::start_lifetime_as_array<char>(output.mem + strtab.sh_offset, strtab.sh_size), strtab.sh_size};
+            }
+            if (header.sh_name < shstrtab.sh_size && std::string_view{estd::start_lifetime_as_array<char>(output.mem + shstrtab.sh_offset, shstrtab.sh_size) + header.sh_name} == ".got") {
+                output.gotAddress = header.sh_addr;
+                output.gotFileOffset = header.sh_offset;
+                output.gotSize = header.sh_size;
+            }
+        }
+        if (output.symbols.empty() || output.symbolStrings.empty() || output.symbolStrings.back() != '\0') return fallBack("the output is damaged");
+    }
+
+    // Only the globals the changed objects define or refer to are looked up
+    std::unordered_map<std::string_view, size_t> globalSymbolIndices;
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t changedID) {
+        auto elfAddress = elfAddresses[changedID];
+        for (auto& header : headers) {
+            if (header.sh_type != SHT_SYMTAB) continue;
+            auto symbols = view_as_span<Elf64_Sym>(elfAddress + header.sh_offset, header.sh_size / sizeof(Elf64_Sym));
+            auto symStrings = estd::start_lifetime_as_array<char>(elfAddress + headers[header.sh_link].sh_offset, headers[header.sh_link].sh_size);
+            for (size_t i{header.sh_info}; i < symbols.size(); ++i)
+                globalSymbolIndices.emplace(std::string_view{symStrings + symbols[i].st_name}, std::numeric_limits<size_t>::max());
+        }
+    });
+    for (size_t symbolIndex{output.firstGlobalSymbol}; symbolIndex < output.symbols.size(); ++symbolIndex) {
+        auto& sym = output.symbols[symbolIndex];
+        if (sym.st_name >= output.symbolStrings.size()) continue;
+        auto it = globalSymbolIndices.find(std::string_view{output.symbolStrings.data() + sym.st_name});
+        if (it != globalSymbolIndices.end() && it->second == std::numeric_limits<size_t>::max()) it->second = symbolIndex;
+    }
+
+    // GOT entries hold the addresses of the symbols, global symbols keep theirs. So does the entry, it only has to be found
+    std::unordered_map<size_t, size_t> gotSlotsByAddress;
+    for (size_t slot{meta::numReservedGotEntries}; slot < output.gotSize / sizeof(Elf64_Addr); ++slot) {
+        Elf64_Addr entry{};
+        std::memcpy(&entry, output.mem + output.gotFileOffset + slot * sizeof(Elf64_Addr), sizeof(entry));
+        gotSlotsByAddress.emplace(entry, slot);
+    }
+
+    std::vector<SectionCopy> sectionCopies;
+    std::vector<ValueWrite> valueWrites;
+    for_each_indexed(changedFileIndices, [&](uint32_t fileIndex, size_t changedID) {
+        if (!fallbackReason.empty()) return;
+        std::ignore = planObjectPatch({.in{elfAddresses[changedID], sectionHeaders[changedID], sectionStringTables[changedID],
+                                           output, globalSymbolIndices, gotSlotsByAddress},
+                                       .inout{state.inputs[fileIndex]},
+                                       .out{sectionCopies, valueWrites, numPatchedSections, fallbackReason}});
+    });
+    if (!fallbackReason.empty()) return StatusCode::ok;
+
+    // Everything fits, now the output is changed. Slots are cleared behind the section, like the padding of a full link
+    parallel_for_each_indexed(sectionCopies, [&](SectionCopy const& copy, size_t) {
+        std::memcpy(output.mem + copy.filePos, copy.source, copy.size);
+        std::memset(output.mem + copy.filePos + copy.size, 0, copy.slotSize - copy.size);
+    });
+    for (auto& write : valueWrites)
+        std::memcpy(output.mem + write.filePos, &write.value, write.size);
+
+    ::munmap(mapping.mem, mapping.size);
+    mapping.mem = nullptr;
+    if (::futimens(outFD, nullptr) == -1 || !stampOf(outFD, state.outputStamp))
+        return report(StatusCode::system_failure, "can't update file stats for: ", options.outputFileName);
+    for (auto fileIndex : changedFileIndices)
+        state.inputs[fileIndex].fileKey = fileKeys[fileIndex];
+    if (auto status = writeStateFile(statePath, serializeState(state)); status != StatusCode::ok) return status;
+
+    isPatched = true;
+    return StatusCode::ok;
+}
+
+} // namespace cppld
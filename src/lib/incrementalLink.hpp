@@ -0,0 +1,65 @@
+#pragma once
+#include "cppld.hpp"
+#include "cppld_internal_types.hpp"
+
+#include <string>
+
+namespace cppld {
+
+namespace parametersFor {
+struct StoreIncrementalLinkState;
+struct PatchPreviousLinkResult;
+} // namespace parametersFor
+
+// The layout of the last --incremental link is kept next to the output
+auto incrementalLinkStatePath(std::string_view outputFileName) -> std::string;
+
+/**
+ * @brief Records what a later incremental link needs to patch the output in place
+ *
+ * For every input its hash, for every input object file the placement of its sections, hashes of their shapes and of the symbol table,
+ * and where its local symbols start in the output symbol table.
+ * Output section addresses, GOT entries and global symbol values are in the output itself, so they are read from there instead.
+ * The size, inode and modification time of the output are recorded too, an output that was written by anything else is not patched
+ */
+auto storeIncrementalLinkState(parametersFor::StoreIncrementalLinkState) -> StatusCode;
+struct parametersFor::StoreIncrementalLinkState {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+        in<LinkerOptions> options;
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+        in<Vector2D<OutSectionID>> inputToOutputSection;
+        in<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
+        readonly_span<std::byte*> materializedViews;
+        readonly_span<Elf64_Shdr> outputSectionHeaders;
+    } in;
+};
+
+/**
+ * @brief Writes the changed input object files into the output of the last incremental link, if they still fit into it
+ *
+ * Everything else has to be as before: the options, the linker, the other inputs and the output file.
+ * A changed object has to have the same sections and symbols, only the contents and the sizes of sections may differ.
+ * Every section has to fit into the slot reserved for it, merged sections have to stay the same and global symbols keep their values.
+ * Then no other input is affected: the sections are copied into their slots, their relocations applied again and the local symbols updated.
+ * If anything doesn't hold, isPatched is false, the output is untouched and fallbackReason says why
+ */
+auto patchPreviousLinkResult(parametersFor::PatchPreviousLinkResult) -> StatusCode;
+struct parametersFor::PatchPreviousLinkResult {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+        in<LinkerOptions> options;
+    } in;
+    struct {
+        out<bool> isPatched;
+        out<size_t> numChangedFiles;
+        out<size_t> numPatchedSections;
+        out<std::string_view> fallbackReason;
+    } out;
+};
+
+} // namespace cppld
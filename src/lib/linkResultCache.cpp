@@ -0,0 +1,232 @@
+#include "linkResultCache.hpp"
+#include "convenient_functions.hpp"
+#include "statusreport.hpp"
+
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <string>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+// Inputs are hashed in leaves of this size, so even a single large archive is spread over all threads
+constexpr size_t leafSize{1 << 20};
+
+constexpr uint64_t prime1{0x9e3779b185ebca87ull};
+constexpr uint64_t prime2{0xc2b2ae3d27d4eb4full};
+constexpr uint64_t prime3{0x165667b19e3779f9ull};
+
+constexpr auto finalizeLane(uint64_t h) -> uint64_t {
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    return h ^ (h >> 32);
+}
+
+} // namespace
+
+// Two independent lanes in the style of xxHash64 rounds, each word goes into both
+auto hashBytes(readonly_span<std::byte> bytes) -> LinkCacheKey {
+    uint64_t low{bytes.size() * prime1};
+    uint64_t high{~bytes.size() * prime2};
+    auto data = bytes.data();
+    auto remaining = bytes.size();
+    auto round = [&](uint64_t word) {
+        low = std::rotl(low + word * prime2, 31) * prime1;
+        high = std::rotl(high ^ (word * prime3), 27) * prime2 + low;
+    };
+    for (; remaining >= sizeof(uint64_t); remaining -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        round(word);
+    }
+    if (remaining) {
+        uint64_t word{0};
+        std::memcpy(&word, data, remaining);
+        round(word);
+    }
+    return {finalizeLane(low ^ high), finalizeLane(high + low * prime3)};
+}
+
+namespace /*internal*/ {
+
+auto hashKeys(readonly_span<LinkCacheKey> keys) -> LinkCacheKey {
+    return hashBytes({reinterpret_cast<std::byte const*>(keys.data()), keys.size() * sizeof(LinkCacheKey)});
+}
+
+auto toHexString(LinkCacheKey const& key) -> std::string {
+    constexpr std::string_view digits{"0123456789abcdef"};
+    std::string hex;
+    for (auto half : {key[1], key[0]}) {
+        for (int shift{60}; shift >= 0; shift -= 4)
+            hex.push_back(digits[(half >> shift) & 0xf]);
+    }
+    return hex;
+}
+
+struct FileDescriptor {
+    int fd;
+    operator int() const { return fd; }
+    ~FileDescriptor() {
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+// Output files are executable, cache entries get the same permissions so a clone or copy of them is, too
+constexpr auto filePermissions = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH;
+
+// Shares the extents with a reflink if possible, copies inside the kernel otherwise
+auto copyFile(std::string_view sourcePath, std::string_view destinationPath) -> StatusCode {
+    FileDescriptor source{::open(std::string{sourcePath}.c_str(), O_RDONLY)};
+    if (source == -1) return report(StatusCode::system_failure, "could not open \"", sourcePath, "\" to copy it");
+    struct stat sourceStat {};
+    if (::fstat(source, &sourceStat) == -1) return report(StatusCode::system_failure, "can't read file stats for: ", sourcePath);
+
+    FileDescriptor destination{::open(std::string{destinationPath}.c_str(), O_CREAT | O_WRONLY | O_TRUNC, filePermissions)};
+    if (destination == -1) return report(StatusCode::system_failure, "could not open \"", destinationPath, "\" to copy to it");
+    if (::ioctl(destination, FICLONE, static_cast<int>(source)) == 0) return StatusCode::ok;
+
+    for (auto remaining = static_cast<size_t>(sourceStat.st_size); remaining > 0;) {
+        auto copied = ::copy_file_range(source, nullptr, destination, nullptr, remaining, 0);
+        if (copied <= 0) return report(StatusCode::system_failure, "could not copy \"", sourcePath, "\" to \"", destinationPath, "\": ", std::strerror(errno));
+        remaining -= static_cast<size_t>(copied);
+    }
+    return StatusCode::ok;
+}
+
+auto cacheEntryPath(std::string_view cacheDirectory, LinkCacheKey const& key) -> std::string {
+    return std::string{cacheDirectory} + "/" + toHexString(key);
+}
+
+} // namespace
+
+auto hashFileContents(parametersFor::HashFileContents p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes] = p.in;
+    auto& [fileHashes] = p.out;
+
+    // Leaves of all files are hashed together, so small files don't leave threads idle
+    std::vector<size_t> firstLeafOfFile;
+    std::vector<readonly_span<std::byte>> leaves;
+    for_each_indexed(sourceAddresses, [&](void* address, size_t fileIndex) {
+        readonly_span<std::byte> file{static_cast<std::byte const*>(address), sourceMemorySizes[fileIndex]};
+        firstLeafOfFile.push_back(leaves.size());
+        for (size_t offset{0}; offset < file.size(); offset += leafSize)
+            leaves.push_back(file.subspan(offset, std::min(leafSize, file.size() - offset)));
+    });
+    firstLeafOfFile.push_back(leaves.size());
+
+    std::vector<LinkCacheKey> leafHashes(leaves.size());
+    parallel_for_each_indexed(leafHashes, [&](LinkCacheKey& leafHash, size_t leafIndex) {
+        leafHash = hashBytes(leaves[leafIndex]);
+    });
+
+    // Files are hashed from their leaves, empty files still get a hash so the position of every file counts
+    fileHashes.clear();
+    fileHashes.reserve(sourceAddresses.size());
+    for (size_t fileIndex{0}; fileIndex < sourceAddresses.size(); ++fileIndex) {
+        auto first = leafHashes.begin() + static_cast<std::ptrdiff_t>(firstLeafOfFile[fileIndex]);
+        auto last = leafHashes.begin() + static_cast<std::ptrdiff_t>(firstLeafOfFile[fileIndex + 1]);
+        auto fileHash = hashKeys({first, last});
+        fileHash[0] ^= sourceMemorySizes[fileIndex];
+        fileHashes.push_back(fileHash);
+    }
+    return StatusCode::ok;
+}
+
+auto hashLinkOptions(LinkerOptions const& options) -> LinkCacheKey {
+    // Everything in LinkerOptions that changes the output has to be here. The output name, the cache and the statistics don't
+    std::vector<std::byte> optionBytes;
+    auto appendValue = [&](auto value) {
+        auto bytes = std::bit_cast<std::array<std::byte, sizeof(value)>>(value);
+        optionBytes.insert(optionBytes.end(), bytes.begin(), bytes.end());
+    };
+    auto appendString = [&](std::string_view string) {
+        appendValue(string.size());
+        auto bytes = reinterpret_cast<std::byte const*>(string.data());
+        optionBytes.insert(optionBytes.end(), bytes, bytes + string.size());
+    };
+    appendString(options.entrySymbolName);
+    appendValue(options.createEhFrameHeader);
+    appendValue(options.optimizationLevel);
+    appendValue(options.gcMergedPieces);
+    appendValue(options.gcSections);
+    appendValue(options.identicalCodeFolding);
+    appendValue(options.symbolOrderingFile.empty());
+    appendValue(options.callGraphSort);
+    appendValue(options.callGraphProfileFile.empty());
+    appendValue(options.maxPageSize);
+    appendValue(options.hugePageText);
+    appendValue(options.separateCode);
+    appendValue(options.separateReadOnlySegment);
+    appendValue(options.sortSectionsByAlignment);
+    appendValue(options.reproducible);
+    appendValue(options.incremental);
+    appendValue(options.relocatable);
+    return hashBytes(optionBytes);
+}
+
+auto hashLinkInputs(parametersFor::HashLinkInputs p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, options] = p.in;
+    auto& [key, hashedBytes] = p.out;
+
+    // The files the options refer to, and the linker that is running
+    std::vector<std::string_view> extraFilePaths{"/proc/self/exe"};
+    if (!options.symbolOrderingFile.empty()) extraFilePaths.push_back(options.symbolOrderingFile);
+    if (!options.callGraphProfileFile.empty()) extraFilePaths.push_back(options.callGraphProfileFile);
+    MemoryMappings extraFiles;
+    if (auto status = filePathsToMemoryMappings({.in{extraFilePaths}, .out{extraFiles}}); status != StatusCode::ok) return status;
+
+    std::vector<void*> fileAddresses{sourceAddresses.begin(), sourceAddresses.end()};
+    fileAddresses.insert(fileAddresses.end(), extraFiles.addresses.begin(), extraFiles.addresses.end());
+    std::vector<size_t> fileSizes{sourceMemorySizes.begin(), sourceMemorySizes.end()};
+    fileSizes.insert(fileSizes.end(), extraFiles.memSizes.begin(), extraFiles.memSizes.end());
+    hashedBytes = std::accumulate(fileSizes.begin(), fileSizes.end(), size_t{0});
+
+    std::vector<LinkCacheKey> rootHashes;
+    if (auto status = hashFileContents({.in{fileAddresses, fileSizes}, .out{rootHashes}}); status != StatusCode::ok) return status;
+    rootHashes.push_back(hashLinkOptions(options));
+
+    key = hashKeys(rootHashes);
+    return StatusCode::ok;
+}
+
+auto fetchCachedLinkResult(parametersFor::FetchCachedLinkResult p) -> StatusCode {
+    auto& [cacheDirectory, key, outputFileName] = p.in;
+    auto& [isHit] = p.out;
+
+    auto entryPath = cacheEntryPath(cacheDirectory, key);
+    isHit = ::access(entryPath.c_str(), R_OK) == 0;
+    if (!isHit) return StatusCode::ok;
+    return copyFile(entryPath, outputFileName);
+}
+
+auto storeLinkResult(parametersFor::StoreLinkResult p) -> StatusCode {
+    auto& [cacheDirectory, key, outputFileName] = p.in;
+
+    if (::mkdir(std::string{cacheDirectory}.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1 && errno != EEXIST)
+        return report(StatusCode::system_failure, "could not create the cache directory \"", cacheDirectory, "\"");
+
+    auto entryPath = cacheEntryPath(cacheDirectory, key);
+    auto temporaryPath = entryPath + ".tmp." + std::to_string(::getpid());
+    if (auto status = copyFile(outputFileName, temporaryPath); status != StatusCode::ok) {
+        ::unlink(temporaryPath.c_str());
+        return status;
+    }
+    if (::rename(temporaryPath.c_str(), entryPath.c_str()) == -1) {
+        ::unlink(temporaryPath.c_str());
+        return report(StatusCode::system_failure, "could not move the cache entry to \"", entryPath, "\"");
+    }
+    return StatusCode::ok;
+}
+
+} // namespace cppld
@@ -0,0 +1,90 @@
+#pragma once
+#include "cppld.hpp"
+#include "cppld_internal_types.hpp"
+
+#include <array>
+
+namespace cppld {
+
+namespace parametersFor {
+struct HashFileContents;
+struct HashLinkInputs;
+struct FetchCachedLinkResult;
+struct StoreLinkResult;
+} // namespace parametersFor
+
+// 128 bit, the name of an entry in the cache directory is its hex representation
+using LinkCacheKey = std::array<uint64_t, 2>;
+
+// Fast, not cryptographic. The inputs are trusted
+auto hashBytes(readonly_span<std::byte> bytes) -> LinkCacheKey;
+
+/**
+ * @brief Hashes every file on its own, the files are split into 1 MiB leaves that are hashed in parallel
+ */
+auto hashFileContents(parametersFor::HashFileContents) -> StatusCode;
+struct parametersFor::HashFileContents {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+    } in;
+    struct {
+        out<std::vector<LinkCacheKey>> fileHashes;
+    } out;
+};
+
+// Hashes the options that change the output
+auto hashLinkOptions(LinkerOptions const& options) -> LinkCacheKey;
+
+/**
+ * @brief Computes the key of a link from everything that determines the output
+ *
+ * The inputs are split into 1 MiB leaves that are hashed in parallel, the leaf hashes of a file are hashed into the file hash and the file hashes in order into the key.
+ * Options that change the output are hashed as well, including the contents of the symbol ordering and call graph profile files.
+ * So is the running linker itself, a different build of the linker may produce a different output.
+ * The hash is fast, not cryptographic. The inputs are trusted
+ */
+auto hashLinkInputs(parametersFor::HashLinkInputs) -> StatusCode;
+struct parametersFor::HashLinkInputs {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+        in<LinkerOptions> options;
+    } in;
+    struct {
+        out<LinkCacheKey> key;
+        out<size_t> hashedBytes;
+    } out;
+};
+
+/**
+ * @brief Places the cached output of a link with the same key at the output file name
+ * The file is cloned if the file system supports reflinks and copied otherwise.
+ * Hard links are not used: the next link to the same output truncates the file in place, which would destroy the cache entry
+ */
+auto fetchCachedLinkResult(parametersFor::FetchCachedLinkResult) -> StatusCode;
+struct parametersFor::FetchCachedLinkResult {
+    struct {
+        std::string_view cacheDirectory;
+        in<LinkCacheKey> key;
+        std::string_view outputFileName;
+    } in;
+    struct {
+        out<bool> isHit;
+    } out;
+};
+
+/**
+ * @brief Copies the output into the cache directory, which is created if necessary
+ * The entry is written under a temporary name first, so concurrent links never see half an entry
+ */
+auto storeLinkResult(parametersFor::StoreLinkResult) -> StatusCode;
+struct parametersFor::StoreLinkResult {
+    struct {
+        std::string_view cacheDirectory;
+        in<LinkCacheKey> key;
+        std::string_view outputFileName;
+    } in;
+};
+
+} // namespace cppld
@@ -0,0 +1,260 @@
+#include "cppld.hpp"
+#include "statusreport.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+// A request is the length of the payload, which comes with the stderr of the client, followed by the payload:
+// the working directory of the client and then its arguments, each terminated by a zero.
+// The reply is the status of the link
+using RequestLength = uint64_t;
+using ReplyStatus = int32_t;
+
+// Far more than the arguments of a process can take (ARG_MAX), the length comes from the client and is not trusted
+constexpr RequestLength maxRequestLength{RequestLength{16} << 20};
+// Links are done one after another, a client that stops sending must not hold up the others
+constexpr time_t requestTimeoutSeconds{10};
+
+struct FileDescriptor {
+    int fd;
+    operator int() const { return fd; }
+    ~FileDescriptor() {
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+auto socketAddressFor(std::string_view socketPath, out<sockaddr_un> address) -> StatusCode {
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) return report(StatusCode::not_ok, "the socket path is too long: ", socketPath);
+    std::memcpy(address.sun_path, socketPath.data(), socketPath.size());
+    return StatusCode::ok;
+}
+
+auto sendAll(int fd, void const* data, size_t size) -> bool {
+    auto bytes = static_cast<char const*>(data);
+    while (size > 0) {
+        auto sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+auto receiveAll(int fd, void* data, size_t size) -> bool {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        auto received = ::recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Receives the length of the payload and the file descriptor that comes with it
+auto receiveRequestHeader(int connection, out<RequestLength> length, out<int> clientStderr) -> bool {
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    iovec lengthBuffer{.iov_base = &length, .iov_len = sizeof(length)};
+    msghdr message{};
+    message.msg_iov = &lengthBuffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (::recvmsg(connection, &message, MSG_CMSG_CLOEXEC) != sizeof(length)) return false;
+
+    auto header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) return false;
+    std::memcpy(&clientStderr, CMSG_DATA(header), sizeof(int));
+    return true;
+}
+
+auto sendRequestHeader(int connection, RequestLength length, int clientStderr) -> bool {
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    iovec lengthBuffer{.iov_base = &length, .iov_len = sizeof(length)};
+    msghdr message{};
+    message.msg_iov = &lengthBuffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &clientStderr, sizeof(int));
+    return ::sendmsg(connection, &message, MSG_NOSIGNAL) == sizeof(length);
+}
+
+// Links like main() does, only the archives come from the cache
+auto linkRequest(readonly_span<char*> arguments, inout<MappedArchiveCache> archiveCache) -> StatusCode {
+    LinkerOptions linkerOptions;
+    MemoryMappings filemappings;
+    std::vector<void*> addresses;
+    std::vector<size_t> memSizes;
+    std::vector<ArchiveIndex const*> archiveIndices;
+    size_t numReusedArchives{0};
+    std::vector<std::string_view> inputFilePaths;
+    std::pmr::monotonic_buffer_resource libraryFilePathStringMemory{std::pmr::get_default_resource()};
+
+    if (auto status = argumentsToLinkerParameters({.in{arguments}, .out{linkerOptions, inputFilePaths, libraryFilePathStringMemory}}); status != StatusCode::ok)
+        return status;
+    // --connect is among the arguments of every client, it's only meant for the client and ignored here.
+    // --server never comes from ld itself (it serves instead of connecting), other clients must not start a server inside the server
+    if (!linkerOptions.serverSocket.empty()) return report(StatusCode::not_ok, "the link server does not start another link server");
+
+    if (auto status = filePathsToCachedMemoryMappings({.in{inputFilePaths}, .inout{archiveCache}, .out{filemappings, addresses, memSizes, archiveIndices, numReusedArchives}});
+        status != StatusCode::ok)
+        return status;
+    linkerOptions.archiveIndices = archiveIndices;
+    if (linkerOptions.printStatistics)
+        inform("link server reused ", numReusedArchives, " archive mappings, ", archiveCache.entries.size(), " archives are mapped");
+
+    if (!linkerOptions.outputSpecs.empty()) {
+        std::vector<std::string_view> extraFilePaths;
+        for (auto& spec : linkerOptions.outputSpecs)
+            extraFilePaths.insert(extraFilePaths.end(), spec.extraFilePaths.begin(), spec.extraFilePaths.end());
+        MemoryMappings extraFileMappings;
+        if (auto status = filePathsToMemoryMappings({.in{extraFilePaths}, .out{extraFileMappings}}); status != StatusCode::ok) return status;
+        return linkSourcesToExecutableElfFiles({.in{addresses, memSizes, extraFileMappings.addresses, extraFileMappings.memSizes, linkerOptions}});
+    }
+    return linkSourcesToExecutableElfFile({.in{addresses, memSizes, linkerOptions}});
+}
+
+auto serveConnection(int connection, inout<MappedArchiveCache> archiveCache) -> void {
+    timeval requestTimeout{.tv_sec = requestTimeoutSeconds, .tv_usec = 0};
+    if (::setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &requestTimeout, sizeof(requestTimeout)) == -1) {
+        report(StatusCode::system_failure, "the link server could not set a timeout for a connection: ", std::strerror(errno));
+        return;
+    }
+    // A client that closes the connection early is no timeout
+    errno = 0;
+    auto reportTimeout = [] {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) report(StatusCode::not_ok, "the link server dropped a client that sent nothing for ", requestTimeoutSeconds, " seconds");
+    };
+
+    RequestLength length{0};
+    int receivedStderr{-1};
+    if (!receiveRequestHeader(connection, length, receivedStderr)) return reportTimeout();
+    FileDescriptor clientStderr{receivedStderr};
+
+    if (length > maxRequestLength) {
+        auto refusedStatus = static_cast<ReplyStatus>(report(StatusCode::not_ok, "the link server refuses a request of ", length, " bytes, at most ", maxRequestLength, " are allowed"));
+        sendAll(connection, &refusedStatus, sizeof(refusedStatus));
+        return;
+    }
+    std::string payload(length, '\0');
+    if (!receiveAll(connection, payload.data(), payload.size())) return reportTimeout();
+
+    // The payload is zero terminated strings: the working directory first, the arguments after it
+    std::vector<char*> strings;
+    for (size_t begin{0}; begin < payload.size();) {
+        auto end = payload.find('\0', begin);
+        if (end == std::string::npos) return;
+        strings.push_back(payload.data() + begin);
+        begin = end + 1;
+    }
+    if (strings.empty()) return;
+
+    // The working directory and stderr belong to the whole process, this is why links are done one after another
+    FileDescriptor serverDirectory{::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    FileDescriptor serverStderr{::fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0)};
+    ReplyStatus linkStatus{static_cast<ReplyStatus>(StatusCode::system_failure)};
+    if (serverDirectory != -1 && serverStderr != -1 && ::dup2(clientStderr, STDERR_FILENO) != -1) {
+        if (::chdir(strings.front()) == -1)
+            report(StatusCode::system_failure, "the link server can't change to the working directory ", strings.front());
+        else
+            linkStatus = static_cast<ReplyStatus>(linkRequest({strings.begin() + 1, strings.end()}, archiveCache));
+
+        ::dup2(serverStderr, STDERR_FILENO);
+        if (::fchdir(serverDirectory) == -1) report(StatusCode::system_failure, "the link server can't change back to its working directory");
+    }
+    sendAll(connection, &linkStatus, sizeof(linkStatus));
+}
+
+} // namespace
+
+auto runLinkServer(parametersFor::RunLinkServer p) -> StatusCode {
+    auto& [socketPath] = p.in;
+
+    sockaddr_un address;
+    if (auto status = socketAddressFor(socketPath, address); status != StatusCode::ok) return status;
+
+    FileDescriptor listener{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (listener == -1) return report(StatusCode::system_failure, "could not create the server socket: ", std::strerror(errno));
+    // A socket left behind by an earlier server would make bind fail. Only a socket nobody answers on is removed,
+    // anything else at that path (e.g. a mistyped file name or the socket of a running server) stays
+    if (struct stat pathStat {}; ::lstat(address.sun_path, &pathStat) == 0) {
+        if (!S_ISSOCK(pathStat.st_mode)) return report(StatusCode::not_ok, "\"", socketPath, "\" exists and is not a socket, the link server won't replace it");
+        FileDescriptor probe{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        if (probe == -1) return report(StatusCode::system_failure, "could not create a socket: ", std::strerror(errno));
+        if (::connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+            return report(StatusCode::not_ok, "another link server already listens on \"", socketPath, "\"");
+        ::unlink(address.sun_path);
+    }
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        return report(StatusCode::system_failure, "could not bind the server socket to \"", socketPath, "\": ", std::strerror(errno));
+    if (::listen(listener, SOMAXCONN) == -1) return report(StatusCode::system_failure, "could not listen on \"", socketPath, "\": ", std::strerror(errno));
+
+    MappedArchiveCache archiveCache;
+    for (;;) {
+        FileDescriptor connection{::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC)};
+        if (connection == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return report(StatusCode::system_failure, "the link server could not accept a connection: ", std::strerror(errno));
+        }
+        serveConnection(connection, archiveCache);
+    }
+}
+
+auto forwardToLinkServer(parametersFor::ForwardToLinkServer p) -> StatusCode {
+    auto& [socketPath, arguments] = p.in;
+    auto& [linkStatus] = p.out;
+
+    sockaddr_un address;
+    if (auto status = socketAddressFor(socketPath, address); status != StatusCode::ok) return status;
+
+    std::string payload;
+    {
+        std::vector<char> workingDirectory(PATH_MAX);
+        if (!::getcwd(workingDirectory.data(), workingDirectory.size()))
+            return report(StatusCode::system_failure, "could not get the working directory: ", std::strerror(errno));
+        payload.append(workingDirectory.data());
+        payload.push_back('\0');
+    }
+    for (auto argument : arguments) {
+        payload.append(argument);
+        payload.push_back('\0');
+    }
+
+    FileDescriptor connection{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (connection == -1) return report(StatusCode::system_failure, "could not create a socket: ", std::strerror(errno));
+    if (::connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+        return report(StatusCode::system_failure, "could not connect to the link server at \"", socketPath, "\": ", std::strerror(errno));
+
+    ReplyStatus replyStatus{0};
+    if (!sendRequestHeader(connection, payload.size(), STDERR_FILENO) || !sendAll(connection, payload.data(), payload.size()) ||
+        !receiveAll(connection, &replyStatus, sizeof(replyStatus)))
+        return report(StatusCode::system_failure, "the link server at \"", socketPath, "\" did not finish the link");
+
+    linkStatus = static_cast<StatusCode>(replyStatus);
+    return StatusCode::ok;
+}
+
+} // namespace cppld
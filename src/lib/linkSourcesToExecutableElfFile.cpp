@@ -1,46 +1,51 @@
 #include "cppld.hpp"
+#include "convenient_functions.hpp"
+#include "incrementalLink.hpp"
+#include "linkResultCache.hpp"
 #include "mapInputSectionsToOutputSections.hpp"
 #include "parseInputAndCreateSymbolTable.hpp"
+#include "relocatableOutput.hpp"
 #include "statusreport.hpp"
 #include "writeLinkingResultsToFile.hpp"
 
-namespace cppld {
-
-auto linkSourcesToExecutableElfFile(parametersFor::LinkSourcesToExecutableElfFile p) -> StatusCode {
-    auto& [sourceAddresses, sourceMemorySizes, options] = p.in;
-
-    if (sourceAddresses.size() >= std::numeric_limits<uint32_t>::max())
-        return report(StatusCode::not_ok, "too much input: ", sourceAddresses.size(), " files");
-    if (sourceAddresses.empty())
-        return report(StatusCode::not_ok, "not enough input to link something");
-    if (sourceAddresses.size() != sourceMemorySizes.size())
-        return report(StatusCode::not_ok, "library usage error");
-    if (options.createEhFrameHeader)
-        return report(StatusCode::not_ok, "creating eh_frame Headers is not supported");
+#include <atomic>
+#include <chrono>
 
-    StatusCode status{StatusCode::ok};
+#include <sys/stat.h>
 
-    std::vector<std::byte*> elfAddresses;
-    std::vector<SortKey> sortKeys;
-    std::vector<readonly_span<Elf64_Shdr>> sectionHeaders;
-    std::vector<const char*> sectionStringTables;
-    std::pmr::monotonic_buffer_resource archiveExtractionMemory;
-
-    std::pmr::monotonic_buffer_resource symbolTableMemory;
-    SymbolTable symbolTable{&symbolTableMemory};
+namespace cppld {
 
-    status = parseInputAndCreateSymbolTable({.in{sourceAddresses, sourceMemorySizes},
-                                             .out{elfAddresses, sortKeys, sectionHeaders, sectionStringTables,
-                                                  archiveExtractionMemory, symbolTable}});
+namespace /*internal*/ {
 
-    if (status != StatusCode::ok) return status;
+// Everything after the symbol table, done once per output
+struct LinkParsedInput {
+    struct {
+        readonly_span<void*> sourceAddresses;
+        readonly_span<size_t> sourceMemorySizes;
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<SortKey> sortKeys;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+        in<SymbolTable> symbolTable;
+        in<LinkerOptions> options;
+        in<OutputTarget> target;
+    } in;
+    struct {
+        inout<Vector2D<InputSectionState>> sectionStates;
+    } inout;
+    struct {
+        out<size_t> outputSize;
+        out<int> memoryFileDescriptor;
+    } out;
+};
+auto linkParsedInput(LinkParsedInput p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, options, target] = p.in;
+    auto& [sectionStates] = p.inout;
+    auto& [outputSize, memoryFileDescriptor] = p.out;
 
-    auto& entrySymbolInfo = symbolTable[options.entrySymbolName];
-    if (!entrySymbolInfo.firstLoad.symbol) {
-        return report(StatusCode::not_ok, "entry symbol \"", options.entrySymbolName, "\" not found in global symbol table");
-    }
+    StatusCode status{StatusCode::ok};
 
-    std::pmr::monotonic_buffer_resource sectionMaterializationMemory{};
+    std::pmr::monotonic_buffer_resource sectionMaterializationMemory{options.memoryResource};
     std::vector<Elf64_Shdr> outputSectionHeaders;
     Elf64_Ehdr elfHeader;
 
@@ -55,31 +60,64 @@ auto linkSourcesToExecutableElfFile(parametersFor::LinkSourcesToExecutableElfFil
     std::vector<size_t> outputSectionFileOffsets;
     size_t gotAddress{};
     Vector2D<ProcessedRela> processedRelas;
-    status = mapInputSectionsToOutputSections({.in{elfAddresses,
-                                                   sortKeys,
-                                                   sectionHeaders,
-                                                   sectionStringTables,
-                                                   symbolTable,
-                                                   entrySymbolInfo},
-                                               .out{sectionMaterializationMemory,
-                                                    outputSectionHeaders,
-                                                    elfHeader,
-                                                    outputToInputSections,
-                                                    inputToOutputSection,
-                                                    outputSectionTypes,
-                                                    outputSectionSizes,
-                                                    inputSectionCopyCommands,
-                                                    materializedViews,
-                                                    programHeaders,
-                                                    outputSectionAddresses,
-                                                    outputSectionFileOffsets,
-                                                    gotAddress,
-                                                    processedRelas}});
-    if (status != StatusCode::ok) return status;
+    if (options.relocatable) {
+        status = mapInputSectionsToRelocatableOutput({.in{elfAddresses,
+                                                          sortKeys,
+                                                          sectionHeaders,
+                                                          sectionStringTables,
+                                                          symbolTable,
+                                                          sectionStates,
+                                                          options},
+                                                      .out{sectionMaterializationMemory,
+                                                           outputSectionHeaders,
+                                                           elfHeader,
+                                                           outputToInputSections,
+                                                           inputToOutputSection,
+                                                           outputSectionTypes,
+                                                           outputSectionSizes,
+                                                           inputSectionCopyCommands,
+                                                           materializedViews,
+                                                           programHeaders,
+                                                           outputSectionAddresses,
+                                                           outputSectionFileOffsets,
+                                                           gotAddress,
+                                                           processedRelas}});
+        if (status != StatusCode::ok) return status;
+    } else {
+        auto entrySymbolIt = symbolTable.find(options.entrySymbolName);
+        if (entrySymbolIt == symbolTable.end() || !entrySymbolIt->second.firstLoad.symbol) {
+            return report(StatusCode::not_ok, "entry symbol \"", options.entrySymbolName, "\" not found in global symbol table");
+        }
+        auto& entrySymbolInfo = entrySymbolIt->second;
+
+        status = mapInputSectionsToOutputSections({.in{elfAddresses,
+                                                       sortKeys,
+                                                       sectionHeaders,
+                                                       sectionStringTables,
+                                                       symbolTable,
+                                                       entrySymbolInfo,
+                                                       options},
+                                                   .inout{sectionStates},
+                                                   .out{sectionMaterializationMemory,
+                                                        outputSectionHeaders,
+                                                        elfHeader,
+                                                        outputToInputSections,
+                                                        inputToOutputSection,
+                                                        outputSectionTypes,
+                                                        outputSectionSizes,
+                                                        inputSectionCopyCommands,
+                                                        materializedViews,
+                                                        programHeaders,
+                                                        outputSectionAddresses,
+                                                        outputSectionFileOffsets,
+                                                        gotAddress,
+                                                        processedRelas}});
+        if (status != StatusCode::ok) return status;
+    }
 
     status = writeLinkingResultsToFile({.in{elfAddresses,
                                             sectionHeaders,
-                                            options.outputFileName,
+                                            target,
                                             elfHeader,
                                             programHeaders,
                                             outputSectionHeaders,
@@ -91,7 +129,232 @@ auto linkSourcesToExecutableElfFile(parametersFor::LinkSourcesToExecutableElfFil
                                             outputSectionTypes,
                                             inputSectionCopyCommands,
                                             gotAddress,
-                                            processedRelas}});
+                                            processedRelas},
+                                        .out{outputSize, memoryFileDescriptor}});
+    if (status != StatusCode::ok) return status;
+
+    if (options.incremental &&
+        storeIncrementalLinkState({.in{sourceAddresses, sourceMemorySizes, options, elfAddresses, sectionHeaders, sectionStringTables,
+                                       inputToOutputSection, inputSectionCopyCommands, materializedViews, outputSectionHeaders}}) != StatusCode::ok)
+        inform("the incremental link state was not stored");
+    return status;
+}
+
+// The size of an output that was not written by this link, but fetched from the cache or patched
+auto sizeOfOutputFile(std::string_view outputFileName) -> size_t {
+    struct stat outputStat {};
+    if (::stat(std::string{outputFileName}.c_str(), &outputStat) == -1) return 0;
+    return static_cast<size_t>(outputStat.st_size);
+}
+
+} // namespace
+
+auto linkSourcesToExecutableElfFile(parametersFor::LinkSourcesToExecutableElfFile p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, options] = p.in;
+
+    size_t outputSize{0};
+    int memoryFileDescriptor{-1};
+    return linkSourcesToExecutableElfImage({.in{sourceAddresses, sourceMemorySizes, options, OutputTarget{.kind = OutputTarget::Kind::file, .fileName = options.outputFileName, .buffer = {}}},
+                                            .out{outputSize, memoryFileDescriptor}});
+}
+
+auto linkSourcesToExecutableElfImage(parametersFor::LinkSourcesToExecutableElfImage p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, callerOptions, target] = p.in;
+    auto& [outputSize, memoryFileDescriptor] = p.out;
+    outputSize = 0;
+    memoryFileDescriptor = -1;
+
+    // The cache and the incremental state refer to the output by its name
+    auto options = callerOptions;
+    options.outputFileName = target.fileName;
+
+    if (sourceAddresses.size() >= std::numeric_limits<uint32_t>::max())
+        return report(StatusCode::not_ok, "too much input: ", sourceAddresses.size(), " files");
+    if (sourceAddresses.empty())
+        return report(StatusCode::not_ok, "not enough input to link something");
+    if (sourceAddresses.size() != sourceMemorySizes.size())
+        return report(StatusCode::not_ok, "library usage error");
+    if (options.createEhFrameHeader)
+        return report(StatusCode::not_ok, "creating eh_frame Headers is not supported");
+    if (target.kind != OutputTarget::Kind::file && (!options.cacheDirectory.empty() || options.incremental))
+        return report(StatusCode::not_ok, "--cache-dir and --incremental can only be used when linking to a file");
+    // Both need the entry point or the final layout, which a relocatable object doesn't have
+    if (options.relocatable && (options.gcSections || options.identicalCodeFolding != IdenticalCodeFolding::none || options.incremental))
+        return report(StatusCode::not_ok, "--gc-sections, --icf and --incremental can't be used with -r");
+
+    StatusCode status{StatusCode::ok};
+
+    LinkCacheKey cacheKey{};
+    if (!options.cacheDirectory.empty()) {
+        auto hashStart = std::chrono::steady_clock::now();
+        size_t hashedBytes{0};
+        status = hashLinkInputs({.in{sourceAddresses, sourceMemorySizes, options}, .out{cacheKey, hashedBytes}});
+        if (status != StatusCode::ok) return status;
+        auto hashDuration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - hashStart);
+
+        bool isHit{false};
+        status = fetchCachedLinkResult({.in{options.cacheDirectory, cacheKey, options.outputFileName}, .out{isHit}});
+        if (options.printStatistics)
+            inform("link cache ", isHit && status == StatusCode::ok ? "hit" : "miss", ", hashing ", hashedBytes, " bytes took ", hashDuration.count(), " ms");
+        // A cache entry that can't be used is just linked again
+        if (isHit && status == StatusCode::ok) {
+            outputSize = sizeOfOutputFile(options.outputFileName);
+            return status;
+        }
+    }
+
+    if (options.incremental) {
+        bool isPatched{false};
+        size_t numChangedFiles{0};
+        size_t numPatchedSections{0};
+        std::string_view fallbackReason;
+        status = patchPreviousLinkResult({.in{sourceAddresses, sourceMemorySizes, options},
+                                          .out{isPatched, numChangedFiles, numPatchedSections, fallbackReason}});
+        if (status != StatusCode::ok) return status;
+        if (options.printStatistics) {
+            if (isPatched)
+                inform("incremental link patched ", numPatchedSections, " sections of ", numChangedFiles, " changed files");
+            else
+                inform("incremental link not possible, ", fallbackReason);
+        }
+        if (isPatched) {
+            outputSize = sizeOfOutputFile(options.outputFileName);
+            return status;
+        }
+    }
+
+    std::vector<std::byte*> elfAddresses;
+    std::vector<SortKey> sortKeys;
+    std::vector<readonly_span<Elf64_Shdr>> sectionHeaders;
+    std::vector<const char*> sectionStringTables;
+    std::pmr::monotonic_buffer_resource archiveExtractionMemory{options.memoryResource};
+
+    std::pmr::monotonic_buffer_resource symbolTableMemory{options.memoryResource};
+    SymbolTable symbolTable{&symbolTableMemory};
+    Vector2D<InputSectionState> sectionStates;
+
+    status = parseInputAndCreateSymbolTable({.in{sourceAddresses, sourceMemorySizes, options.archiveIndices},
+                                             .out{elfAddresses, sortKeys, sectionHeaders, sectionStringTables,
+                                                  archiveExtractionMemory, symbolTable, sectionStates}});
+
+    if (status != StatusCode::ok) return status;
+
+    status = linkParsedInput({.in{sourceAddresses, sourceMemorySizes, elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, options, target},
+                              .inout{sectionStates},
+                              .out{outputSize, memoryFileDescriptor}});
+    if (status != StatusCode::ok) return status;
+
+    if (!options.cacheDirectory.empty() && storeLinkResult({.in{options.cacheDirectory, cacheKey, options.outputFileName}}) != StatusCode::ok)
+        inform("the link result was not cached");
+    return status;
+}
+
+auto linkSourcesToExecutableElfFiles(parametersFor::LinkSourcesToExecutableElfFiles p) -> StatusCode {
+    auto& [sourceAddresses, sourceMemorySizes, extraAddresses, extraMemorySizes, options] = p.in;
+    auto& outputSpecs = options.outputSpecs;
+
+    if (sourceAddresses.size() + extraAddresses.size() >= std::numeric_limits<uint32_t>::max())
+        return report(StatusCode::not_ok, "too much input: ", sourceAddresses.size() + extraAddresses.size(), " files");
+    if (outputSpecs.empty())
+        return report(StatusCode::not_ok, "no outputs to link");
+    if (sourceAddresses.size() != sourceMemorySizes.size() || extraAddresses.size() != extraMemorySizes.size())
+        return report(StatusCode::not_ok, "library usage error");
+    if (options.createEhFrameHeader)
+        return report(StatusCode::not_ok, "creating eh_frame Headers is not supported");
+    // Both keep state per output file, which the outputs of one link don't have on their own
+    if (!options.cacheDirectory.empty() || options.incremental)
+        return report(StatusCode::not_ok, "--cache-dir and --incremental can't be used with --output-spec");
+    if (options.relocatable)
+        return report(StatusCode::not_ok, "-r can't be used with --output-spec");
+
+    std::vector<size_t> firstExtraOfOutput{0};
+    for (auto& spec : outputSpecs)
+        firstExtraOfOutput.push_back(firstExtraOfOutput.back() + spec.extraFilePaths.size());
+    if (firstExtraOfOutput.back() != extraAddresses.size())
+        return report(StatusCode::not_ok, "library usage error");
+
+    // Parsed once, afterwards only read by the outputs
+    std::vector<std::byte*> sharedElfAddresses;
+    std::vector<SortKey> sharedSortKeys;
+    std::vector<readonly_span<Elf64_Shdr>> sharedSectionHeaders;
+    std::vector<const char*> sharedSectionStringTables;
+    std::vector<SortKey> archiveMemberSortKeys;
+    std::vector<ArchiveMemberState> sharedArchiveMemberStates;
+    ArchiveSymbolTable archiveSymbolTable{options.memoryResource};
+    auto parseStart = std::chrono::steady_clock::now();
+    auto status = parseInputFiles({.in{sourceAddresses, sourceMemorySizes, options.archiveIndices},
+                                   .out{sharedElfAddresses, sharedSortKeys, sharedSectionHeaders, sharedSectionStringTables,
+                                        archiveMemberSortKeys, sharedArchiveMemberStates, archiveSymbolTable}});
+    if (status != StatusCode::ok) return status;
+    if (options.printStatistics)
+        inform("parsed the shared inputs once for ", outputSpecs.size(), " outputs in ",
+               std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseStart).count(), " ms");
+
+    // The extra files of an output come after the shared ones, so the file indices in the sort keys of the shared inputs stay the same for every output
+    parallel_for_each_indexed(outputSpecs, [&](OutputSpec const& spec, size_t outputID) {
+        auto extraBegin = static_cast<std::ptrdiff_t>(firstExtraOfOutput[outputID]);
+        auto extraEnd = static_cast<std::ptrdiff_t>(firstExtraOfOutput[outputID + 1]);
+        std::vector<void*> addresses{sourceAddresses.begin(), sourceAddresses.end()};
+        addresses.insert(addresses.end(), extraAddresses.begin() + extraBegin, extraAddresses.begin() + extraEnd);
+        std::vector<size_t> memSizes{sourceMemorySizes.begin(), sourceMemorySizes.end()};
+        memSizes.insert(memSizes.end(), extraMemorySizes.begin() + extraBegin, extraMemorySizes.begin() + extraEnd);
+
+        auto linkOutput = [&]() -> StatusCode {
+            std::vector<uint32_t> extraElfFileIndices;
+            std::vector<uint32_t> extraArchiveFileIndices;
+            auto outputStatus = classifyInput({.in{{addresses.begin() + static_cast<std::ptrdiff_t>(sourceAddresses.size()), addresses.end()},
+                                                   {memSizes.begin() + static_cast<std::ptrdiff_t>(sourceAddresses.size()), memSizes.end()}},
+                                               .out{extraElfFileIndices, extraArchiveFileIndices}});
+            if (outputStatus != StatusCode::ok) return outputStatus;
+            if (!extraArchiveFileIndices.empty()) return report(StatusCode::not_ok, "the extra files of an --output-spec have to be object files");
+            for (auto& fileIndex : extraElfFileIndices)
+                fileIndex += static_cast<uint32_t>(sourceAddresses.size());
+
+            // Extracted archive members and the extra objects are added to copies of the shared results
+            std::vector<std::byte*> elfAddresses{sharedElfAddresses};
+            std::vector<SortKey> sortKeys{sharedSortKeys};
+            std::vector<readonly_span<Elf64_Shdr>> sectionHeaders{sharedSectionHeaders};
+            std::vector<const char*> sectionStringTables{sharedSectionStringTables};
+            std::vector<ArchiveMemberState> archiveMemberStates{sharedArchiveMemberStates};
+            {
+                std::vector<std::byte*> extraElfAddresses;
+                std::vector<SortKey> extraSortKeys;
+                std::vector<readonly_span<Elf64_Shdr>> extraSectionHeaders;
+                std::vector<const char*> extraSectionStringTables;
+                outputStatus = parseElfFiles({.in{addresses, memSizes, extraElfFileIndices},
+                                              .out{extraElfAddresses, extraSortKeys, extraSectionHeaders, extraSectionStringTables}});
+                if (outputStatus != StatusCode::ok) return outputStatus;
+                elfAddresses.insert(elfAddresses.end(), extraElfAddresses.begin(), extraElfAddresses.end());
+                sortKeys.insert(sortKeys.end(), extraSortKeys.begin(), extraSortKeys.end());
+                sectionHeaders.insert(sectionHeaders.end(), extraSectionHeaders.begin(), extraSectionHeaders.end());
+                sectionStringTables.insert(sectionStringTables.end(), extraSectionStringTables.begin(), extraSectionStringTables.end());
+            }
+
+            std::pmr::monotonic_buffer_resource archiveExtractionMemory{options.memoryResource};
+            std::pmr::monotonic_buffer_resource symbolTableMemory{options.memoryResource};
+            SymbolTable symbolTable{&symbolTableMemory};
+            Vector2D<InputSectionState> sectionStates;
+            outputStatus = createSymbolTable({.in{addresses, memSizes, archiveMemberSortKeys, archiveSymbolTable},
+                                              .inout{elfAddresses, sortKeys, sectionHeaders, sectionStringTables, archiveMemberStates},
+                                              .out{archiveExtractionMemory, symbolTable, sectionStates}});
+            if (outputStatus != StatusCode::ok) return outputStatus;
+
+            auto outputOptions = options;
+            outputOptions.entrySymbolName = spec.entrySymbolName;
+            outputOptions.outputFileName = spec.outputFileName;
+            outputOptions.outputSpecs = {};
+            size_t outputSize{0};
+            int memoryFileDescriptor{-1};
+            return linkParsedInput({.in{addresses, memSizes, elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, outputOptions,
+                                        OutputTarget{.kind = OutputTarget::Kind::file, .fileName = spec.outputFileName, .buffer = {}}},
+                                    .inout{sectionStates},
+                                    .out{outputSize, memoryFileDescriptor}});
+        };
+        if (auto outputStatus = linkOutput(); outputStatus != StatusCode::ok) {
+            report(outputStatus, "could not link ", spec.outputFileName);
+            std::atomic_ref{status}.store(outputStatus);
+        }
+    });
     return status;
 }
 
@@ -1,14 +1,24 @@
 #include "mapInputSectionsToOutputSections.hpp"
 #include "convenient_functions.hpp"
+#include "foldIdenticalSections.hpp"
+#include "garbageCollectSections.hpp"
+#include "orderInputSections.hpp"
+#include "splitSectionIntoPieces.hpp"
 #include "statusreport.hpp"
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstring>
+#include <mutex>
+#include <numeric>
+#include <utility>
 
 namespace cppld {
 
 auto mapInputSectionsToOutputSections(parametersFor::MapInputSectionsToOutputSections p) -> StatusCode {
-    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, entrySymbolInfo] = p.in;
+    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, entrySymbolInfo, options] = p.in;
+    auto& [sectionStates] = p.inout;
     auto& [sectionMaterializationMemory, outputSectionHeaders, elfHeader, outputToInputSections,
            inputToOutputSection, outputSectionTypes, outputSectionSizes, inputSectionCopyCommands,
            materializedViews, programHeaders, outputSectionAddresses, outputSectionFileOffsets,
@@ -22,23 +32,82 @@ auto mapInputSectionsToOutputSections(parametersFor::MapInputSectionsToOutputSec
     size_t totalNumberOfLocalSymbols;
     size_t totalStringTableMemorySize;
 
-    status = initOutputSections({.in{sectionHeaders, sectionStringTables},
+    if (options.gcSections) {
+        status = garbageCollectSections({.in{elfAddresses, sectionHeaders, sectionStringTables, symbolTable, entrySymbolInfo},
+                                         .inout{sectionStates}});
+        if (status != StatusCode::ok) return status;
+    }
+
+    std::vector<FoldedSection> foldedSections;
+    if (options.identicalCodeFolding != IdenticalCodeFolding::none) {
+        size_t numFoldIterations{0};
+        status = foldIdenticalSections({.in{elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, options.identicalCodeFolding},
+                                        .inout{sectionStates},
+                                        .out{foldedSections, numFoldIterations}});
+        if (status != StatusCode::ok) return status;
+        if (options.printStatistics)
+            inform("folded ", foldedSections.size(), " identical sections in ", numFoldIterations, " iterations");
+    }
+
+    status = initOutputSections({.in{sectionHeaders, sectionStringTables, sectionStates, options.reproducible, /*keepSectionNames*/ false},
                                  .out{names, outputToInputSections, alignments,
                                       outputSectionTypes, flags, inputToOutputSection,
                                       totalNumberOfLocalSymbols,
                                       totalStringTableMemorySize}});
     if (status != StatusCode::ok) return status; // NOLINT
 
+    Vector2D<uint32_t> sectionPriorities;
+    if (!options.symbolOrderingFile.empty()) {
+        status = orderSectionsBySymbols({.in{options.symbolOrderingFile, elfAddresses, sectionHeaders},
+                                         .out{sectionPriorities}});
+        if (status != StatusCode::ok) return status;
+    } else if (options.callGraphSort) {
+        size_t numCallEdges{0};
+        size_t numClusters{0};
+        status = orderSectionsByCallGraph({.in{options.callGraphProfileFile, elfAddresses, sectionHeaders, symbolTable, sectionStates},
+                                           .out{sectionPriorities, numCallEdges, numClusters}});
+        if (status != StatusCode::ok) return status;
+        if (options.printStatistics)
+            inform("laid out the call graph with ", numCallEdges, " edges in ", numClusters, " clusters");
+    }
+
+    size_t savedAlignmentPadding{0};
     status = mergeAndSortInputSections({.in{elfAddresses,
                                             sortKeys,
                                             sectionHeaders,
-                                            flags},
+                                            sectionStringTables,
+                                            names,
+                                            flags,
+                                            sectionPriorities,
+                                            /*tailMergeStrings*/ options.optimizationLevel >= 2,
+                                            options.sortSectionsByAlignment,
+                                            options.incremental},
                                         .inout{outputToInputSections},
                                         .out{outputSectionSizes,
                                              inputSectionCopyCommands,
                                              materializedViews,
-                                             sectionMaterializationMemory}});
+                                             sectionMaterializationMemory,
+                                             savedAlignmentPadding}});
     if (status != StatusCode::ok) return status;
+    if (options.printStatistics && options.sortSectionsByAlignment)
+        inform("saved ", savedAlignmentPadding, " bytes of alignment padding");
+
+    // Folded sections live where the section they were folded into lives
+    for (auto& [folded, kept] : foldedSections) {
+        inputToOutputSection[folded.elfIndex][folded.headerIndex] = inputToOutputSection[kept.elfIndex][kept.headerIndex];
+        inputSectionCopyCommands[folded.elfIndex][folded.headerIndex] = inputSectionCopyCommands[kept.elfIndex][kept.headerIndex];
+    }
+
+    // Not for incremental links, they can only patch sections that are copied as a whole
+    if (!options.incremental) {
+        size_t numRemovedDescriptions{0};
+        status = removeDeadFrameDescriptions({.in{elfAddresses, sectionHeaders, names, outputToInputSections, symbolTable, sectionStates},
+                                              .inout{inputSectionCopyCommands, outputSectionSizes, materializedViews},
+                                              .out{sectionMaterializationMemory, numRemovedDescriptions}});
+        if (status != StatusCode::ok) return status;
+        if (options.printStatistics && numRemovedDescriptions)
+            inform("removed ", numRemovedDescriptions, " unwind descriptions of discarded sections");
+    }
 
     OutSectionID gotID, symTabID, strTabID, shstrTabID;
     {
@@ -65,20 +134,30 @@ auto mapInputSectionsToOutputSections(parametersFor::MapInputSectionsToOutputSec
         shstrTabID = allocateSyntheticSection(".shstrtab", SHT_STRTAB, noFlags, alignof(char));
     }
     std::array<std::vector<OutSectionID>, meta::numProgramSegments> segmentedSections;
-    status = sortOutputSections({.in{outputSectionTypes, flags}, .out{segmentedSections}});
+    status = sortOutputSections({.in{outputSectionTypes, flags, options.separateReadOnlySegment}, .out{segmentedSections}});
     if (status != StatusCode::ok) return status;
 
     std::vector<GOTEntryPatchupInfo> gotEntryPatches;
     status = preProcessesRelocations({.in{elfAddresses, sectionHeaders, symbolTable,
-                                          inputSectionCopyCommands, inputToOutputSection, outputToInputSections.size(), gotID},
+                                          inputSectionCopyCommands, inputToOutputSection, sectionStates, outputToInputSections.size(), gotID},
                                       .out{processedRelas, gotEntryPatches}});
     if (status != StatusCode::ok) return status;
 
+    if (options.gcMergedPieces) {
+        status = removeUnreferencedMergedPieces({.in{sectionHeaders, outputToInputSections, inputToOutputSection, flags, alignments,
+                                                     symbolTable, gotEntryPatches, gotID},
+                                                 .inout{inputSectionCopyCommands, processedRelas, outputSectionSizes, materializedViews},
+                                                 .out{sectionMaterializationMemory}});
+        if (status != StatusCode::ok) return status;
+    }
+
     // Reserve GOT space
     outputSectionSizes[gotID] = (meta::numReservedGotEntries + gotEntryPatches.size()) * sizeof(Elf64_Addr);
     materializedViews[gotID] = static_cast<std::byte*>(sectionMaterializationMemory.allocate(outputSectionSizes[gotID]));
+    // The reserved entries and those of undefined weak symbols stay zero
+    std::memset(materializedViews[gotID], 0, outputSectionSizes[gotID]);
 
-    status = constructLoadedSectionLayout({.in{segmentedSections, outputSectionSizes, alignments, outputSectionTypes},
+    status = constructLoadedSectionLayout({.in{segmentedSections, outputSectionSizes, alignments, outputSectionTypes, options.maxPageSize, options.hugePageText, !options.separateCode},
                                            .out{programHeaders, outputSectionAddresses, outputSectionFileOffsets}});
     if (status != StatusCode::ok) return status;
 
@@ -99,8 +178,8 @@ auto mapInputSectionsToOutputSections(parametersFor::MapInputSectionsToOutputSec
     status = synthesizeSyntheticSections({.in{gotID, symTabID, strTabID, shstrTabID,
                                               gotEntryPatches, outputSectionAddresses,
                                               inputToOutputSection, inputSectionCopyCommands,
-                                              flags, names, symbolTable, elfAddresses,
-                                              sectionHeaders, enoughStringTableMemory, enoughSymbolTableMemory},
+                                              flags, names, symbolTable, elfAddresses, sortKeys,
+                                              sectionHeaders, options.reproducible, enoughStringTableMemory, enoughSymbolTableMemory},
                                           .inout{materializedViews, outputSectionSizes},
                                           .out{numLocalSymbols, sh_names}});
     if (status != StatusCode::ok) return status;
@@ -130,6 +209,57 @@ auto mapInputSectionsToOutputSections(parametersFor::MapInputSectionsToOutputSec
 // Implementation of the substeps
 // They should all more or less get inlined into the primary function
 
+namespace /*internal*/ {
+
+// Certain Section Names get truncated
+// Names with the same character after the dot are next to each other, longer names before their prefixes
+constexpr std::array<std::string_view, 13> namesToTruncate{
+    ".text",
+    ".tbss",
+    ".tdata",
+    ".data.rel.ro",
+    ".data",
+    ".ldata",
+    ".lrodata",
+    ".lbss",
+    ".rodata",
+    ".bss.rel.ro",
+    ".bss",
+    ".init_array",
+    ".fini_array"};
+
+// First level of a trie over namesToTruncate: the character after the dot selects the range of candidates
+constexpr auto truncationCandidates = [] {
+    std::array<std::pair<uint8_t, uint8_t>, 256> ranges{};
+    for (uint8_t i{0}; i < namesToTruncate.size(); ++i) {
+        auto& range = ranges[static_cast<unsigned char>(namesToTruncate[i][1])];
+        if (range.first == range.second) range = {i, i};
+        ++range.second;
+    }
+    return ranges;
+}();
+
+auto toOutputSectionName(std::string_view fullName) -> std::string_view {
+    if (fullName.size() < 2 || fullName[0] != '.') return fullName;
+    auto [first, last] = truncationCandidates[static_cast<unsigned char>(fullName[1])];
+    for (auto i = first; i < last; ++i) {
+        if (fullName.starts_with(namesToTruncate[i])) return fullName.substr(0, namesToTruncate[i].size());
+    }
+    return fullName;
+}
+
+// The sections of one file that go into one output section
+struct FileBucket {
+    std::string_view outputSectionName;
+    std::vector<SectionRef> sections;
+    OutSectionID outSecID{0};
+    size_t offsetInOutputSection{0};
+    // Never shares its output section with other buckets
+    bool isGroupMember{false};
+};
+
+} // namespace
+
 auto initOutputSections(parametersFor::InitOutputSections p) -> StatusCode {
     // Certain Section Types never reach the output
     auto sectionTypeReachesOutput = [](Elf64_Word type) -> bool {
@@ -145,75 +275,102 @@ auto initOutputSections(parametersFor::InitOutputSections p) -> StatusCode {
         return true;
     };
 
-    // Certain Section Names get truncated
-    auto toOutputSectionName = [](std::string_view fullName) -> std::string_view {
-        constexpr std::array<std::string_view, 13> namesToTruncate{
-            ".text",
-            ".data.rel.ro",
-            ".data",
-            ".ldata",
-            ".rodata",
-            ".lrodata",
-            ".bss.rel.ro",
-            ".bss",
-            ".lbss",
-            ".init_array",
-            ".fini_array",
-            ".tbss",
-            ".tdata"};
-        for (auto truncate : namesToTruncate) {
-            if (fullName.starts_with(truncate)) return fullName.substr(0, truncate.size());
-        }
-        return fullName;
-    };
-
-    auto& [sectionHeaders, sectionStringTables] = p.in;
+    auto& [sectionHeaders, sectionStringTables, sectionStates, sortByName, keepSectionNames] = p.in;
     auto& [names, outputToInputSections, alignments, types, flags, inputToOutputSection,
            totalNumberOfLocalSymbols, totalStringTableMemorySize] = p.out;
 
     // sections to output sections. 2D array since input sections are also in a 2D array
     inputToOutputSection.resize(sectionHeaders.size());
-    totalNumberOfLocalSymbols = 0;
-    totalStringTableMemorySize = 0;
 
-    // sections names to inputSections
-    std::unordered_map<std::string_view, std::vector<SectionRef>> sectionMap;
-    // Map all input sections to their output section
-    // The final ids for the output sections are only known after flattening the hash map, so the id is assigned later
-    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t inputIndex) {
+    // Every file buckets its sections by output section name on its own, in parallel
+    // The buckets keep the order of the first appearance of a name in the file
+    Vector2D<FileBucket> fileBuckets(sectionHeaders.size());
+    std::vector<size_t> stringTableMemorySizes(sectionHeaders.size(), 0);
+    std::vector<size_t> numberOfLocalSymbols(sectionHeaders.size(), 0);
+    parallel_for_each_indexed(fileBuckets, [&](std::vector<FileBucket>& buckets, size_t inputIndex) {
+        auto headers = sectionHeaders[inputIndex];
         // Reserve enough space for later. For debugging set an out of bounds value
         inputToOutputSection[inputIndex].resize(headers.size(), meta::notAnOutputSection);
 
+        std::unordered_map<std::string_view, size_t> bucketIndices;
         for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerIndex) {
             if (header.sh_type == SHT_STRTAB)
-                totalStringTableMemorySize += header.sh_size;
+                stringTableMemorySizes[inputIndex] += header.sh_size;
             if (header.sh_type == SHT_SYMTAB)
-                totalNumberOfLocalSymbols += header.sh_info;
-            if (!sectionTypeReachesOutput(header.sh_type))
+                numberOfLocalSymbols[inputIndex] += header.sh_info;
+            if (!sectionTypeReachesOutput(header.sh_type) || sectionStates[inputIndex][headerIndex] != InputSectionState::live)
                 return;
             std::string_view sectionName{sectionStringTables[inputIndex] + header.sh_name};
-            auto outputSectionName = toOutputSectionName(sectionName);
-            sectionMap[outputSectionName].push_back({.elfIndex = inputIndex, .headerIndex = headerIndex});
+            if (keepSectionNames && (header.sh_flags & SHF_GROUP)) {
+                buckets.push_back({.outputSectionName = sectionName, .sections = {{.elfIndex = inputIndex, .headerIndex = headerIndex}}, .isGroupMember = true});
+                return;
+            }
+            auto outputSectionName = keepSectionNames ? sectionName : toOutputSectionName(sectionName);
+            auto [bucketIndex, isNew] = bucketIndices.try_emplace(outputSectionName, buckets.size());
+            if (isNew) buckets.push_back({.outputSectionName = outputSectionName, .sections = {}});
+            buckets[bucketIndex->second].sections.push_back({.elfIndex = inputIndex, .headerIndex = headerIndex});
         });
     });
+    totalStringTableMemorySize = std::accumulate(stringTableMemorySizes.begin(), stringTableMemorySizes.end(), size_t{0});
+    totalNumberOfLocalSymbols = std::accumulate(numberOfLocalSymbols.begin(), numberOfLocalSymbols.end(), size_t{0});
+
+    // Output sections get their ids in order of first appearance, going through the files in order
+    // This only touches every name once per file and is the same on every run
+    std::unordered_map<std::string_view, OutSectionID> outSectionIDs;
+    std::vector<size_t> outputSectionInputCounts;
+    for (auto& buckets : fileBuckets) {
+        for (auto& bucket : buckets) {
+            auto nextID = static_cast<OutSectionID>(names.size());
+            auto [outSecID, isNew] = bucket.isGroupMember ? std::pair{outSectionIDs.end(), true} : outSectionIDs.try_emplace(bucket.outputSectionName, nextID);
+            if (isNew) {
+                // 4 synthetic sections will be added later (got, symtab, strtab and shstrtab)
+                if (names.size() >= (SHN_LORESERVE - 4))
+                    return report(StatusCode::not_ok, "too many output sections: ", names.size() + 1);
+                names.push_back(bucket.outputSectionName);
+                outputSectionInputCounts.push_back(0);
+            }
+            bucket.outSecID = bucket.isGroupMember ? nextID : outSecID->second;
+            bucket.offsetInOutputSection = std::exchange(outputSectionInputCounts[bucket.outSecID],
+                                                         outputSectionInputCounts[bucket.outSecID] + bucket.sections.size());
+        }
+    }
 
-    // 4 synthetic sections will be added later (got, symtab, strtab and shstrtab)
-    if (sectionMap.size() >= (SHN_LORESERVE - 4))
-        return report(StatusCode::not_ok, "too many output sections: ", sectionMap.size());
-
-    // Flatten map to array. This is necessary to obtain a reasonable index and to make iterations faster
-    names.reserve(sectionMap.size());
-    outputToInputSections.reserve(sectionMap.size());
-    for (auto& [name, inputSections] : sectionMap) {
-        names.push_back(name);
-        outputToInputSections.push_back(std::move(inputSections));
+    if (sortByName) {
+        std::vector<OutSectionID> byName(names.size());
+        std::iota(byName.begin(), byName.end(), OutSectionID{0});
+        std::sort(byName.begin(), byName.end(), [&](OutSectionID a, OutSectionID b) { return names[a] < names[b]; });
+        std::vector<OutSectionID> renamedIDs(names.size());
+        for_each_indexed(byName, [&](OutSectionID oldID, size_t newID) { renamedIDs[oldID] = static_cast<OutSectionID>(newID); });
+
+        std::vector<std::string_view> sortedNames(names.size());
+        std::vector<size_t> sortedInputCounts(names.size());
+        for_each_indexed(byName, [&](OutSectionID oldID, size_t newID) {
+            sortedNames[newID] = names[oldID];
+            sortedInputCounts[newID] = outputSectionInputCounts[oldID];
+        });
+        names = std::move(sortedNames);
+        outputSectionInputCounts = std::move(sortedInputCounts);
+        for (auto& buckets : fileBuckets) {
+            for (auto& bucket : buckets)
+                bucket.outSecID = renamedIDs[bucket.outSecID];
+        }
     }
 
+    // The buckets are copied to their place in parallel, which gives the same order as filling the output sections file by file
+    outputToInputSections.resize(names.size());
+    for_each_indexed(outputToInputSections, [&](std::vector<SectionRef>& inputSections, size_t outSecID) {
+        inputSections.resize(outputSectionInputCounts[outSecID]);
+    });
+    parallel_for_each_indexed(fileBuckets, [&](std::vector<FileBucket>& buckets, size_t) {
+        for (auto& bucket : buckets) {
+            std::copy(bucket.sections.begin(), bucket.sections.end(),
+                      outputToInputSections[bucket.outSecID].begin() + static_cast<std::ptrdiff_t>(bucket.offsetInOutputSection));
+        }
+    });
+
     // SHF_MERGE sometimes appears in .rodata sections but sometimes it doesn't.
-    // If that happens, the flags are not directly compatible, so the no merge happens.
-    // Though luck, now your output is maybe slightly larger than before... should have put it in a separate section
-    // Of course, partial merging would in principal be possible, but it was not demanded
-    // and is thus not in the scope of this project
+    // If that happens, the flags are not directly compatible and the output section loses the merge flags.
+    // The mergeable inputs still get deduplicated, see mergeAndSortInputSections
     auto makeFlagsCompatible = [](Elf64_Xword& sourceFlag, Elf64_Xword other) {
         if (sourceFlag == other) return true;
 
@@ -235,26 +392,28 @@ auto initOutputSections(parametersFor::InitOutputSections p) -> StatusCode {
     StatusCode status{StatusCode::ok};
     // set alignment, types and flags for output section
     // This is necessary to sort them to the correct place later
-    // Each output section is independent from others, so they could be done in parallel (though there isn't much to be gained here since the number of output section is fairly small and the input unevenly distributed)
-    for_each_indexed(outputToInputSections, [&](std::vector<SectionRef>& inputSections, size_t outSecID) {
+    // Each output section is independent from others, so they are done in parallel
+    parallel_for_each_indexed(outputToInputSections, [&](std::vector<SectionRef>& inputSections, size_t outSecID) {
         for_each_indexed(inputSections, [&](SectionRef secRef, size_t sectionIndex) {
             // The linter once again sees an uninitialized pointer, which seems to be confusing some things
             // NOLINTNEXTLINE
             auto& inputSection = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+            // Groups are resolved already, only relocatable output has them again
+            auto inputFlags = keepSectionNames ? inputSection.sh_flags : inputSection.sh_flags & ~static_cast<Elf64_Xword>(SHF_GROUP);
 
             // Create a link back. Since one input can only ever belong to one output, there is no race condition here
             inputToOutputSection[secRef.elfIndex][secRef.headerIndex] = static_cast<OutSectionID>(outSecID);
             // The first section determines the attributes
             if (sectionIndex == 0) {
-                flags[outSecID] = inputSection.sh_flags;
+                flags[outSecID] = inputFlags;
                 types[outSecID] = inputSection.sh_type;
                 alignments[outSecID] = inputSection.sh_addralign;
             }
             // Error on incompatible type + flags
-            if ((!makeFlagsCompatible(flags[outSecID], inputSection.sh_flags)) || (types[outSecID] != inputSection.sh_type)) {
-                status = report(StatusCode::not_ok, "Sections with the same name have different flags/flags than expected: ",
-                                flags[outSecID], " vs ", inputSection.sh_flags, " and ", types[outSecID], " vs. ", inputSection.sh_type,
-                                ". Offending section: ", names[outSecID]);
+            if ((!makeFlagsCompatible(flags[outSecID], inputFlags)) || (types[outSecID] != inputSection.sh_type)) {
+                std::atomic_ref{status}.store(report(StatusCode::not_ok, "Sections with the same name have different flags/flags than expected: ",
+                                                     flags[outSecID], " vs ", inputFlags, " and ", types[outSecID], " vs. ", inputSection.sh_type,
+                                                     ". Offending section: ", names[outSecID]));
             }
             // Alignment is the maximum of all input sections
             alignments[outSecID] = std::max(alignments[outSecID], inputSection.sh_addralign);
@@ -268,8 +427,10 @@ namespace /*internal*/ {
 struct ConcatenateSections {
     struct {
         readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
         readonly_span<SectionRef> sectionRefs;
         OutSectionID outSectionID;
+        bool reserveSlack;
     } in;
     struct {
         out<std::vector<size_t>> outputSectionSizes;
@@ -277,173 +438,728 @@ struct ConcatenateSections {
     } out;
 };
 
+// Output sections with fewer inputs than two chunks are laid out serially
+constexpr size_t concatenationChunkSize{1 << 14};
+
 auto concatenateSections(ConcatenateSections p) -> StatusCode {
-    auto& [sectionHeaders, sectionRefs, outSectionID] = p.in;
+    auto& [sectionHeaders, sectionStringTables, sectionRefs, outSectionID, reserveSlack] = p.in;
     auto& [outputSectionSizes, inputSectionCopyCommands] = p.out;
-    size_t outSectionSize{0};
-    for (auto& secRef : sectionRefs) {
-        auto elfID = secRef.elfIndex;
-        auto& inSecHdr = sectionHeaders[elfID][secRef.headerIndex];
 
-        outSectionSize = alignup(outSectionSize, inSecHdr.sh_addralign);
+    auto headerOf = [&](size_t i) -> Elf64_Shdr const& { return sectionHeaders[sectionRefs[i].elfIndex][sectionRefs[i].headerIndex]; };
+    auto copyCommandOf = [&](size_t i) -> SectionMemCopies& { return inputSectionCopyCommands[sectionRefs[i].elfIndex][sectionRefs[i].headerIndex]; };
+    // Places the inputs [begin, end) from offset on and returns the end
+    auto place = [&](size_t begin, size_t end, size_t offset) -> size_t {
+        for (auto i = begin; i < end; ++i) {
+            auto& inSecHdr = headerOf(i);
+            offset = alignup(offset, inSecHdr.sh_addralign);
+            copyCommandOf(i) = PartCopy{.size = inSecHdr.sh_size, .dstOffset = offset};
+            auto hasSlot = reserveSlack && hasIncrementalSlot(inSecHdr, sectionStringTables[sectionRefs[i].elfIndex] + inSecHdr.sh_name);
+            offset += hasSlot ? incrementalSlotSize(inSecHdr.sh_size) : inSecHdr.sh_size;
+        }
+        return offset;
+    };
 
-        auto& copyCmds = inputSectionCopyCommands[elfID];
-        copyCmds.resize(sectionHeaders[elfID].size());
-        copyCmds[secRef.headerIndex] = PartCopy{.size = inSecHdr.sh_size,
-                                                .dstOffset = outSectionSize};
-        //copyCmds[secRef.headerIndex].push_back({.size = inSecHdr.sh_size,
-        //                                        .dstOffset = outSectionSize});
-        outSectionSize += inSecHdr.sh_size;
+    if (sectionRefs.size() < 2 * concatenationChunkSize) {
+        outputSectionSizes[outSectionID] = place(0, sectionRefs.size(), 0);
+        return StatusCode::ok;
     }
+
+    // Each chunk is placed from offset 0 in parallel first. Alignments are powers of two, so all of them divide the largest one of the chunk.
+    // From the first input with that alignment (the anchor) on, the final offsets only differ by a constant shift.
+    // The inputs in front of the anchor are placed again once the start of the chunk is known, which gives the same result as placing serially
+    struct Chunk {
+        size_t begin;
+        size_t end;
+        size_t anchor;
+        size_t maxAlignment{1};
+        size_t size{0};
+        size_t shift{0};
+        bool powerOfTwoAlignments{true};
+    };
+    std::vector<Chunk> chunks;
+    chunks.reserve(sectionRefs.size() / concatenationChunkSize + 1);
+    for (size_t begin{0}; begin < sectionRefs.size(); begin += concatenationChunkSize)
+        chunks.push_back({.begin = begin, .end = std::min(begin + concatenationChunkSize, sectionRefs.size()), .anchor = begin});
+
+    parallel_for_each_indexed(chunks, [&](Chunk& chunk, size_t) {
+        for (auto i = chunk.begin; i < chunk.end; ++i) {
+            auto alignment = std::max<size_t>(headerOf(i).sh_addralign, 1);
+            chunk.powerOfTwoAlignments &= std::has_single_bit(alignment);
+            if (alignment > chunk.maxAlignment) {
+                chunk.maxAlignment = alignment;
+                chunk.anchor = i;
+            }
+        }
+        chunk.size = place(chunk.begin, chunk.end, 0);
+    });
+    if (!std::all_of(chunks.begin(), chunks.end(), [](Chunk const& chunk) { return chunk.powerOfTwoAlignments; })) {
+        outputSectionSizes[outSectionID] = place(0, sectionRefs.size(), 0);
+        return StatusCode::ok;
+    }
+
+    size_t outSectionSize{0};
+    for (auto& chunk : chunks) {
+        auto anchorOffset = alignup(place(chunk.begin, chunk.anchor, outSectionSize), chunk.maxAlignment);
+        chunk.shift = anchorOffset - std::get<PartCopy>(copyCommandOf(chunk.anchor)).dstOffset;
+        outSectionSize = chunk.size + chunk.shift;
+    }
+
+    parallel_for_each_indexed(chunks, [&](Chunk const& chunk, size_t) {
+        for (auto i = chunk.anchor; i < chunk.end; ++i)
+            std::get<PartCopy>(copyCommandOf(i)).dstOffset += chunk.shift;
+    });
     outputSectionSizes[outSectionID] = outSectionSize;
     return StatusCode::ok;
 };
 
-enum class MergeType {
-    fixedLength,
-    variableLength
+// Key for the deduplication. The hash was calculated once while splitting and is reused for every lookup
+struct MergePiece {
+    std::string_view data;
+    uint64_t hash;
+};
+
+// The deduplicated representation of all equal pieces
+// The piece that appears first in input order (lowest SortKey, then header and position) owns it and decides its placement
+// With tail merging, a piece that ends another piece has no storage of its own and lives at the end of its host
+struct MergedPiece {
+    size_t ownerSection;
+    size_t ownerPiece;
+    size_t outSectionOffset;
+    MergedPiece const* tailOf{nullptr};
+    size_t offsetInHost{0};
+};
+
+struct MergePieceHash {
+    size_t operator()(MergePiece const& piece) const { return piece.hash; }
+};
+struct MergePieceEqual {
+    bool operator()(MergePiece const& a, MergePiece const& b) const { return a.data == b.data; }
+};
+
+// Mutex sharded map, so several threads can insert pieces at the same time without fighting over a single lock
+struct MergeShard {
+    std::mutex mutex;
+    std::unordered_map<MergePiece, MergedPiece, MergePieceHash, MergePieceEqual> pieces;
 };
+constexpr size_t numMergeShards{64};
+// Below this size, spawning threads costs more than merging
+constexpr size_t minBytesForParallelMerge{size_t{1} << 16};
 
 struct MergeSections {
     struct {
         readonly_span<std::byte*> elfAddresses;
         readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
         readonly_span<SectionRef> sectionRefs;
-        OutSectionID outSectionID;
         MergeType mergeType;
+        bool tailMergeStrings;
+        size_t baseOffset; // Where the merged block starts inside the output section
     } in;
     struct {
-        out<std::vector<size_t>> outputSectionSizes;
+        inout<std::mutex> materializationMutex;
+    } inout;
+    struct {
+        out<size_t> mergedSize;
         out<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
         out<std::byte*> materializedView;
         out<std::pmr::memory_resource> materializedSectionMemory;
     } out;
 };
 
+// Pieces are split and hashed per input section and then inserted into a sharded map concurrently.
+// The owner of each piece is the first occurence in input order, so the result does not depend on the thread interleaving.
+// Offsets are assigned by a prefix sum over the bytes owned by each input section
 auto mergeSections(MergeSections p) -> StatusCode {
     auto& [elfAddresses,
            sectionHeaders,
            sectionRefs,
-           outSectionID,
-           mergeType] = p.in;
+           mergeType,
+           tailMergeStrings,
+           baseOffset] = p.in;
+
+    auto& [materializationMutex] = p.inout;
 
-    auto& [outputSectionSizes,
+    auto& [mergedSize,
            inputSectionCopyCommands,
            materializedView,
            materializedSectionMemory] = p.out;
 
-    size_t outSectionSize{0};
-    std::unordered_map<std::string_view, size_t> elementToOutSectionOffset;
+    size_t totalInputSize{0};
+    for (auto& secRef : sectionRefs)
+        totalInputSize += sectionHeaders[secRef.elfIndex][secRef.headerIndex].sh_size;
 
-    Vector2D<std::string_view> sectionElements;
-    sectionElements.reserve(sectionRefs.size());
+    std::vector<readonly_span<char>> sectionData(sectionRefs.size());
+    std::vector<SectionPieces> sectionPieces(sectionRefs.size());
+    Vector2D<MergedPiece*> mergedPieces(sectionRefs.size());
+    auto forEachInputSection = [&, parallel = totalInputSize >= minBytesForParallelMerge](auto f) {
+        if (parallel) {
+            parallel_for_each_indexed(sectionPieces, f);
+        } else {
+            for_each_indexed(sectionPieces, f);
+        }
+    };
+    auto pieceData = [&](size_t secRefIndex, size_t pieceIndex) {
+        auto& offsets = sectionPieces[secRefIndex].offsets;
+        auto start = offsets[pieceIndex];
+        return std::string_view{sectionData[secRefIndex].data() + start, offsets[pieceIndex + 1] - start};
+    };
 
-    for (auto& secRef : sectionRefs) {
-        auto baseAddress = elfAddresses[secRef.elfIndex];
-        auto secHdr = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
-        // While we are here, prepare enough space for the copy commands later
-        inputSectionCopyCommands[secRef.elfIndex].resize(sectionHeaders[secRef.elfIndex].size());
-
-        const bool useFixedLength{mergeType == MergeType::fixedLength};
-        auto& secElements = sectionElements.emplace_back();
-
-        auto stringsStart = estd::start_lifetime_as_array<char>(baseAddress + secHdr.sh_offset, secHdr.sh_size);
-        auto stringsEnd = stringsStart + secHdr.sh_size;
-        for (char* nextEnd{}; stringsStart < stringsEnd; stringsStart = nextEnd) {
-            //
-            nextEnd = useFixedLength ? stringsStart + secHdr.sh_entsize :
-                                       std::find(stringsStart, stringsEnd, '\0') + 1;
-            if (nextEnd > stringsEnd) {
-                return report(StatusCode::not_ok, "section merger encountered out of bounds element");
-            }
+    StatusCode status{StatusCode::ok};
+
+    // Split and hash
+    forEachInputSection([&](SectionPieces& pieces, size_t secRefIndex) {
+        auto& secRef = sectionRefs[secRefIndex];
+        auto& secHdr = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+        if (secHdr.sh_size == 0) return;
+
+        sectionData[secRefIndex] = view_as_span<char>(elfAddresses[secRef.elfIndex] + secHdr.sh_offset, secHdr.sh_size);
+        auto splitStatus = splitSectionIntoPieces({.in{sectionData[secRefIndex], secHdr.sh_entsize, mergeType},
+                                                   .out{pieces}});
+        if (splitStatus != StatusCode::ok)
+            std::atomic_ref{status}.store(splitStatus);
+    });
+    if (status != StatusCode::ok) return status;
 
-            // Using a string_view because it comes with a hash function built in
-            std::string_view element{stringsStart, nextEnd};
-            secElements.push_back(element);
+    // Deduplicate. The shard is picked with the upper bits, since the map itself uses the lower ones
+    std::array<MergeShard, numMergeShards> shards;
+    for (auto& shard : shards)
+        shard.pieces.reserve(totalInputSize / (16 * numMergeShards));
+
+    forEachInputSection([&](SectionPieces& pieces, size_t secRefIndex) {
+        auto& merged = mergedPieces[secRefIndex];
+        merged.resize(pieces.hashes.size());
+        for_each_indexed(pieces.hashes, [&](uint64_t hash, size_t pieceIndex) {
+            auto& shard = shards[(hash >> 32u) % numMergeShards];
+            std::unique_lock lock{shard.mutex};
+            auto [it, newInsert] = shard.pieces.try_emplace({pieceData(secRefIndex, pieceIndex), hash},
+                                                            MergedPiece{secRefIndex, pieceIndex, 0});
+            auto& mergedPiece = it->second;
+            // Map nodes are stable, so the pointer stays valid while other threads keep inserting
+            merged[pieceIndex] = &mergedPiece;
+            if (!newInsert && std::pair{secRefIndex, pieceIndex} < std::pair{mergedPiece.ownerSection, mergedPiece.ownerPiece}) {
+                mergedPiece.ownerSection = secRefIndex;
+                mergedPiece.ownerPiece = pieceIndex;
+            }
+        });
+    });
 
-            auto [_, newInsert] = elementToOutSectionOffset.try_emplace(element, outSectionSize);
-            if (!newInsert) continue;
+    auto isOwner = [&](size_t secRefIndex, size_t pieceIndex) {
+        auto& mergedPiece = *mergedPieces[secRefIndex][pieceIndex];
+        return mergedPiece.ownerSection == secRefIndex && mergedPiece.ownerPiece == pieceIndex;
+    };
 
-            outSectionSize += element.size();
+    // Sorted by their reversed content, all strings ending with a string directly follow it.
+    // So if the next string ends with the current one, the current one is a tail of it (or whatever hosts that one)
+    std::vector<MergedPiece*> tails;
+    if (tailMergeStrings && mergeType == MergeType::variableLength) {
+        std::vector<std::pair<std::string_view, MergedPiece*>> uniquePieces;
+        for_each_indexed(sectionPieces, [&](SectionPieces& pieces, size_t secRefIndex) {
+            for (size_t pieceIndex = 0; pieceIndex < pieces.hashes.size(); ++pieceIndex) {
+                if (isOwner(secRefIndex, pieceIndex))
+                    uniquePieces.emplace_back(pieceData(secRefIndex, pieceIndex), mergedPieces[secRefIndex][pieceIndex]);
+            }
+        });
+        std::sort(uniquePieces.begin(), uniquePieces.end(), [](auto const& a, auto const& b) {
+            return std::lexicographical_compare(a.first.rbegin(), a.first.rend(), b.first.rbegin(), b.first.rend());
+        });
+        for (size_t i = uniquePieces.size(); i-- > 1;) {
+            auto& [data, mergedPiece] = uniquePieces[i - 1];
+            auto& [nextData, nextMergedPiece] = uniquePieces[i];
+            if (!nextData.ends_with(data)) continue;
+            auto* host = nextMergedPiece->tailOf ? nextMergedPiece->tailOf : nextMergedPiece;
+            auto hostSize = nextData.size() + nextMergedPiece->offsetInHost;
+            mergedPiece->tailOf = host;
+            mergedPiece->offsetInHost = hostSize - data.size();
+            tails.push_back(mergedPiece);
         }
     }
+    auto placesBytes = [&](size_t secRefIndex, size_t pieceIndex) {
+        return isOwner(secRefIndex, pieceIndex) && !mergedPieces[secRefIndex][pieceIndex]->tailOf;
+    };
+
+    // Prefix sum over the bytes each input section contributes to the output
+    std::vector<size_t> ownedSizes(sectionRefs.size());
+    forEachInputSection([&](SectionPieces& pieces, size_t secRefIndex) {
+        size_t ownedSize{0};
+        for (size_t pieceIndex = 0; pieceIndex < pieces.hashes.size(); ++pieceIndex) {
+            if (placesBytes(secRefIndex, pieceIndex)) ownedSize += pieceData(secRefIndex, pieceIndex).size();
+        }
+        ownedSizes[secRefIndex] = ownedSize;
+    });
+    auto outSectionSize = std::reduce(ownedSizes.begin(), ownedSizes.end(), size_t{0});
+    std::exclusive_scan(ownedSizes.begin(), ownedSizes.end(), ownedSizes.begin(), size_t{0});
+
     // After merging the size of the section is known
-    outputSectionSizes[outSectionID] = outSectionSize;
+    mergedSize = outSectionSize;
+    {
+        std::unique_lock lock{materializationMutex};
+        materializedView = static_cast<std::byte*>(materializedSectionMemory.allocate(outSectionSize));
+    }
 
-    for_each_indexed(sectionRefs, [&](SectionRef const& secRef, size_t secRefIndex) {
+    // Owners place their pieces
+    forEachInputSection([&](SectionPieces& pieces, size_t secRefIndex) {
+        auto offset = ownedSizes[secRefIndex];
+        for (size_t pieceIndex = 0; pieceIndex < pieces.hashes.size(); ++pieceIndex) {
+            if (!placesBytes(secRefIndex, pieceIndex)) continue;
+            auto data = pieceData(secRefIndex, pieceIndex);
+            mergedPieces[secRefIndex][pieceIndex]->outSectionOffset = offset;
+            std::memcpy(materializedView + offset, data.data(), data.size());
+            offset += data.size();
+        }
+    });
+    for (auto* tail : tails)
+        tail->outSectionOffset = tail->tailOf->outSectionOffset + tail->offsetInHost;
+
+    // Everyone looks up where their pieces went
+    forEachInputSection([&](SectionPieces& pieces, size_t secRefIndex) {
+        auto& secRef = sectionRefs[secRefIndex];
         auto& sectionMemCopies = inputSectionCopyCommands[secRef.elfIndex][secRef.headerIndex];
-        auto& elements = sectionElements[secRefIndex];
 
         sectionMemCopies = std::vector<PartCopy>{};
         auto& partCopies = std::get<std::vector<PartCopy>>(sectionMemCopies);
-        partCopies.reserve(elements.size());
-        for (auto e : elements) {
-            partCopies.push_back({.size = e.size(),
-                                  .dstOffset = elementToOutSectionOffset.at(e)});
+        partCopies.reserve(pieces.hashes.size());
+        for (size_t pieceIndex = 0; pieceIndex < pieces.hashes.size(); ++pieceIndex) {
+            partCopies.push_back({.size = pieceData(secRefIndex, pieceIndex).size(),
+                                  .dstOffset = baseOffset + mergedPieces[secRefIndex][pieceIndex]->outSectionOffset});
+        }
+    });
+
+    return StatusCode::ok;
+};
+
+// 16 Byte entries, e.g. from .rodata.cst16
+struct Entry128 {
+    uint64_t low;
+    uint64_t high;
+    bool operator==(Entry128 const&) const = default;
+    bool operator<(Entry128 const& other) const { return high != other.high ? high < other.high : low < other.low; }
+};
+struct Entry128Hash {
+    size_t operator()(Entry128 const& e) const { return std::hash<uint64_t>{}(e.low ^ (e.high * 0x9e3779b97f4a7c15ull)); }
+};
+template <typename Entry>
+using EntryHash = std::conditional_t<std::is_same_v<Entry, Entry128>, Entry128Hash, std::hash<Entry>>;
+
+// Up to this number of entries, sorting is cheaper than setting up a hash map
+constexpr size_t maxEntriesForSortUnique{4096};
+
+// Fixed size entries are loaded as integers and deduplicated by value instead of being hashed as strings.
+// Like mergeSections, the first occurence of a value in input order decides its offset
+template <typename Entry>
+auto mergeFixedSizeSections(MergeSections p) -> StatusCode {
+    auto& [elfAddresses, sectionHeaders, sectionRefs, mergeType, tailMergeStrings, baseOffset] = p.in;
+    auto& [materializationMutex] = p.inout;
+    auto& [mergedSize, inputSectionCopyCommands, materializedView, materializedSectionMemory] = p.out;
+
+    // Load everything into one flat array
+    std::vector<size_t> sectionStarts;
+    sectionStarts.reserve(sectionRefs.size() + 1);
+    size_t numEntries{0};
+    for (auto& secRef : sectionRefs) {
+        auto& secHdr = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+        if (secHdr.sh_size % sizeof(Entry) != 0)
+            return report(StatusCode::not_ok, "section merger encountered out of bounds element");
+        sectionStarts.push_back(numEntries);
+        numEntries += secHdr.sh_size / sizeof(Entry);
+    }
+    sectionStarts.push_back(numEntries);
+
+    std::vector<Entry> entries(numEntries);
+    for_each_indexed(sectionRefs, [&](SectionRef const& secRef, size_t secRefIndex) {
+        auto& secHdr = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+        if (secHdr.sh_size == 0) return;
+        std::memcpy(entries.data() + sectionStarts[secRefIndex], elfAddresses[secRef.elfIndex] + secHdr.sh_offset, secHdr.sh_size);
+    });
+
+    // Deduplicate. Unique values get consecutive slots in order of their first occurence
+    std::vector<size_t> entrySlots(numEntries);
+    std::vector<Entry> uniqueEntries;
+    if (numEntries <= maxEntriesForSortUnique) {
+        std::vector<uint32_t> order(numEntries);
+        std::iota(order.begin(), order.end(), uint32_t{0});
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return entries[a] < entries[b]; });
+
+        // The first index of a run of equal values is its first occurence
+        std::vector<uint32_t> firstOccurence(numEntries);
+        for (size_t i = 0; i < numEntries; ++i) {
+            bool startsRun = i == 0 || !(entries[order[i - 1]] == entries[order[i]]);
+            firstOccurence[order[i]] = startsRun ? order[i] : firstOccurence[order[i - 1]];
+        }
+        for (size_t i = 0; i < numEntries; ++i) {
+            if (firstOccurence[i] == i) {
+                entrySlots[i] = uniqueEntries.size();
+                uniqueEntries.push_back(entries[i]);
+            } else {
+                entrySlots[i] = entrySlots[firstOccurence[i]];
+            }
+        }
+    } else {
+        std::unordered_map<Entry, size_t, EntryHash<Entry>> entryToSlot;
+        entryToSlot.reserve(numEntries);
+        for_each_indexed(entries, [&](Entry const& entry, size_t i) {
+            auto [it, newInsert] = entryToSlot.try_emplace(entry, uniqueEntries.size());
+            if (newInsert) uniqueEntries.push_back(entry);
+            entrySlots[i] = it->second;
+        });
+    }
+
+    auto outSectionSize = uniqueEntries.size() * sizeof(Entry);
+    mergedSize = outSectionSize;
+    {
+        std::unique_lock lock{materializationMutex};
+        materializedView = static_cast<std::byte*>(materializedSectionMemory.allocate(outSectionSize));
+    }
+    if (outSectionSize) std::memcpy(materializedView, uniqueEntries.data(), outSectionSize);
+
+    for_each_indexed(sectionRefs, [&](SectionRef const& secRef, size_t secRefIndex) {
+        auto& sectionMemCopies = inputSectionCopyCommands[secRef.elfIndex][secRef.headerIndex];
+        sectionMemCopies = std::vector<PartCopy>{};
+        auto& partCopies = std::get<std::vector<PartCopy>>(sectionMemCopies);
+        partCopies.reserve(sectionStarts[secRefIndex + 1] - sectionStarts[secRefIndex]);
+        for (auto i = sectionStarts[secRefIndex]; i < sectionStarts[secRefIndex + 1]; ++i) {
+            partCopies.push_back({.size = sizeof(Entry), .dstOffset = baseOffset + entrySlots[i] * sizeof(Entry)});
         }
     });
 
-    //
-    materializedView = static_cast<std::byte*>(materializedSectionMemory.allocate(outSectionSize));
-    for (auto& [string, offset] : elementToOutSectionOffset) {
-        std::memcpy(materializedView + offset, string.data(), string.size());
+    return StatusCode::ok;
+}
+
+struct MergeOutputSection {
+    struct {
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<SectionRef> sectionRefs;
+        OutSectionID outSectionID;
+        bool tailMergeStrings;
+    } in;
+    struct {
+        inout<std::mutex> materializationMutex;
+    } inout;
+    struct {
+        out<std::vector<size_t>> outputSectionSizes;
+        out<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
+        out<std::byte*> materializedView;
+        out<std::pmr::memory_resource> materializedSectionMemory;
+    } out;
+};
+
+// Input sections are only deduplicated against others with the same entry size and the same kind of entries.
+// Since e.g. .rodata.cst4, .rodata.cst8 and .rodata.cst16 all end up in .rodata, each of those gets its own block.
+// Together the blocks form a merged sub-section that is placed where the first mergeable input would have been.
+// Inputs without SHF_MERGE in the same output section are concatenated around it. Such a mixed output section is not materialized,
+// the writer copies every input with its copy commands instead (PartCopy for the plain ones, one per piece for the merged ones)
+auto mergeOutputSection(MergeOutputSection p) -> StatusCode {
+    auto& [elfAddresses, sectionHeaders, sectionRefs, outSectionID, tailMergeStrings] = p.in;
+    auto& [materializationMutex] = p.inout;
+    auto& [outputSectionSizes, inputSectionCopyCommands, materializedView, materializedSectionMemory] = p.out;
+
+    auto headerOf = [&](SectionRef const& secRef) -> Elf64_Shdr const& {
+        return sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+    };
+    auto mergeTypeOf = [&](SectionRef const& secRef) {
+        return (headerOf(secRef).sh_flags & SHF_STRINGS) ? MergeType::variableLength : MergeType::fixedLength;
+    };
+
+    std::vector<std::pair<uint64_t, MergeType>> groupKeys;
+    Vector2D<SectionRef> groups;
+    for (auto& secRef : sectionRefs) {
+        if (!(headerOf(secRef).sh_flags & SHF_MERGE)) continue;
+        auto key = std::pair{headerOf(secRef).sh_entsize, mergeTypeOf(secRef)};
+        auto groupIt = std::find(groupKeys.begin(), groupKeys.end(), key);
+        if (groupIt == groupKeys.end()) {
+            groupKeys.push_back(key);
+            groups.emplace_back();
+            groupIt = groupKeys.end() - 1;
+        }
+        groups[static_cast<size_t>(groupIt - groupKeys.begin())].push_back(secRef);
     }
 
+    struct MergedBlock {
+        size_t offset;
+        size_t size;
+        std::byte* view;
+    };
+    std::vector<MergedBlock> blocks;
+    size_t outSectionSize{0};
+    auto placeMergedBlocks = [&]() -> StatusCode {
+        for (auto& group : groups) {
+            Elf64_Xword groupAlignment{1};
+            for (auto& secRef : group)
+                groupAlignment = std::max(groupAlignment, headerOf(secRef).sh_addralign);
+            auto& block = blocks.emplace_back(MergedBlock{alignup(outSectionSize, groupAlignment), 0, nullptr});
+
+            auto mergeType = mergeTypeOf(group.front());
+            MergeSections mergeParameters{.in{elfAddresses, sectionHeaders, group, mergeType, tailMergeStrings, block.offset},
+                                          .inout{materializationMutex},
+                                          .out{block.size, inputSectionCopyCommands, block.view, materializedSectionMemory}};
+            StatusCode mergeResult{StatusCode::ok};
+            // Constant pools with an integer sized entry get deduplicated by value
+            switch (mergeType == MergeType::fixedLength ? headerOf(group.front()).sh_entsize : 0) {
+                case sizeof(uint8_t): mergeResult = mergeFixedSizeSections<uint8_t>(mergeParameters); break;
+                case sizeof(uint16_t): mergeResult = mergeFixedSizeSections<uint16_t>(mergeParameters); break;
+                case sizeof(uint32_t): mergeResult = mergeFixedSizeSections<uint32_t>(mergeParameters); break;
+                case sizeof(uint64_t): mergeResult = mergeFixedSizeSections<uint64_t>(mergeParameters); break;
+                case sizeof(Entry128): mergeResult = mergeFixedSizeSections<Entry128>(mergeParameters); break;
+                default: mergeResult = mergeSections(mergeParameters); break;
+            }
+            if (mergeResult != StatusCode::ok) return mergeResult;
+            outSectionSize = block.offset + block.size;
+        }
+        return StatusCode::ok;
+    };
+
+    bool hasPlainInputs{false};
+    for (auto& secRef : sectionRefs) {
+        auto& inSecHdr = headerOf(secRef);
+        if (inSecHdr.sh_flags & SHF_MERGE) {
+            if (!blocks.empty() || groups.empty()) continue;
+            auto mergeResult = placeMergedBlocks();
+            if (mergeResult != StatusCode::ok) return mergeResult;
+            continue;
+        }
+        hasPlainInputs = true;
+        outSectionSize = alignup(outSectionSize, inSecHdr.sh_addralign);
+        inputSectionCopyCommands[secRef.elfIndex][secRef.headerIndex] = PartCopy{.size = inSecHdr.sh_size,
+                                                                                  .dstOffset = outSectionSize};
+        outSectionSize += inSecHdr.sh_size;
+    }
+    outputSectionSizes[outSectionID] = outSectionSize;
+
+    if (hasPlainInputs) return StatusCode::ok;
+    if (blocks.size() == 1) {
+        materializedView = blocks.front().view;
+        return StatusCode::ok;
+    }
+    {
+        std::unique_lock lock{materializationMutex};
+        materializedView = static_cast<std::byte*>(materializedSectionMemory.allocate(outSectionSize));
+    }
+    std::memset(materializedView, 0, outSectionSize);
+    for (auto& block : blocks) {
+        if (block.size) std::memcpy(materializedView + block.offset, block.view, block.size);
+    }
     return StatusCode::ok;
+}
+
+// The groups of functions GCC and Clang mark with section name prefixes, in the order they are placed in .text
+enum class TextGroup : uint8_t {
+    hot,
+    regular,
+    startup,
+    exit,
+    unlikely
 };
 
+auto toTextGroup(std::string_view name) -> TextGroup {
+    constexpr std::array<std::pair<std::string_view, TextGroup>, 4> prefixes{{{".text.hot", TextGroup::hot},
+                                                                              {".text.startup", TextGroup::startup},
+                                                                              {".text.exit", TextGroup::exit},
+                                                                              {".text.unlikely", TextGroup::unlikely}}};
+    for (auto [prefix, group] : prefixes) {
+        // .text.hot or .text.hot.function, but not .text.hotter
+        if (name.starts_with(prefix) && (name.size() == prefix.size() || name[prefix.size()] == '.')) return group;
+    }
+    return TextGroup::regular;
+}
+
+// Data sections where nothing depends on the order of the inputs. Arrays of pointers like .init_array are not among them
+auto isSortableByAlignment(std::string_view outSectionName) -> bool {
+    constexpr std::array<std::string_view, 10> sortableNames{
+        ".data", ".data.rel.ro", ".ldata", ".rodata", ".lrodata", ".bss", ".bss.rel.ro", ".lbss", ".tdata", ".tbss"};
+    return std::find(sortableNames.begin(), sortableNames.end(), outSectionName) != sortableNames.end();
+}
+
+// The bytes concatenateSections inserts between the inputs to align them
+auto alignmentPadding(readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders, readonly_span<SectionRef> sectionRefs) -> size_t {
+    size_t size{0};
+    size_t padding{0};
+    for (auto& secRef : sectionRefs) {
+        auto& header = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+        auto aligned = alignup(size, header.sh_addralign);
+        padding += aligned - size;
+        size = aligned + header.sh_size;
+    }
+    return padding;
+}
+
+// An input section with the key it gets sorted by
+struct KeyedSection {
+    uint64_t key;
+    SectionRef secRef;
+};
+
+// Below this, a comparison sort is faster than the passes over the buckets
+constexpr size_t radixSortThreshold{1 << 12};
+// Elements one thread handles while counting and scattering
+constexpr size_t radixSortChunkSize{1 << 16};
+// Merging more already sorted runs than this is slower than sorting
+constexpr size_t maxMergedRuns{8};
+
+/**
+ * @brief Stable sort by key
+ * Inputs are mostly in order already. Up to maxMergedRuns sorted runs are merged, everything else gets a least significant digit radix sort.
+ * Bytes that are the same in every key are skipped, chunks of the input are counted and scattered in parallel
+ */
+void sortByKey(std::vector<KeyedSection>& sections) {
+    auto byKey = [](KeyedSection const& a, KeyedSection const& b) { return a.key < b.key; };
+    std::vector<size_t> runStarts{0};
+    for (size_t i{1}; i < sections.size() && runStarts.size() <= maxMergedRuns; ++i) {
+        if (sections[i].key < sections[i - 1].key) runStarts.push_back(i);
+    }
+    if (runStarts.size() <= maxMergedRuns) {
+        for (size_t run{1}; run < runStarts.size(); ++run) {
+            auto runEnd = run + 1 < runStarts.size() ? runStarts[run + 1] : sections.size();
+            auto begin = sections.begin();
+            std::inplace_merge(begin, begin + static_cast<std::ptrdiff_t>(runStarts[run]), begin + static_cast<std::ptrdiff_t>(runEnd), byKey);
+        }
+        return;
+    }
+    if (sections.size() < radixSortThreshold) {
+        std::stable_sort(sections.begin(), sections.end(), byKey);
+        return;
+    }
+
+    constexpr size_t numBuckets{256};
+    uint64_t differingBits{0};
+    for (auto& section : sections)
+        differingBits |= section.key ^ sections.front().key;
+
+    std::vector<std::array<size_t, numBuckets>> chunkBuckets((sections.size() + radixSortChunkSize - 1) / radixSortChunkSize);
+    std::vector<KeyedSection> scattered(sections.size());
+    for (unsigned shift{0}; shift < 64; shift += 8) {
+        if (((differingBits >> shift) & (numBuckets - 1)) == 0) continue;
+        auto digitOf = [&](KeyedSection const& section) { return (section.key >> shift) & (numBuckets - 1); };
+        auto chunkOf = [&](size_t chunkID) {
+            auto begin = sections.begin() + static_cast<std::ptrdiff_t>(chunkID * radixSortChunkSize);
+            return std::span{begin, std::min(radixSortChunkSize, sections.size() - chunkID * radixSortChunkSize)};
+        };
+        parallel_for_each_indexed(chunkBuckets, [&](std::array<size_t, numBuckets>& buckets, size_t chunkID) {
+            buckets.fill(0);
+            for (auto& section : chunkOf(chunkID))
+                ++buckets[digitOf(section)];
+        });
+        // Each chunk scatters behind the earlier chunks with the same digit, which keeps the sort stable
+        for (size_t offset{0}, digit{0}; digit < numBuckets; ++digit) {
+            for (auto& buckets : chunkBuckets)
+                offset += std::exchange(buckets[digit], offset);
+        }
+        parallel_for_each_indexed(chunkBuckets, [&](std::array<size_t, numBuckets>& buckets, size_t chunkID) {
+            for (auto& section : chunkOf(chunkID))
+                scattered[buckets[digitOf(section)]++] = section;
+        });
+        sections.swap(scattered);
+    }
+}
+
 } // namespace
 
 auto mergeAndSortInputSections(parametersFor::MergeAndSortInputSections p) -> StatusCode {
-    auto& [elfAddresses, sortKeys, sectionHeaders, outSectionFlags] = p.in;
+    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables, outSectionNames, outSectionFlags, sectionPriorities, tailMergeStrings, sortByAlignment, reserveIncrementalSlack] = p.in;
     auto& [outputToInputSections] = p.inout;
-    auto& [outputSectionSizes, inputSectionCopyCommands, materializedViews, materializedSectionMemory] = p.out;
+    auto& [outputSectionSizes, inputSectionCopyCommands, materializedViews, materializedSectionMemory, savedAlignmentPadding] = p.out;
+
+    savedAlignmentPadding = 0;
 
     outputSectionSizes.resize(outSectionFlags.size());
     inputSectionCopyCommands.resize(elfAddresses.size());
     materializedViews.resize(outSectionFlags.size(), nullptr);
+    // Sized up front, so the output sections can be handled concurrently without reallocations
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        inputSectionCopyCommands[elfID].resize(headers.size());
+    });
 
     StatusCode status{StatusCode::ok};
+    std::mutex materializationMutex;
 
-    for_each_indexed(outputToInputSections, [&](std::vector<SectionRef>& sectionRefs, size_t outSectionID) {
-        std::sort(sectionRefs.begin(), sectionRefs.end(), [&](SectionRef const& a, SectionRef const& b) {
-            auto precA = sortKeys[a.elfIndex];
-            auto precB = sortKeys[b.elfIndex];
-            // Same file? sort by file precendece else sort by section location
-            return precA != precB ? precA < precB : a.headerIndex < b.headerIndex;
+    // The precedence of a file as a dense number, so it fits into the upper half of a 64 bit key
+    std::vector<uint32_t> fileRanks(sortKeys.size());
+    {
+        std::vector<uint32_t> filesByPrecedence(sortKeys.size());
+        std::iota(filesByPrecedence.begin(), filesByPrecedence.end(), 0);
+        std::sort(filesByPrecedence.begin(), filesByPrecedence.end(), [&](uint32_t a, uint32_t b) {
+            return sortKeys[a] != sortKeys[b] ? sortKeys[a] < sortKeys[b] : a < b;
         });
-        // all outsectionIDs have flags, but the linter seem to realize this
-        // NOLINTNEXTLINE
-        auto sectionFlags = outSectionFlags[outSectionID];
+        for_each_indexed(filesByPrecedence, [&](uint32_t elfID, size_t rank) { fileRanks[elfID] = static_cast<uint32_t>(rank); });
+    }
+
+    parallel_for_each_indexed(outputToInputSections, [&](std::vector<SectionRef>& sectionRefs, size_t outSectionID) {
+        auto priorityOf = [&](SectionRef const& secRef) {
+            return sectionPriorities.empty() ? noSectionPriority : sectionPriorities[secRef.elfIndex][secRef.headerIndex];
+        };
+        // Sorted by file precedence, then by section location. Explicitly ordered sections come first, so they are sorted by priority last
+        std::vector<KeyedSection> keyedSections;
+        keyedSections.reserve(sectionRefs.size());
+        for (auto& secRef : sectionRefs)
+            keyedSections.push_back({.key = (uint64_t{fileRanks[secRef.elfIndex]} << 32) | secRef.headerIndex, .secRef = secRef});
+        sortByKey(keyedSections);
+        auto hasPriority = [&](SectionRef const& secRef) { return priorityOf(secRef) != noSectionPriority; };
+        if (std::any_of(sectionRefs.begin(), sectionRefs.end(), hasPriority)) {
+            for (auto& keyedSection : keyedSections)
+                keyedSection.key = priorityOf(keyedSection.secRef);
+            sortByKey(keyedSections);
+        }
+        std::transform(keyedSections.begin(), keyedSections.end(), sectionRefs.begin(), [](KeyedSection const& keyedSection) { return keyedSection.secRef; });
+        if (outSectionNames[outSectionID] == ".text") {
+            auto textGroupOf = [&](SectionRef const& secRef) {
+                return toTextGroup(std::string_view{sectionStringTables[secRef.elfIndex] + sectionHeaders[secRef.elfIndex][secRef.headerIndex].sh_name});
+            };
+            auto isRegular = [&](SectionRef const& secRef) { return textGroupOf(secRef) == TextGroup::regular; };
+            if (!std::all_of(sectionRefs.begin(), sectionRefs.end(), isRegular)) {
+                std::stable_sort(sectionRefs.begin(), sectionRefs.end(), [&](SectionRef const& a, SectionRef const& b) {
+                    return textGroupOf(a) < textGroupOf(b);
+                });
+            }
+        }
+        // The flags of the output section lose SHF_MERGE if only some inputs have it, so the inputs decide
+        auto isMergeable = [&](SectionRef const& secRef) {
+            return (sectionHeaders[secRef.elfIndex][secRef.headerIndex].sh_flags & SHF_MERGE) != 0;
+        };
         StatusCode mergeResult{StatusCode::ok};
-        if (!(sectionFlags & SHF_MERGE)) {
-            concatenateSections({.in{sectionHeaders, sectionRefs, static_cast<OutSectionID>(outSectionID)},
+        if (std::none_of(sectionRefs.begin(), sectionRefs.end(), isMergeable)) {
+            if (sortByAlignment && isSortableByAlignment(outSectionNames[outSectionID]) &&
+                std::none_of(sectionRefs.begin(), sectionRefs.end(), hasPriority)) {
+                auto alignmentOf = [&](SectionRef const& secRef) {
+                    return std::max<size_t>(sectionHeaders[secRef.elfIndex][secRef.headerIndex].sh_addralign, 1);
+                };
+                // Stable, so equally aligned sections keep their order by file precedence
+                std::vector<SectionRef> byAlignment{sectionRefs};
+                std::stable_sort(byAlignment.begin(), byAlignment.end(), [&](SectionRef const& a, SectionRef const& b) {
+                    return alignmentOf(a) > alignmentOf(b);
+                });
+                auto paddingBefore = alignmentPadding(sectionHeaders, sectionRefs);
+                auto paddingAfter = alignmentPadding(sectionHeaders, byAlignment);
+                // Sizes that are not a multiple of the alignment can make it worse, then the order stays
+                if (paddingAfter < paddingBefore) {
+                    sectionRefs = std::move(byAlignment);
+                    std::atomic_ref{savedAlignmentPadding}.fetch_add(paddingBefore - paddingAfter);
+                }
+            }
+            concatenateSections({.in{sectionHeaders, sectionStringTables, sectionRefs, static_cast<OutSectionID>(outSectionID), reserveIncrementalSlack},
                                  .out{outputSectionSizes, inputSectionCopyCommands}});
             return;
         }
 
-        MergeType mergeType = (sectionFlags & SHF_STRINGS) ? MergeType::variableLength : MergeType::fixedLength;
-        mergeResult = mergeSections({.in{elfAddresses, sectionHeaders, sectionRefs, static_cast<OutSectionID>(outSectionID), mergeType},
-                                     .out{outputSectionSizes, inputSectionCopyCommands, materializedViews[outSectionID], materializedSectionMemory}});
+        mergeResult = mergeOutputSection({.in{elfAddresses, sectionHeaders, sectionRefs, static_cast<OutSectionID>(outSectionID), tailMergeStrings},
+                                          .inout{materializationMutex},
+                                          .out{outputSectionSizes, inputSectionCopyCommands, materializedViews[outSectionID], materializedSectionMemory}});
         if (mergeResult != StatusCode::ok) {
-            status = mergeResult;
+            std::atomic_ref{status}.store(mergeResult);
         }
     });
 
     return status;
 }
 auto sortOutputSections(parametersFor::SortOutputSections p) -> StatusCode {
-    auto& [types, flags] = p.in;
+    auto& [types, flags, separateReadOnlySegment] = p.in;
     auto& [segmentedSections] = p.out;
 
-    auto flagsToSegmentIndex = [](Elf64_Xword flag) -> size_t {
+    auto flagsToSegmentIndex = [&](Elf64_Xword flag) -> size_t {
         if (!(flag & SHF_ALLOC)) return (meta::SegmentLocation::notLoaded);
         if (flag & SHF_TLS) return (meta::SegmentLocation::tlsTemplate);
         if ((flag & SHF_WRITE) && (flag & SHF_EXECINSTR)) return (meta::SegmentLocation::readWriteExecute);
         if (flag & SHF_WRITE) return (meta::SegmentLocation::readWrite);
         if (flag & SHF_EXECINSTR) return (meta::SegmentLocation::readExecute);
         // else
-        return (meta::SegmentLocation::readOnly);
+        return separateReadOnlySegment ? meta::SegmentLocation::readOnly : meta::SegmentLocation::readExecute;
     };
 
     for_each_indexed(flags, [&](Elf64_Xword flag, size_t outsecID) {
@@ -453,28 +1169,17 @@ auto sortOutputSections(parametersFor::SortOutputSections p) -> StatusCode {
     parallel_for_each_indexed(segmentedSections, [&](std::vector<OutSectionID>& sections, size_t segmentLocation) {
         if (segmentLocation == meta::SegmentLocation::notLoaded)
             return;
-        std::sort(sections.begin(), sections.end(), [&](OutSectionID a, OutSectionID b) {
-            return (types[a] == SHT_NOBITS) < (types[b] == SHT_NOBITS);
+        std::stable_sort(sections.begin(), sections.end(), [&](OutSectionID a, OutSectionID b) {
+            if ((types[a] == SHT_NOBITS) != (types[b] == SHT_NOBITS)) return types[b] == SHT_NOBITS;
+            // Read only data that shares the executable segment goes first
+            return (flags[a] & SHF_EXECINSTR) < (flags[b] & SHF_EXECINSTR);
         });
     });
 
     return StatusCode::ok;
 }
 
-namespace /*internal*/
-{
-struct InputToOutputSectionOffset {
-    struct {
-        in<SectionRef> secRef;
-        in<size_t> offsetInInput;
-        in<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
-    } in;
-    struct {
-        out<size_t> offsetInOutput;
-    } out;
-};
-
-auto inputToOutputSectionOffset(InputToOutputSectionOffset p) -> StatusCode {
+auto inputToOutputSectionOffset(parametersFor::InputToOutputSectionOffset p) -> StatusCode {
     auto& [secRef, offsetInInput, inputSectionCopyCommands] = p.in;
     auto& [offsetInOutput] = p.out;
     offsetInOutput = offsetInInput;
@@ -487,7 +1192,12 @@ auto inputToOutputSectionOffset(InputToOutputSectionOffset p) -> StatusCode {
                 end += copyCmd.size;
                 
                 if (start <= offsetInInput && offsetInInput < end) { // NOLINT
-                    offsetInOutput = offsetInInput + copyCmd.dstOffset; // NOLINT
+                    // Nothing refers to a dropped piece, (local) symbols that still point into one get the start of the section
+                    if (copyCmd.dstOffset == droppedPieceOffset) {
+                        offsetInOutput = 0;
+                        return StatusCode::ok;
+                    }
+                    offsetInOutput = (offsetInInput - start) + copyCmd.dstOffset; // NOLINT
                     return StatusCode::ok;
                 }
                 start = end;
@@ -504,6 +1214,18 @@ auto inputToOutputSectionOffset(InputToOutputSectionOffset p) -> StatusCode {
     return std::visit(visitor, copyCmds);
 };
 
+auto isInDroppedPiece(SectionMemCopies const& copyCommands, size_t offsetInInput) -> bool {
+    auto pieces = std::get_if<std::vector<PartCopy>>(&copyCommands);
+    if (!pieces) return false;
+    for (size_t start{0}; auto& piece : *pieces) {
+        if (offsetInInput < start + piece.size) return piece.dstOffset == droppedPieceOffset;
+        start += piece.size;
+    }
+    return false;
+}
+
+namespace /*internal*/
+{
 struct ProcessRelas {
     struct {
         size_t elfID;
@@ -559,18 +1281,27 @@ auto processRelas(ProcessRelas p) -> StatusCode {
         resRela.symbolValue = entry->second * sizeof(Elf64_Addr);
     };
 
+    // Only .eh_frame has dropped pieces at this point, the relocations of removed FDEs go with them
+    auto& targetCopyCommands = inputSectionCopyCommands[elfID][headerID];
+    auto hasPieces = std::holds_alternative<std::vector<PartCopy>>(targetCopyCommands);
+
     for (auto& rela : relas) {
         auto& sym = linkedSymbols[ELF64_R_SYM(rela.r_info)];
+        if (hasPieces && isInDroppedPiece(targetCopyCommands, rela.r_offset)) continue;
 
         if (sym.st_shndx == SHN_XINDEX) {
             status = report(StatusCode::bad_input_file, " symbol points to a section with a too high index");
             continue;
         }
 
+        // The value of an absolute symbol is its address already. The relocation is still applied where it is and with its addend
         if (sym.st_shndx == SHN_ABS) {
+            size_t outputSectionOffset{};
+            auto outSectionStatus = inputToOutputSectionOffset({.in{{elfID, headerID}, rela.r_offset, inputSectionCopyCommands}, .out{outputSectionOffset}});
+            if (outSectionStatus != StatusCode::ok) return outSectionStatus;
             processResults.push_back(
-                {.addend = 0,
-                 .outputSectionOffset = 0,
+                {.addend = rela.r_addend,
+                 .outputSectionOffset = outputSectionOffset,
                  .symbolValue = sym.st_value,
                  .type = static_cast<uint32_t>(ELF64_R_TYPE(rela.r_info)),
                  .symbolSectionID = 0,
@@ -578,21 +1309,50 @@ auto processRelas(ProcessRelas p) -> StatusCode {
             continue;
         }
 
+        // Discarded sections still get referenced, e.g. by debug info. Those references resolve to zero
+        auto resolvesToNothing = [&](size_t symElfID, size_t symSectionID) {
+            return symSectionID < SHN_LORESERVE && inputToOutputSection[symElfID][symSectionID] == meta::notAnOutputSection;
+        };
+        auto pushReferenceToNothing = [&]() {
+            size_t outputSectionOffset{};
+            auto outSectionStatus = inputToOutputSectionOffset({.in{{elfID, headerID}, rela.r_offset, inputSectionCopyCommands}, .out{outputSectionOffset}});
+            processResults.push_back(
+                {.addend = 0,
+                 .outputSectionOffset = outputSectionOffset,
+                 .symbolValue = 0,
+                 .type = static_cast<uint32_t>(ELF64_R_TYPE(rela.r_info)),
+                 .symbolSectionID = 0,
+                 .note = ProcessedRela::Note::absoluteValue});
+            return outSectionStatus;
+        };
+
         if (ELF32_ST_BIND(sym.st_info) == STB_LOCAL) {
             if (sym.st_shndx == SHN_UNDEF) {
                 status = report(StatusCode::not_ok, " local symbol undefined");
                 continue;
             }
+            if (resolvesToNothing(elfID, sym.st_shndx)) {
+                if (auto nothingStatus = pushReferenceToNothing(); nothingStatus != StatusCode::ok) return nothingStatus;
+                continue;
+            }
 
             size_t outputSectionOffset{};
             auto outSectionStatus = inputToOutputSectionOffset({.in{{elfID, headerID}, rela.r_offset, inputSectionCopyCommands}, .out{outputSectionOffset}});
             if (outSectionStatus != StatusCode::ok) return outSectionStatus;
+            // A section symbol plus addend may refer to any piece of a merged section and the pieces are moved independently.
+            // So the addend has to select the piece before mapping to the output
+            auto symbolOffset = sym.st_value;
+            auto addend = rela.r_addend;
+            if (ELF64_ST_TYPE(sym.st_info) == STT_SECTION && std::holds_alternative<std::vector<PartCopy>>(inputSectionCopyCommands[elfID][sym.st_shndx])) {
+                symbolOffset = static_cast<size_t>(static_cast<int64_t>(symbolOffset) + addend);
+                addend = 0;
+            }
             size_t symbolValue{};
-            auto symbolValueStatus = inputToOutputSectionOffset({.in{{elfID, sym.st_shndx}, sym.st_value, inputSectionCopyCommands}, .out{symbolValue}});
+            auto symbolValueStatus = inputToOutputSectionOffset({.in{{elfID, sym.st_shndx}, symbolOffset, inputSectionCopyCommands}, .out{symbolValue}});
             if (symbolValueStatus != StatusCode::ok) return symbolValueStatus;
 
             processResults.push_back(
-                {.addend = rela.r_addend,
+                {.addend = addend,
                  .outputSectionOffset = outputSectionOffset,
                  .symbolValue = symbolValue,
                  .type = static_cast<uint32_t>(ELF64_R_TYPE(rela.r_info)),
@@ -638,6 +1398,12 @@ auto processRelas(ProcessRelas p) -> StatusCode {
             continue;
         }
 
+        if (resolvesToNothing(firstLoad.elfID, symbol.st_shndx)) {
+            resRela.symbolValue = 0;
+            resRela.symbolSectionID = 0;
+            resRela.note = ProcessedRela::Note::absoluteValue;
+            continue;
+        }
         resRela.symbolSectionID = inputToOutputSection[firstLoad.elfID][firstLoad.symbol->st_shndx];
         if (symbol.st_shndx == SHN_ABS) {
             resRela.symbolValue = firstLoad.symbol->st_value;
@@ -659,7 +1425,7 @@ auto processRelas(ProcessRelas p) -> StatusCode {
 }
 } // namespace
 auto preProcessesRelocations(parametersFor::PreProcessesRelocations p) -> StatusCode {
-    auto& [elfAddresses, sectionHeaders, symbolTable, inputSectionCopyCommands, inputToOutputSection, numberOfOutputSections, gotSectionIndex] = p.in;
+    auto& [elfAddresses, sectionHeaders, symbolTable, inputSectionCopyCommands, inputToOutputSection, sectionStates, numberOfOutputSections, gotSectionIndex] = p.in;
     auto& [processedRelas, gotEntryPatches] = p.out;
     processedRelas.resize(numberOfOutputSections);
 
@@ -690,6 +1456,8 @@ auto preProcessesRelocations(parametersFor::PreProcessesRelocations p) -> Status
                 //relocations in a section that is not part of the output; Can be skipped
                 return;
             }
+            // A folded section shares the bytes of the section it was folded into, which get relocated already
+            if (sectionStates[elfID][header.sh_info] != InputSectionState::live) return;
 
             auto relas = view_as_span<Elf64_Rela>(address + header.sh_offset, header.sh_size / header.sh_entsize);
 
@@ -704,8 +1472,311 @@ auto preProcessesRelocations(parametersFor::PreProcessesRelocations p) -> Status
     });
     return status;
 }
+auto removeUnreferencedMergedPieces(parametersFor::RemoveUnreferencedMergedPieces p) -> StatusCode {
+    auto& [sectionHeaders, outputToInputSections, inputToOutputSection, flags, alignments, symbolTable, gotEntryPatches, gotSectionIndex] = p.in;
+    auto& [inputSectionCopyCommands, processedRelas, outputSectionSizes, materializedViews] = p.inout;
+    auto& [materializedSectionMemory] = p.out;
+
+    auto copyCmdsOf = [&](SectionRef const& secRef) -> SectionMemCopies& {
+        return inputSectionCopyCommands[secRef.elfIndex][secRef.headerIndex];
+    };
+
+    // Only allocated sections are collected, unloaded ones like .comment are referenced by nobody but still wanted
+    std::vector<bool> isCollected(outputToInputSections.size(), false);
+    for_each_indexed(outputToInputSections, [&](std::vector<SectionRef> const& sectionRefs, size_t outSecID) {
+        if (!(flags[outSecID] & SHF_ALLOC)) return;
+        isCollected[outSecID] = std::any_of(sectionRefs.begin(), sectionRefs.end(), [&](SectionRef const& secRef) {
+            return (sectionHeaders[secRef.elfIndex][secRef.headerIndex].sh_flags & SHF_MERGE) && std::holds_alternative<std::vector<PartCopy>>(copyCmdsOf(secRef));
+        });
+    });
+    if (std::none_of(isCollected.begin(), isCollected.end(), [](bool b) { return b; }))
+        return StatusCode::ok;
+
+    auto refersToPiece = [&](ProcessedRela const& rela) {
+        return rela.note == ProcessedRela::Note::none && rela.symbolSectionID != gotSectionIndex && isCollected[rela.symbolSectionID] &&
+               rela.type != R_X86_64_SIZE32 && rela.type != R_X86_64_SIZE64;
+    };
+
+    // Collect the referenced offsets in the output sections
+    Vector2D<size_t> referencedOffsets(outputToInputSections.size());
+    for (auto& relas : processedRelas) {
+        for (auto& rela : relas) {
+            if (refersToPiece(rela)) referencedOffsets[rela.symbolSectionID].push_back(rela.symbolValue);
+        }
+    }
+    auto addReferencedSymbol = [&](size_t elfID, size_t headerID, size_t symbolValue) {
+        if (headerID == SHN_UNDEF || headerID >= SHN_LORESERVE) return;
+        auto outSecID = inputToOutputSection[elfID][headerID];
+        if (outSecID == meta::notAnOutputSection || !isCollected[outSecID]) return;
+        size_t offset{};
+        std::ignore = inputToOutputSectionOffset({.in{{elfID, headerID}, symbolValue, inputSectionCopyCommands}, .out{offset}});
+        referencedOffsets[outSecID].push_back(offset);
+    };
+    for (auto& patch : gotEntryPatches)
+        addReferencedSymbol(patch.elfID, patch.headerID, patch.symbolValue);
+    for (auto& [_, entry] : symbolTable) {
+        if (entry.firstLoad.symbol) addReferencedSymbol(entry.firstLoad.elfID, entry.firstLoad.symbol->st_shndx, entry.firstLoad.symbol->st_value);
+    }
+
+    // Continuous ranges of the output section that stay, and where they move to
+    struct LiveRange {
+        size_t oldStart;
+        size_t oldEnd;
+        size_t newStart;
+    };
+    Vector2D<LiveRange> liveRanges(outputToInputSections.size());
+    // Bytes (pieces, relocated words) move with the range they are in. Symbols may also point right behind a range,
+    // e.g. a label at the end of an input, and move with it as well. Only offsets inside of dropped pieces get droppedPieceOffset
+    enum class Remapped { bytes, symbol };
+    auto remap = [&](size_t outSecID, size_t oldOffset, Remapped what) {
+        auto& ranges = liveRanges[outSecID];
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), oldOffset, [](size_t offset, LiveRange const& range) {
+            return offset < range.oldStart;
+        });
+        if (it == ranges.begin()) return droppedPieceOffset;
+        --it;
+        if (it->oldEnd < oldOffset || (it->oldEnd == oldOffset && what == Remapped::bytes)) return droppedPieceOffset;
+        return it->newStart + (oldOffset - it->oldStart);
+    };
+
+    std::mutex materializationMutex;
+    parallel_for_each_indexed(liveRanges, [&](std::vector<LiveRange>& ranges, size_t outSecID) {
+        if (!isCollected[outSecID]) return;
+        auto& offsets = referencedOffsets[outSecID];
+        std::sort(offsets.begin(), offsets.end());
+        auto isReferenced = [&](PartCopy const& piece) {
+            auto it = std::lower_bound(offsets.begin(), offsets.end(), piece.dstOffset);
+            return it != offsets.end() && *it < piece.dstOffset + piece.size;
+        };
+
+        // Plain inputs stay completely, pieces only if they are referenced. Equal pieces share their range
+        for (auto& secRef : outputToInputSections[outSecID]) {
+            auto visitor = overloaded{
+                [&](std::vector<PartCopy> const& pieces) {
+                    for (auto& piece : pieces) {
+                        if (isReferenced(piece)) ranges.push_back({piece.dstOffset, piece.dstOffset + piece.size, 0});
+                    }
+                },
+                [&](PartCopy const& cmd) { ranges.push_back({cmd.dstOffset, cmd.dstOffset + cmd.size, 0}); },
+                [](std::monostate) {}};
+            std::visit(visitor, copyCmdsOf(secRef));
+        }
+        std::sort(ranges.begin(), ranges.end(), [](LiveRange const& a, LiveRange const& b) { return a.oldStart < b.oldStart; });
+
+        // Join overlapping ranges (tails and duplicates) and move them down while keeping the offsets congruent to the alignment
+        auto alignment = std::max(alignments[outSecID], Elf64_Xword{1});
+        size_t newSize{0};
+        size_t numJoined{0};
+        for (auto& range : ranges) {
+            if (numJoined && range.oldStart <= ranges[numJoined - 1].oldEnd) {
+                auto& joined = ranges[numJoined - 1];
+                joined.oldEnd = std::max(joined.oldEnd, range.oldEnd);
+            } else {
+                ranges[numJoined++] = range;
+            }
+        }
+        ranges.resize(numJoined);
+        for (auto& range : ranges) {
+            range.newStart = newSize + (range.oldStart - newSize) % alignment;
+            newSize = range.newStart + (range.oldEnd - range.oldStart);
+        }
+
+        if (auto oldView = materializedViews[outSecID]) {
+            std::byte* newView;
+            {
+                std::unique_lock lock{materializationMutex};
+                newView = static_cast<std::byte*>(materializedSectionMemory.allocate(newSize));
+            }
+            std::memset(newView, 0, newSize);
+            for (auto& range : ranges)
+                std::memcpy(newView + range.newStart, oldView + range.oldStart, range.oldEnd - range.oldStart);
+            materializedViews[outSecID] = newView;
+        }
+        outputSectionSizes[outSecID] = newSize;
+
+        for (auto& secRef : outputToInputSections[outSecID]) {
+            auto visitor = overloaded{
+                // Duplicates and tails whose bytes survive in another piece map to those, only pieces outside of every live range are dropped
+                [&](std::vector<PartCopy>& pieces) {
+                    for (auto& piece : pieces)
+                        piece.dstOffset = remap(outSecID, piece.dstOffset, Remapped::bytes);
+                },
+                [&](PartCopy& cmd) { cmd.dstOffset = remap(outSecID, cmd.dstOffset, cmd.size ? Remapped::bytes : Remapped::symbol); },
+                [](std::monostate) {}};
+            std::visit(visitor, copyCmdsOf(secRef));
+        }
+
+        // Relocations inside of dropped pieces go as well
+        auto& relas = processedRelas[outSecID];
+        for (auto& rela : relas)
+            rela.outputSectionOffset = remap(outSecID, rela.outputSectionOffset, Remapped::bytes);
+        std::erase_if(relas, [](ProcessedRela const& rela) { return rela.outputSectionOffset == droppedPieceOffset; });
+    });
+
+    for (auto& relas : processedRelas) {
+        for (auto& rela : relas) {
+            if (refersToPiece(rela)) rela.symbolValue = remap(rela.symbolSectionID, rela.symbolValue, Remapped::symbol);
+        }
+    }
+    return StatusCode::ok;
+}
+namespace /*internal*/ {
+
+// A CIE or FDE of .eh_frame, the offsets are relative to its input section
+struct FrameRecord {
+    size_t offset;
+    size_t size;
+    // Where the CIE id of a CIE or the CIE pointer of an FDE is. The start address of an FDE follows it
+    size_t ciePointerOffset{0};
+    bool isDescription{false};
+    bool isLive{true};
+    size_t newOffset{droppedPieceOffset};
+};
+
+auto readFrameWord(readonly_span<std::byte> data, size_t offset) -> uint32_t {
+    uint32_t word;
+    std::memcpy(&word, data.data() + offset, sizeof(word));
+    return word;
+}
+
+// The records follow each other, each starts with its length. A zero length terminates the section
+auto splitFrameRecords(readonly_span<std::byte> data, std::vector<FrameRecord>& records) -> StatusCode {
+    constexpr uint32_t extendedLength{0xffffffff};
+    for (size_t offset{0}; offset < data.size();) {
+        if (data.size() - offset < sizeof(uint32_t)) {
+            // Padding at the end
+            records.push_back({.offset = offset, .size = data.size() - offset});
+            break;
+        }
+        uint64_t length = readFrameWord(data, offset);
+        size_t lengthSize{sizeof(uint32_t)};
+        if (length == extendedLength) {
+            if (data.size() - offset < sizeof(uint32_t) + sizeof(uint64_t)) return report(StatusCode::bad_input_file, "truncated record in .eh_frame");
+            std::memcpy(&length, data.data() + offset + sizeof(uint32_t), sizeof(length));
+            lengthSize += sizeof(uint64_t);
+        }
+        if (length > data.size() - offset - lengthSize) return report(StatusCode::bad_input_file, "record of .eh_frame is larger than the section");
+
+        FrameRecord record{.offset = offset, .size = lengthSize + length};
+        if (length >= sizeof(uint32_t)) {
+            record.ciePointerOffset = offset + lengthSize;
+            record.isDescription = readFrameWord(data, record.ciePointerOffset) != 0;
+        }
+        records.push_back(record);
+        offset += record.size;
+    }
+    return StatusCode::ok;
+}
+
+} // namespace
+
+auto removeDeadFrameDescriptions(parametersFor::RemoveDeadFrameDescriptions p) -> StatusCode {
+    auto& [elfAddresses, sectionHeaders, outSectionNames, outputToInputSections, symbolTable, sectionStates] = p.in;
+    auto& [inputSectionCopyCommands, outputSectionSizes, materializedViews] = p.inout;
+    auto& [materializedSectionMemory, numRemovedDescriptions] = p.out;
+    numRemovedDescriptions = 0;
+
+    auto recordAt = [](std::vector<FrameRecord>& records, size_t offset) -> FrameRecord* {
+        auto it = std::upper_bound(records.begin(), records.end(), offset, [](size_t at, FrameRecord const& record) { return at < record.offset; });
+        if (it == records.begin()) return nullptr;
+        --it;
+        return offset < it->offset + it->size ? &*it : nullptr;
+    };
+
+    for (size_t outSecID{0}; outSecID < outSectionNames.size(); ++outSecID) {
+        if (outSectionNames[outSecID] != ".eh_frame" || materializedViews[outSecID]) continue;
+        auto& inputs = outputToInputSections[outSecID];
+
+        // An FDE is dead if the section its start address points to is not live
+        Vector2D<FrameRecord> recordsOfInputs(inputs.size());
+        size_t numDead{0};
+        for (size_t inputIndex{0}; inputIndex < inputs.size(); ++inputIndex) {
+            auto [elfID, headerID] = inputs[inputIndex];
+            auto& headers = sectionHeaders[elfID];
+            auto& header = headers[headerID];
+            if (header.sh_type == SHT_NOBITS) continue;
+            auto& records = recordsOfInputs[inputIndex];
+            if (auto splitStatus = splitFrameRecords({elfAddresses[elfID] + header.sh_offset, header.sh_size}, records); splitStatus != StatusCode::ok)
+                return splitStatus;
+
+            auto relaHeader = std::find_if(headers.begin(), headers.end(), [&](Elf64_Shdr const& candidate) {
+                return candidate.sh_type == SHT_RELA && candidate.sh_info == headerID;
+            });
+            if (relaHeader == headers.end()) continue;
+            if (relaHeader->sh_entsize != sizeof(Elf64_Rela) || relaHeader->sh_link >= headers.size())
+                return report(StatusCode::bad_input_file, "unusual relocations of .eh_frame in object file #", elfID);
+            auto address = elfAddresses[elfID];
+            auto relas = view_as_span<Elf64_Rela>(address + relaHeader->sh_offset, relaHeader->sh_size / sizeof(Elf64_Rela));
+            auto& symTabHeader = headers[relaHeader->sh_link];
+            auto symbols = view_as_span<Elf64_Sym>(address + symTabHeader.sh_offset, symTabHeader.sh_size / sizeof(Elf64_Sym));
+            auto symStrings = estd::start_lifetime_as_array<char>(address + headers[symTabHeader.sh_link].sh_offset, headers[symTabHeader.sh_link].sh_size);
+
+            for (auto& rela : relas) {
+                auto record = recordAt(records, rela.r_offset);
+                if (!record || !record->isDescription || !record->isLive || rela.r_offset != record->ciePointerOffset + sizeof(uint32_t)) continue;
+                if (ELF64_R_SYM(rela.r_info) >= symbols.size())
+                    return report(StatusCode::bad_input_file, "relocation refers to symbol ", ELF64_R_SYM(rela.r_info), " which does not exist");
+
+                auto& sym = symbols[ELF64_R_SYM(rela.r_info)];
+                SectionRef target{elfID, sym.st_shndx};
+                if (ELF64_ST_BIND(sym.st_info) != STB_LOCAL) {
+                    auto it = symbolTable.find(std::string_view{symStrings + sym.st_name});
+                    if (it == symbolTable.end() || !it->second.firstLoad.symbol) continue;
+                    target = {it->second.firstLoad.elfID, it->second.firstLoad.symbol->st_shndx};
+                }
+                if (target.headerIndex == SHN_UNDEF || target.headerIndex >= sectionStates[target.elfIndex].size()) continue;
+                if (sectionStates[target.elfIndex][target.headerIndex] == InputSectionState::live) continue;
+                record->isLive = false;
+                ++numDead;
+            }
+        }
+        if (numDead == 0) continue;
+
+        // The live records move together, every input keeps its alignment
+        size_t newSize{0};
+        for (size_t inputIndex{0}; inputIndex < inputs.size(); ++inputIndex) {
+            auto& header = sectionHeaders[inputs[inputIndex].elfIndex][inputs[inputIndex].headerIndex];
+            newSize = alignup(newSize, std::max(header.sh_addralign, Elf64_Xword{1}));
+            auto& pieces = inputSectionCopyCommands[inputs[inputIndex].elfIndex][inputs[inputIndex].headerIndex] = std::vector<PartCopy>{};
+            for (auto& record : recordsOfInputs[inputIndex]) {
+                if (record.isLive) {
+                    record.newOffset = newSize;
+                    newSize += record.size;
+                }
+                std::get<std::vector<PartCopy>>(pieces).push_back({.size = record.size, .dstOffset = record.newOffset});
+            }
+        }
+
+        // The CIE pointer of an FDE is the distance back to its CIE, which changes if something between them was dropped
+        auto view = static_cast<std::byte*>(materializedSectionMemory.allocate(std::max(newSize, size_t{1})));
+        std::memset(view, 0, newSize);
+        for (size_t inputIndex{0}; inputIndex < inputs.size(); ++inputIndex) {
+            auto& header = sectionHeaders[inputs[inputIndex].elfIndex][inputs[inputIndex].headerIndex];
+            readonly_span<std::byte> data{elfAddresses[inputs[inputIndex].elfIndex] + header.sh_offset, header.sh_size};
+            auto& records = recordsOfInputs[inputIndex];
+            for (auto& record : records) {
+                if (!record.isLive) continue;
+                std::memcpy(view + record.newOffset, data.data() + record.offset, record.size);
+                if (!record.isDescription) continue;
+
+                auto cieOffset = record.ciePointerOffset - readFrameWord(data, record.ciePointerOffset);
+                auto cie = recordAt(records, cieOffset);
+                if (!cie || cie->offset != cieOffset || cie->isDescription)
+                    return report(StatusCode::bad_input_file, "FDE in .eh_frame of object file #", inputs[inputIndex].elfIndex, " has no CIE");
+                auto newCiePointerOffset = record.newOffset + (record.ciePointerOffset - record.offset);
+                auto newCiePointer = static_cast<uint32_t>(newCiePointerOffset - cie->newOffset);
+                std::memcpy(view + newCiePointerOffset, &newCiePointer, sizeof(newCiePointer));
+            }
+        }
+        outputSectionSizes[outSecID] = newSize;
+        materializedViews[outSecID] = view;
+        numRemovedDescriptions += numDead;
+    }
+    return StatusCode::ok;
+}
+
 auto constructLoadedSectionLayout(parametersFor::ConstructLoadedSectionLayout p) -> StatusCode {
-    auto& [segmentedSections, outputSectionSizes, outputSectionAlignments, outputSectionTypes] = p.in;
+    auto& [segmentedSections, outputSectionSizes, outputSectionAlignments, outputSectionTypes, maxPageSize, hugePageText, packSegments] = p.in;
     auto& [programHeaders, outputSectionAddresses, outputSectionFileOffsets] = p.out;
 
     outputSectionAddresses.resize(outputSectionSizes.size(), meta::notAnOutputSection);
@@ -724,6 +1795,7 @@ auto constructLoadedSectionLayout(parametersFor::ConstructLoadedSectionLayout p)
     static_assert((sizeof(Elf64_Ehdr) % alignof(Elf64_Phdr)) == 0);
     const size_t fileHeadersSize{sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr) * programHeaders.size()};
 
+    StatusCode status{StatusCode::ok};
     size_t fileStartPos{fileHeadersSize};
     size_t segmentStartAddress{fileHeadersSize + meta::virtualAddressStart};
     size_t ptHdrIndex{0};
@@ -731,29 +1803,51 @@ auto constructLoadedSectionLayout(parametersFor::ConstructLoadedSectionLayout p)
         if (sections.empty() || segmentIndex == meta::SegmentLocation::notLoaded)
             return;
 
+        auto isHugePageSegment = hugePageText && segmentIndex == meta::SegmentLocation::readExecute;
+        auto segmentAlignment = std::max(maxPageSize, isHugePageSegment ? meta::hugePageSize : size_t{0});
+        for (auto outsecID : sections)
+            segmentAlignment = std::max(segmentAlignment, outputSectionAlignments[outsecID]);
+
+        if (ptHdrIndex == 0) {
+            // The first segment starts with the headers at the base address, which has to be aligned already
+            if (meta::virtualAddressStart % segmentAlignment != 0) {
+                status = report(StatusCode::not_ok, "segment alignment ", segmentAlignment, " is larger than the base address allows");
+                return;
+            }
+        } else if (packSegments && !isHugePageSegment) {
+            // The address moves to the next page, the file offset stays and the two remain congruent modulo the alignment
+            segmentStartAddress = alignup(segmentStartAddress, segmentAlignment) + (fileStartPos & (segmentAlignment - 1));
+        } else {
+            // The file offset has to be congruent to the address modulo the alignment
+            segmentStartAddress = alignup(segmentStartAddress, segmentAlignment);
+            fileStartPos += (segmentStartAddress - fileStartPos) & (segmentAlignment - 1);
+        }
+
         auto filePos = fileStartPos;
         auto addressPos = segmentStartAddress;
 
         for (auto outsecID : sections) {
             auto sectionAlignment = outputSectionAlignments[outsecID];
             auto sectionSize = outputSectionSizes[outsecID];
-            filePos = alignup(filePos, sectionAlignment);
             addressPos = alignup(addressPos, sectionAlignment);
-
             outputSectionAddresses[outsecID] = addressPos;
-            outputSectionFileOffsets[outsecID] = filePos;
-
-            if (outputSectionTypes[outsecID] == SHT_NOBITS) continue;
+            // Only memory is reserved for NOBITS, it has to be in p_memsz so the kernel zeroes it instead of mapping the file
+            addressPos += sectionSize;
+            if (outputSectionTypes[outsecID] == SHT_NOBITS) {
+                outputSectionFileOffsets[outsecID] = filePos;
+                continue;
+            }
 
+            filePos = alignup(filePos, sectionAlignment);
+            outputSectionFileOffsets[outsecID] = filePos;
             filePos += sectionSize;
-            addressPos += sectionSize;
         }
 
         auto segmentFileSize = filePos - fileStartPos;
         auto memSize = addressPos - segmentStartAddress;
 
         auto& ptHdr = programHeaders[ptHdrIndex];
-        ptHdr.p_align = meta::pageSize;
+        ptHdr.p_align = segmentAlignment;
         ptHdr.p_offset = fileStartPos;
         ptHdr.p_memsz = memSize;
         ptHdr.p_filesz = segmentFileSize;
@@ -769,15 +1863,21 @@ auto constructLoadedSectionLayout(parametersFor::ConstructLoadedSectionLayout p)
         }
         ++ptHdrIndex;
 
-        fileStartPos = alignup(fileStartPos + segmentFileSize, meta::pageSize);
-        segmentStartAddress = alignup(segmentStartAddress + memSize, meta::pageSize);
+        // Nothing else may share the last page, with huge pages that is a huge page
+        fileStartPos += segmentFileSize;
+        segmentStartAddress += memSize;
+        if (!packSegments || isHugePageSegment) {
+            auto endAlignment = isHugePageSegment ? meta::hugePageSize : maxPageSize;
+            fileStartPos = alignup(fileStartPos, endAlignment);
+            segmentStartAddress = alignup(segmentStartAddress, endAlignment);
+        }
     });
 
-    return StatusCode::ok;
+    return status;
 }
 
 auto synthesizeSyntheticSections(parametersFor::SynthesizeSyntheticSections p) -> StatusCode {
-    auto& [gotID, symTabID, strTabID, shstrTabID, gotEntryPatches, outputSectionAddresses, inputToOutputSection, inputSectionCopyCommands, flags, names, symbolTable, elfAddresses, sectionHeaders, enoughStringTableMemory, enoughSymbolTableMemory] = p.in;
+    auto& [gotID, symTabID, strTabID, shstrTabID, gotEntryPatches, outputSectionAddresses, inputToOutputSection, inputSectionCopyCommands, flags, names, symbolTable, elfAddresses, sortKeys, sectionHeaders, sortGlobalSymbols, enoughStringTableMemory, enoughSymbolTableMemory] = p.in;
     auto& [materializedViews, outputSectionSizes] = p.inout;
 
     auto& [numLocalSymbols, sh_names] = p.out;
@@ -833,7 +1933,7 @@ auto synthesizeSyntheticSections(parametersFor::SynthesizeSyntheticSections p) -
 
         auto outSectionID = inputToOutputSection[elfID][sym.st_shndx];
 
-        if (!(flags[outSectionID] & SHF_ALLOC))
+        if (outSectionID == meta::notAnOutputSection || !(flags[outSectionID] & SHF_ALLOC))
             return;
 
         auto inputAddress = outputSectionAddresses[outSectionID];
@@ -863,10 +1963,21 @@ auto synthesizeSyntheticSections(parametersFor::SynthesizeSyntheticSections p) -
 
     numLocalSymbols = static_cast<Elf64_Word>(symbolTableSize / sizeof(Elf64_Sym));
 
+    std::vector<std::pair<std::string_view, SymbolRef>> globalSymbols;
+    globalSymbols.reserve(symbolTable.size());
     for (auto& [symName, entry] : symbolTable) {
-        if (!entry.firstLoad.symbol) continue;
-        pushSymbol(*entry.firstLoad.symbol, symName, entry.firstLoad.elfID);
+        if (entry.firstLoad.symbol) globalSymbols.emplace_back(symName, entry.firstLoad);
+    }
+    if (sortGlobalSymbols) {
+        auto resolvedBefore = [&](SymbolRef const& a, SymbolRef const& b) {
+            // Symbols of the same file are in one array, so their addresses follow the symbol index
+            if (a.elfID == b.elfID) return a.symbol < b.symbol;
+            return sortKeys[a.elfID] != sortKeys[b.elfID] ? sortKeys[a.elfID] < sortKeys[b.elfID] : a.elfID < b.elfID;
+        };
+        std::sort(globalSymbols.begin(), globalSymbols.end(), [&](auto const& a, auto const& b) { return resolvedBefore(a.second, b.second); });
     }
+    for (auto& [symName, symRef] : globalSymbols)
+        pushSymbol(*symRef.symbol, symName, symRef.elfID);
 
     outputSectionSizes[symTabID] = symbolTableSize;
     outputSectionSizes[strTabID] = stringTableSize;
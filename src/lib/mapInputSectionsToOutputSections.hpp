@@ -1,5 +1,11 @@
 #pragma once
+#include "cppld.hpp"
 #include "cppld_internal_types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+
 namespace cppld {
 
 namespace parametersFor {
@@ -9,9 +15,13 @@ struct InitOutputSections;
 struct MergeAndSortInputSections;
 struct SortOutputSections;
 struct PreProcessesRelocations;
+struct RemoveUnreferencedMergedPieces;
+struct RemoveDeadFrameDescriptions;
 struct ConstructLoadedSectionLayout;
 struct SynthesizeSyntheticSections;
 struct BuildElfAndSectionHeaders;
+// Helper
+struct InputToOutputSectionOffset;
 
 } // namespace parametersFor
 
@@ -29,7 +39,11 @@ struct parametersFor::MapInputSectionsToOutputSections {
         readonly_span<const char*> sectionStringTables;
         in<SymbolTable> symbolTable;
         in<GlobalSymbolTableEntry> entrySymbolInfo;
+        in<LinkerOptions> options;
     } in;
+    struct {
+        inout<Vector2D<InputSectionState>> sectionStates;
+    } inout;
     struct {
         out<std::pmr::memory_resource> materializedSectionMemory;
         out<std::vector<Elf64_Shdr>> outputSectionHeaders;
@@ -94,18 +108,26 @@ constexpr size_t numReservedGotEntries{3};
 constexpr size_t virtualAddressStart{0x400000};
 // Default page size on Linux
 constexpr size_t pageSize{0x1000};
+// Transparent huge pages on x86_64
+constexpr size_t hugePageSize{0x200000};
 
 } // namespace meta
 
 /**
  * @brief Sort everything and determine, names, types and alignments (e.g. Chaotic Evil, Lawful Good, etc)
- * Also saves the input to output mapping and vice versa
+ * Also saves the input to output mapping and vice versa. Sections that are not live don't get an output section
+ * Output sections are numbered in order of first appearance, with sortByName by name
+ * With keepSectionNames (for -r), sections keep their input names and every member of a group gets an output section of its own,
+ * so the groups can be written to the output again. Members keep SHF_GROUP then
  */
 auto initOutputSections(parametersFor::InitOutputSections) -> StatusCode;
 struct parametersFor::InitOutputSections {
     struct {
         readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
         readonly_span<char const*> sectionStringTables;
+        in<Vector2D<InputSectionState>> sectionStates;
+        bool sortByName;
+        bool keepSectionNames;
     } in;
     struct {
         out<std::vector<std::string_view>> names;
@@ -121,9 +143,13 @@ struct parametersFor::InitOutputSections {
 
 /**
  * @brief Determines how to input section will appear inside an output section
- * This modifies the order of the output to input section mapping
- * Deduplicates elements if SHF_MERGE is set
+ * This modifies the order of the output to input section mapping, sections with a priority (see orderInputSections.hpp) come first
+ * Within .text, .text.hot.* sections are placed first and .text.startup.*, .text.exit.* and .text.unlikely.* last. Explicit priorities order the sections within each group
+ * With sortByAlignment, the inputs of data sections without explicit priorities are placed by descending alignment, if that needs less padding
+ * Deduplicates elements if SHF_MERGE is set, with tailMergeStrings strings that end another string are stored inside it
  * After merging the final size is known (since it includes padding)
+ * With reserveIncrementalSlack, every concatenated input gets a slot of incrementalSlotSize() bytes, so it can grow in a later incremental link.
+ * Inputs that hasIncrementalSlot() rejects get no slack
  */
 auto mergeAndSortInputSections(parametersFor::MergeAndSortInputSections) -> StatusCode;
 struct parametersFor::MergeAndSortInputSections {
@@ -131,7 +157,13 @@ struct parametersFor::MergeAndSortInputSections {
         readonly_span<std::byte*> elfAddresses;
         readonly_span<SortKey> sortKeys;
         readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+        readonly_span<std::string_view> outSectionNames;
         readonly_span<Elf64_Xword> outSectionFlags;
+        in<Vector2D<uint32_t>> sectionPriorities; // Empty if there is no explicit order
+        bool tailMergeStrings;
+        bool sortByAlignment;
+        bool reserveIncrementalSlack;
     } in;
     struct {
         inout<Vector2D<SectionRef>> outputToInputSections;
@@ -141,19 +173,37 @@ struct parametersFor::MergeAndSortInputSections {
         out<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
         out<std::vector<std::byte*>> materializedViews;
         out<std::pmr::memory_resource> materializedSectionMemory;
+        out<size_t> savedAlignmentPadding;
     } out;
 };
 
+// A quarter of the size, but at least enough for a few more instructions
+constexpr auto incrementalSlotSize(size_t sectionSize) -> size_t {
+    return sectionSize + std::max<size_t>(sectionSize / 4, 32);
+}
+
+// Lists of records and arrays are read up to their end, zeros in between would be a terminator of .eh_frame or a null function pointer.
+// Their inputs have to stay within their size in incremental links
+constexpr auto hasIncrementalSlot(Elf64_Shdr const& header, std::string_view name) -> bool {
+    if (header.sh_type == SHT_INIT_ARRAY || header.sh_type == SHT_FINI_ARRAY || header.sh_type == SHT_PREINIT_ARRAY || header.sh_type == SHT_X86_64_UNWIND)
+        return false;
+    constexpr std::array<std::string_view, 6> listNames{".eh_frame", ".init_array", ".fini_array", ".preinit_array", ".ctors", ".dtors"};
+    return std::none_of(listNames.begin(), listNames.end(), [&](std::string_view listName) {
+        return name.starts_with(listName) && (name.size() == listName.size() || name[listName.size()] == '.');
+    });
+}
+
 /**
  * @brief Sorts the output sections into segments by types and flags
- * They are already sorted by name
- * 
+ * Within a segment, the order of the output section ids is kept
+ * Without a separate read only segment, read only sections go in front of the executable ones
  */
 auto sortOutputSections(parametersFor::SortOutputSections) -> StatusCode;
 struct parametersFor::SortOutputSections {
     struct {
         readonly_span<Elf64_Word> types;
         readonly_span<Elf64_Xword> flags;
+        bool separateReadOnlySegment;
     } in;
 
     struct {
@@ -161,6 +211,53 @@ struct parametersFor::SortOutputSections {
     } out;
 };
 
+/**
+ * @brief Where an offset in an input section ends up in its output section, following the copy commands of merged sections
+ * Offsets into dropped pieces of merged sections map to the start of the output section
+ */
+auto inputToOutputSectionOffset(parametersFor::InputToOutputSectionOffset) -> StatusCode;
+struct parametersFor::InputToOutputSectionOffset {
+    struct {
+        in<SectionRef> secRef;
+        in<size_t> offsetInInput;
+        in<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
+    } in;
+    struct {
+        out<size_t> offsetInOutput;
+    } out;
+};
+
+/**
+ * @brief Whether an offset in an input section lies in a piece that was dropped from the output, relocations there are not applied
+ */
+auto isInDroppedPiece(SectionMemCopies const& copyCommands, size_t offsetInInput) -> bool;
+
+/**
+ * @brief Drops the FDEs of .eh_frame that describe a section that is not in the output (e.g. collected by --gc-sections or of a COMDAT group that lost)
+ * The records of every input of .eh_frame become pieces, dropped FDEs get droppedPieceOffset and the others move together.
+ * If anything was dropped, .eh_frame is materialized with the CIE pointers of the moved FDEs fixed up. Relocations are applied on top as usual
+ */
+auto removeDeadFrameDescriptions(parametersFor::RemoveDeadFrameDescriptions) -> StatusCode;
+struct parametersFor::RemoveDeadFrameDescriptions {
+    struct {
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<std::string_view> outSectionNames;
+        in<Vector2D<SectionRef>> outputToInputSections;
+        in<SymbolTable> symbolTable;
+        in<Vector2D<InputSectionState>> sectionStates;
+    } in;
+    struct {
+        inout<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
+        inout<std::vector<size_t>> outputSectionSizes;
+        inout<std::vector<std::byte*>> materializedViews;
+    } inout;
+    struct {
+        out<std::pmr::memory_resource> materializedSectionMemory;
+        out<size_t> numRemovedDescriptions;
+    } out;
+};
+
 /**
  * @brief Do a pass over the relocations to determine where they should go relative to the output section
  * Also determines the entries needed for the Global Offset Table and outputs information to fill it later
@@ -174,6 +271,7 @@ struct parametersFor::PreProcessesRelocations {
         in<SymbolTable> symbolTable;
         in<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
         in<Vector2D<OutSectionID>> inputToOutputSection;
+        in<Vector2D<InputSectionState>> sectionStates;
         size_t numberOfOutputSections;
         OutSectionID gotSectionIndex;
     } in;
@@ -183,10 +281,43 @@ struct parametersFor::PreProcessesRelocations {
     } out;
 };
 
+/**
+ * @brief Drops pieces of merged allocated sections that no relocation, GOT entry or global symbol refers to
+ * Only inputs with SHF_MERGE count as merged, the records of .eh_frame are pieces as well but stay
+ * The remaining content is moved together, every offset keeps its remainder modulo the section alignment.
+ * Copy commands, relocations and materialized views of the affected sections are updated accordingly
+ */
+auto removeUnreferencedMergedPieces(parametersFor::RemoveUnreferencedMergedPieces) -> StatusCode;
+struct parametersFor::RemoveUnreferencedMergedPieces {
+    struct {
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        in<Vector2D<SectionRef>> outputToInputSections;
+        in<Vector2D<OutSectionID>> inputToOutputSection;
+        readonly_span<Elf64_Xword> flags;
+        readonly_span<Elf64_Xword> alignments;
+        in<SymbolTable> symbolTable;
+        in<std::vector<GOTEntryPatchupInfo>> gotEntryPatches;
+        OutSectionID gotSectionIndex;
+    } in;
+    struct {
+        inout<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
+        inout<Vector2D<ProcessedRela>> processedRelas;
+        inout<std::vector<size_t>> outputSectionSizes;
+        inout<std::vector<std::byte*>> materializedViews;
+    } inout;
+    struct {
+        out<std::pmr::memory_resource> materializedSectionMemory;
+    } out;
+};
+
 /**
  * @brief Assigns addresses to sections and generates the program headers accordingly
  * 
  * Note that unloaded sections are not covered here since they require the addresses of the loaded sections to be generated in the first place
+ * Each segment is aligned to the max page size or the largest alignment of its sections, whichever is bigger, and p_align says so.
+ * With hugePageText, the executable segment starts on a huge page boundary and the next segment only starts after the next one
+ * With packSegments, there is no padding in the file between segments (-z noseparate-code). Instead, the address of a segment
+ * skips to the next page and keeps the offset of the file position within the page, so a page of the file may be mapped twice
  */
 auto constructLoadedSectionLayout(parametersFor::ConstructLoadedSectionLayout) -> StatusCode;
 struct parametersFor::ConstructLoadedSectionLayout {
@@ -195,6 +326,9 @@ struct parametersFor::ConstructLoadedSectionLayout {
         readonly_span<size_t> const& outputSectionSizes;
         readonly_span<Elf64_Xword> const& outputSectionAlignments;
         readonly_span<Elf64_Word> const& outputSectionTypes;
+        size_t maxPageSize;
+        bool hugePageText;
+        bool packSegments;
     } in;
     struct {
         out<std::vector<Elf64_Phdr>> programHeaders;
@@ -207,6 +341,7 @@ struct parametersFor::ConstructLoadedSectionLayout {
  * @brief With the exception of the .got, mostly uncessary for program execution,
  * but hey, you asked for it 
  * 
+ * With sortGlobalSymbols, global symbols follow in the order they were resolved (file precedence, then symbol index) instead of the order of the symbol table
  */
 auto synthesizeSyntheticSections(parametersFor::SynthesizeSyntheticSections) -> StatusCode;
 struct parametersFor::SynthesizeSyntheticSections {
@@ -220,7 +355,9 @@ struct parametersFor::SynthesizeSyntheticSections {
         readonly_span<std::string_view> names;
         in<SymbolTable> symbolTable;
         readonly_span<std::byte*> elfAddresses;
+        readonly_span<SortKey> sortKeys;
         readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        bool sortGlobalSymbols;
 
         std::byte* enoughStringTableMemory;
         std::byte* enoughSymbolTableMemory;
@@ -0,0 +1,327 @@
+#include "orderInputSections.hpp"
+#include "convenient_functions.hpp"
+#include "cppld.hpp"
+#include "statusreport.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <numeric>
+#include <unordered_map>
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+// Calls f for every line of a text file that isn't empty, without surrounding whitespace
+// The lines point into the mapping of the file, so it is kept by the caller
+template <typename Function>
+auto forEachLineOfFile(std::string_view filePath, MemoryMappings& mappings, Function f) -> StatusCode {
+    std::array filePaths{filePath};
+    if (auto status = filePathsToMemoryMappings({.in{filePaths}, .out{mappings}}); status != StatusCode::ok) return status;
+
+    std::string_view content{static_cast<const char*>(mappings.addresses.front()), mappings.memSizes.front()};
+    while (!content.empty()) {
+        auto lineEnd = std::min(content.find('\n'), content.size());
+        auto line = content.substr(0, lineEnd);
+        content.remove_prefix(std::min(lineEnd + 1, content.size()));
+
+        constexpr std::string_view whitespace{" \t\r"};
+        line.remove_prefix(std::min(line.find_first_not_of(whitespace), line.size()));
+        line.remove_suffix(line.size() - (line.find_last_not_of(whitespace) + 1));
+        if (line.empty()) continue;
+        if (auto status = f(line); status != StatusCode::ok) return status;
+    }
+    return StatusCode::ok;
+}
+
+// Calls f(symbol, name) for every symbol defined in a section of the file
+template <typename Function>
+auto forEachDefinedSymbol(std::byte* address, readonly_span<Elf64_Shdr> headers, Function f) -> void {
+    for (auto& header : headers) {
+        if (header.sh_type != SHT_SYMTAB || header.sh_entsize != sizeof(Elf64_Sym)) continue;
+        auto symbols = view_as_span<Elf64_Sym>(address + header.sh_offset, header.sh_size / sizeof(Elf64_Sym));
+        auto& strTabHeader = headers[header.sh_link];
+        auto symStrings = estd::start_lifetime_as_array<char>(address + strTabHeader.sh_offset, strTabHeader.sh_size);
+        for (auto& sym : symbols) {
+            if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= headers.size() || ELF64_ST_TYPE(sym.st_info) == STT_SECTION) continue;
+            f(sym, std::string_view{symStrings + sym.st_name});
+        }
+    }
+}
+
+} // namespace
+
+auto orderSectionsBySymbols(parametersFor::OrderSectionsBySymbols p) -> StatusCode {
+    auto& [symbolOrderingFile, elfAddresses, sectionHeaders] = p.in;
+    auto& [sectionPriorities] = p.out;
+
+    MemoryMappings mappings;
+    std::unordered_map<std::string_view, uint32_t> priorities;
+    auto status = forEachLineOfFile(symbolOrderingFile, mappings, [&](std::string_view line) {
+        // The first mention counts
+        priorities.emplace(line, static_cast<uint32_t>(priorities.size()));
+        return StatusCode::ok;
+    });
+    if (status != StatusCode::ok) return report(status, "can't read symbol ordering file");
+
+    sectionPriorities.resize(sectionHeaders.size());
+    parallel_for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        auto& elfPriorities = sectionPriorities[elfID];
+        elfPriorities.assign(headers.size(), noSectionPriority);
+        forEachDefinedSymbol(elfAddresses[elfID], headers, [&](Elf64_Sym const& sym, std::string_view name) {
+            auto it = priorities.find(name);
+            if (it == priorities.end()) return;
+            elfPriorities[sym.st_shndx] = std::min(elfPriorities[sym.st_shndx], it->second);
+        });
+    });
+    return StatusCode::ok;
+}
+
+namespace /*internal*/ {
+
+// Same limits as lld: clusters beyond a megabyte don't fit into any cache anyway, and merging must not make a cluster much colder
+constexpr size_t maxClusterSize{1024 * 1024};
+constexpr double maxDensityDegradation{8};
+// Below this number of files, spawning threads costs more than scanning the relocations
+constexpr size_t minFilesForParallelEdges{16};
+
+struct CallEdge {
+    uint32_t from;
+    uint32_t to;
+    uint64_t weight;
+};
+
+// Sorts the edges and sums up the weights of duplicates
+auto compressEdges(std::vector<CallEdge>& edges) -> void {
+    std::sort(edges.begin(), edges.end(), [](CallEdge const& a, CallEdge const& b) {
+        return std::tie(a.from, a.to) < std::tie(b.from, b.to);
+    });
+    size_t numUnique{0};
+    for (auto& edge : edges) {
+        if (numUnique && edges[numUnique - 1].from == edge.from && edges[numUnique - 1].to == edge.to) {
+            edges[numUnique - 1].weight += edge.weight;
+        } else {
+            edges[numUnique++] = edge;
+        }
+    }
+    edges.resize(numUnique);
+}
+
+} // namespace
+
+auto orderSectionsByCallGraph(parametersFor::OrderSectionsByCallGraph p) -> StatusCode {
+    auto& [callGraphProfileFile, elfAddresses, sectionHeaders, symbolTable, sectionStates] = p.in;
+    auto& [sectionPriorities, numEdges, numClusters] = p.out;
+
+    constexpr uint32_t notANode{std::numeric_limits<uint32_t>::max()};
+    auto isNode = [&](Elf64_Shdr const& header, size_t elfID, size_t headerID) {
+        return sectionStates[elfID][headerID] == InputSectionState::live && header.sh_type == SHT_PROGBITS &&
+               (header.sh_flags & SHF_ALLOC) && (header.sh_flags & SHF_EXECINSTR) && header.sh_size > 0;
+    };
+
+    // Nodes are numbered in file and header order, which breaks all ties later
+    std::vector<SectionRef> nodes;
+    Vector2D<uint32_t> nodeOf(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        nodeOf[elfID].resize(headers.size(), notANode);
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (!isNode(header, elfID, headerID)) return;
+            nodeOf[elfID][headerID] = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({.elfIndex = elfID, .headerIndex = headerID});
+        });
+    });
+    auto nodeOfSection = [&](size_t elfID, size_t headerID) {
+        return headerID < nodeOf[elfID].size() ? nodeOf[elfID][headerID] : notANode;
+    };
+
+    std::vector<CallEdge> edges;
+    StatusCode status{StatusCode::ok};
+    if (callGraphProfileFile.empty()) {
+        Vector2D<CallEdge> edgesPerElf(sectionHeaders.size());
+        auto collectEdges = [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+            auto address = elfAddresses[elfID];
+            auto& elfEdges = edgesPerElf[elfID];
+            for (auto& relaHeader : headers) {
+                if (relaHeader.sh_type != SHT_RELA || relaHeader.sh_entsize != sizeof(Elf64_Rela)) continue;
+                auto from = nodeOfSection(elfID, relaHeader.sh_info);
+                if (from == notANode) continue;
+
+                auto relas = view_as_span<Elf64_Rela>(address + relaHeader.sh_offset, relaHeader.sh_size / sizeof(Elf64_Rela));
+                auto& symTabHeader = headers[relaHeader.sh_link];
+                auto symbols = view_as_span<Elf64_Sym>(address + symTabHeader.sh_offset, symTabHeader.sh_size / sizeof(Elf64_Sym));
+                auto& symStrTabHeader = headers[symTabHeader.sh_link];
+                auto symStrings = estd::start_lifetime_as_array<char>(address + symStrTabHeader.sh_offset, symStrTabHeader.sh_size);
+                for (auto& rela : relas) {
+                    auto type = ELF64_R_TYPE(rela.r_info);
+                    if (type != R_X86_64_PLT32 && type != R_X86_64_PC32) continue;
+                    auto& sym = symbols[ELF64_R_SYM(rela.r_info)];
+                    auto to = notANode;
+                    if (ELF64_ST_BIND(sym.st_info) == STB_LOCAL) {
+                        to = nodeOfSection(elfID, sym.st_shndx);
+                    } else if (auto it = symbolTable.find(std::string_view{symStrings + sym.st_name});
+                               it != symbolTable.end() && it->second.firstLoad.symbol) {
+                        to = nodeOfSection(it->second.firstLoad.elfID, it->second.firstLoad.symbol->st_shndx);
+                    }
+                    if (to != notANode) elfEdges.push_back({.from = from, .to = to, .weight = 1});
+                }
+            }
+            compressEdges(elfEdges);
+        };
+        if (sectionHeaders.size() >= minFilesForParallelEdges) {
+            parallel_for_each_indexed(sectionHeaders, collectEdges);
+        } else {
+            for_each_indexed(sectionHeaders, collectEdges);
+        }
+        for (auto& elfEdges : edgesPerElf)
+            edges.insert(edges.end(), elfEdges.begin(), elfEdges.end());
+    } else {
+        // Global symbols resolve through the symbol table, local ones to the first file defining them
+        std::vector<std::array<std::string_view, 2>> profileCalls;
+        std::vector<uint64_t> profileWeights;
+        std::unordered_map<std::string_view, uint32_t> profileNames;
+        MemoryMappings mappings;
+        status = forEachLineOfFile(callGraphProfileFile, mappings, [&](std::string_view line) {
+            std::array<std::string_view, 3> fields;
+            for (auto& field : fields) {
+                auto end = std::min(line.find_first_of(" \t"), line.size());
+                field = line.substr(0, end);
+                line.remove_prefix(std::min(line.find_first_not_of(" \t", end), line.size()));
+            }
+            uint64_t weight{0};
+            auto [end, error] = std::from_chars(fields[2].data(), fields[2].data() + fields[2].size(), weight);
+            if (fields[1].empty() || error != std::errc{} || end != fields[2].data() + fields[2].size() || !line.empty())
+                return report(StatusCode::not_ok, "call graph profile lines need to be \"caller callee count\"");
+            profileCalls.push_back({fields[0], fields[1]});
+            profileWeights.push_back(weight);
+            profileNames.emplace(fields[0], static_cast<uint32_t>(profileNames.size()));
+            profileNames.emplace(fields[1], static_cast<uint32_t>(profileNames.size()));
+            return StatusCode::ok;
+        });
+        if (status != StatusCode::ok) return report(status, "can't read call graph profile");
+
+        std::vector<uint64_t> localDefinitions(profileNames.size(), std::numeric_limits<uint64_t>::max());
+        parallel_for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+            forEachDefinedSymbol(elfAddresses[elfID], headers, [&](Elf64_Sym const& sym, std::string_view name) {
+                if (ELF64_ST_BIND(sym.st_info) != STB_LOCAL) return;
+                auto it = profileNames.find(name);
+                if (it == profileNames.end()) return;
+                std::atomic_ref definition{localDefinitions[it->second]};
+                auto packed = (uint64_t{elfID} << 32u) | sym.st_shndx;
+                auto current = definition.load();
+                while (packed < current && !definition.compare_exchange_weak(current, packed)) {}
+            });
+        });
+        auto nodeOfName = [&](std::string_view name) {
+            if (auto it = symbolTable.find(name); it != symbolTable.end() && it->second.firstLoad.symbol)
+                return nodeOfSection(it->second.firstLoad.elfID, it->second.firstLoad.symbol->st_shndx);
+            auto local = localDefinitions[profileNames.at(name)];
+            if (local == std::numeric_limits<uint64_t>::max()) return notANode;
+            return nodeOfSection(local >> 32u, local & std::numeric_limits<uint32_t>::max());
+        };
+        for_each_indexed(profileCalls, [&](std::array<std::string_view, 2> const& call, size_t i) {
+            auto from = nodeOfName(call[0]);
+            auto to = nodeOfName(call[1]);
+            if (from != notANode && to != notANode) edges.push_back({.from = from, .to = to, .weight = profileWeights[i]});
+        });
+    }
+    compressEdges(edges);
+    numEdges = edges.size();
+
+    struct Cluster {
+        uint32_t next; // The nodes of a cluster form a ring, the leader is the first one
+        uint32_t prev;
+        size_t size;
+        uint64_t weight;
+        uint64_t initialWeight;
+        uint32_t bestPred;
+        uint64_t bestPredWeight;
+    };
+    std::vector<Cluster> clusters(nodes.size());
+    for_each_indexed(clusters, [&](Cluster& cluster, size_t node) {
+        auto& secRef = nodes[node];
+        cluster = {.next = static_cast<uint32_t>(node), .prev = static_cast<uint32_t>(node),
+                   .size = sectionHeaders[secRef.elfIndex][secRef.headerIndex].sh_size,
+                   .weight = 0, .initialWeight = 0, .bestPred = notANode, .bestPredWeight = 0};
+    });
+    for (auto& edge : edges) {
+        auto& callee = clusters[edge.to];
+        callee.weight += edge.weight;
+        if (edge.from == edge.to) continue;
+        // Edges are sorted by caller, so the first of equally heavy callers wins
+        if (callee.bestPred == notANode || callee.bestPredWeight < edge.weight) {
+            callee.bestPred = edge.from;
+            callee.bestPredWeight = edge.weight;
+        }
+    }
+    for (auto& cluster : clusters)
+        cluster.initialWeight = cluster.weight;
+
+    auto densityOf = [](uint64_t weight, size_t size) { return static_cast<double>(weight) / static_cast<double>(size); };
+    auto byDensity = [&](uint32_t a, uint32_t b) {
+        return densityOf(clusters[a].weight, clusters[a].size) > densityOf(clusters[b].weight, clusters[b].size);
+    };
+
+    std::vector<uint32_t> leaders(nodes.size());
+    std::iota(leaders.begin(), leaders.end(), uint32_t{0});
+    auto leaderOf = [&](uint32_t node) {
+        while (leaders[node] != node) {
+            leaders[node] = leaders[leaders[node]];
+            node = leaders[node];
+        }
+        return node;
+    };
+
+    std::vector<uint32_t> sorted(nodes.size());
+    std::iota(sorted.begin(), sorted.end(), uint32_t{0});
+    std::stable_sort(sorted.begin(), sorted.end(), byDensity);
+    for (auto node : sorted) {
+        auto& cluster = clusters[node];
+        // Callers that only make up a small part of the calls don't justify the merge
+        constexpr uint64_t minBestPredShare{10};
+        if (cluster.bestPred == notANode || cluster.bestPredWeight * minBestPredShare <= cluster.initialWeight) continue;
+        auto predLeader = leaderOf(cluster.bestPred);
+        if (predLeader == node) continue;
+        auto& predCluster = clusters[predLeader];
+        if (cluster.size + predCluster.size > maxClusterSize) continue;
+        // Merging must not make the caller cluster much colder
+        if (densityOf(predCluster.weight + cluster.weight, predCluster.size + cluster.size) <
+            densityOf(predCluster.weight, predCluster.size) / maxDensityDegradation) continue;
+
+        // Append the ring of node to the ring of the caller
+        leaders[node] = predLeader;
+        auto tail = predCluster.prev;
+        auto nodeTail = cluster.prev;
+        clusters[tail].next = node;
+        cluster.prev = tail;
+        clusters[nodeTail].next = predLeader;
+        predCluster.prev = nodeTail;
+        predCluster.size += cluster.size;
+        predCluster.weight += cluster.weight;
+        cluster.size = 0;
+        cluster.weight = 0;
+    }
+
+    sorted.clear();
+    for_each_indexed(clusters, [&](Cluster const& cluster, size_t node) {
+        if (cluster.size > 0) sorted.push_back(static_cast<uint32_t>(node));
+    });
+    std::stable_sort(sorted.begin(), sorted.end(), byDensity);
+    numClusters = sorted.size();
+
+    sectionPriorities.resize(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        sectionPriorities[elfID].assign(headers.size(), noSectionPriority);
+    });
+    uint32_t priority{0};
+    for (auto leader : sorted) {
+        auto node = leader;
+        do {
+            sectionPriorities[nodes[node].elfIndex][nodes[node].headerIndex] = priority++;
+            node = clusters[node].next;
+        } while (node != leader);
+    }
+    return StatusCode::ok;
+}
+
+} // namespace cppld
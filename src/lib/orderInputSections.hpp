@@ -0,0 +1,59 @@
+#pragma once
+#include "cppld_internal_types.hpp"
+
+namespace cppld {
+
+namespace parametersFor {
+struct OrderSectionsBySymbols;
+struct OrderSectionsByCallGraph;
+} // namespace parametersFor
+
+// Sections without a priority keep their order by file precedence and header index, after all prioritized sections
+constexpr uint32_t noSectionPriority{std::numeric_limits<uint32_t>::max()};
+
+/**
+ * @brief Gives every input section that defines a symbol of the symbol ordering file the position of the first such symbol as priority
+ *
+ * The position counts distinct names in the order of their first mention, so empty lines and repeated names don't leave gaps.
+ * mergeAndSortInputSections places sections with lower priorities first within their output section.
+ * Local and global symbols are both considered, the symbol tables of the input files are scanned in parallel.
+ * Empty lines and surrounding whitespace are ignored, names that are not found are skipped
+ */
+auto orderSectionsBySymbols(parametersFor::OrderSectionsBySymbols) -> StatusCode;
+struct parametersFor::OrderSectionsBySymbols {
+    struct {
+        std::string_view symbolOrderingFile;
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+    } in;
+    struct {
+        out<Vector2D<uint32_t>> sectionPriorities;
+    } out;
+};
+
+/**
+ * @brief Computes a layout of the executable sections with C3 clustering (Ottoni and Maher, "Optimizing function placement for large-scale data-center applications")
+ *
+ * The call graph is built from R_X86_64_PLT32 and R_X86_64_PC32 relocations between executable sections, weighted by the number of relocations.
+ * If a profile is given, its "caller callee count" lines replace those weights.
+ * Every section is appended to the cluster of its heaviest caller, unless the cluster gets too big or too sparse.
+ * Clusters are then ordered by density (weight per byte), the position in that order becomes the priority.
+ * Edges are collected per file in parallel, ties are broken by file and header index, so the layout is deterministic
+ */
+auto orderSectionsByCallGraph(parametersFor::OrderSectionsByCallGraph) -> StatusCode;
+struct parametersFor::OrderSectionsByCallGraph {
+    struct {
+        std::string_view callGraphProfileFile; // May be empty
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        in<SymbolTable> symbolTable;
+        in<Vector2D<InputSectionState>> sectionStates;
+    } in;
+    struct {
+        out<Vector2D<uint32_t>> sectionPriorities;
+        out<size_t> numEdges;
+        out<size_t> numClusters;
+    } out;
+};
+
+} // namespace cppld
@@ -3,6 +3,7 @@
 #include "statusreport.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <charconv>
 #include <cstring>
 #include <utility>
@@ -11,36 +12,64 @@
 namespace cppld {
 
 auto parseInputAndCreateSymbolTable(parametersFor::ParseInputAndCreateSymbolTable p) -> StatusCode {
-    auto& [addresses, memSizes] = p.in;
+    auto& [addresses, memSizes, archiveIndices] = p.in;
 
     auto& [elfAddresses,
            sortKeys,
            sectionHeaders,
            sectionStringTables,
            archiveExtractionMemory,
-           symbolTable] = p.out;
+           symbolTable,
+           sectionStates] = p.out;
 
-    StatusCode status{StatusCode::ok};
+    std::vector<SortKey> archiveMemberSortKeys;
+    std::vector<ArchiveMemberState> archiveMembersStates;
+    ArchiveSymbolTable archiveSymbolTable;
+    auto status = parseInputFiles({.in{addresses, memSizes, archiveIndices},
+                                   .out{elfAddresses, sortKeys, sectionHeaders, sectionStringTables,
+                                        archiveMemberSortKeys, archiveMembersStates, archiveSymbolTable}});
+    if (status != StatusCode::ok) return status;
+
+    return createSymbolTable({.in{addresses, memSizes, archiveMemberSortKeys, archiveSymbolTable},
+                              .inout{elfAddresses, sortKeys, sectionHeaders, sectionStringTables, archiveMembersStates},
+                              .out{archiveExtractionMemory, symbolTable, sectionStates}});
+}
+
+auto parseInputFiles(parametersFor::ParseInputFiles p) -> StatusCode {
+    auto& [addresses, memSizes, archiveIndices] = p.in;
+    auto& [elfAddresses,
+           sortKeys,
+           sectionHeaders,
+           sectionStringTables,
+           archiveMemberSortKeys,
+           archiveMembersStates,
+           archiveSymbolTable] = p.out;
 
     std::vector<uint32_t> elfFileIndices;
     std::vector<uint32_t> archiveFileIndices;
 
-    status = classifyInput({.in{addresses, memSizes}, .out{elfFileIndices, archiveFileIndices}});
+    auto status = classifyInput({.in{addresses, memSizes}, .out{elfFileIndices, archiveFileIndices}});
     if (status != StatusCode::ok) return status;
 
     auto elfParseFuture = std::async(std::launch::async, parseElfFiles,
                                      parametersFor::ParseElfFiles{.in{addresses, memSizes, elfFileIndices},
                                                                   .out{elfAddresses, sortKeys, sectionHeaders, sectionStringTables}});
 
-    std::vector<SortKey> archiveMemberSortKeys;
-    std::vector<ArchiveMemberState> archiveMembersStates;
-    ArchiveSymbolTable archiveSymbolTable;
     auto archiveParseFuture = std::async(std::launch::async, parseArchiveMembers,
-                                         parametersFor::ParseArchiveMembers{.in{addresses, memSizes, archiveFileIndices},
+                                         parametersFor::ParseArchiveMembers{.in{addresses, memSizes, archiveFileIndices, archiveIndices},
                                                                             .out{archiveMemberSortKeys, archiveMembersStates, archiveSymbolTable}});
     auto elfParseStatus = elfParseFuture.get();
     auto archiveParseStatus = archiveParseFuture.get();
     if (elfParseStatus != StatusCode::ok || archiveParseStatus != StatusCode::ok) return StatusCode::not_ok;
+    return StatusCode::ok;
+}
+
+auto createSymbolTable(parametersFor::CreateSymbolTable p) -> StatusCode {
+    auto& [addresses, memSizes, archiveMemberSortKeys, archiveSymbolTable] = p.in;
+    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables, archiveMembersStates] = p.inout;
+    auto& [archiveExtractionMemory, symbolTable, sectionStates] = p.out;
+
+    StatusCode status{StatusCode::ok};
 
     size_t elfInsertStartID{0};
     std::vector<std::string_view> searchedSymbolNames{};
@@ -68,8 +97,8 @@ auto parseInputAndCreateSymbolTable(parametersFor::ParseInputAndCreateSymbolTabl
             break;
 
         searchedSymbolNames.clear();
-        status = insertSymbolsIntoSymbolTable({.in{{elfAddresses.begin() + static_cast<std::ptrdiff_t>(elfInsertStartID), elfAddresses.end()},
-                                                   {sectionHeaders.begin() + static_cast<std::ptrdiff_t>(elfInsertStartID), sectionHeaders.end()},
+        status = insertSymbolsIntoSymbolTable({.in{elfAddresses,
+                                                   sectionHeaders,
                                                    sortKeys,
                                                    elfInsertStartID},
                                                .inout{symbolTable},
@@ -77,6 +106,8 @@ auto parseInputAndCreateSymbolTable(parametersFor::ParseInputAndCreateSymbolTabl
         if (status != StatusCode::ok) return status;
     }
 
+    status = resolveComdatGroups({.in{elfAddresses, sortKeys, sectionHeaders, sectionStringTables},
+                                  .out{sectionStates}});
     return status;
 }
 
@@ -146,7 +177,8 @@ auto initRelaElf(InitRelaElf p) -> StatusCode {
     // Validate that all sections are within the mapped memory region
     for (auto& secHdr : secHeaders) {
         if (secHdr.sh_type == SHT_NOBITS) continue;
-        if (secHdr.sh_type == SHT_GROUP) return report(StatusCode::not_ok, " Group Sections not supported");
+        if (secHdr.sh_type == SHT_GROUP && (secHdr.sh_entsize != sizeof(Elf64_Word) || secHdr.sh_size < sizeof(Elf64_Word) || secHdr.sh_link >= secHeaders.size()))
+            return report(StatusCode::bad_input_file, "Elf File with a malformed section group");
         if (memSize < (secHdr.sh_offset + secHdr.sh_size)) return report(StatusCode::bad_input_file, "Elf File accesses out of bounds memory");
     }
 
@@ -197,66 +229,92 @@ auto parseElfFiles(parametersFor::ParseElfFiles p) -> StatusCode {
 }
 
 auto parseArchiveMembers(parametersFor::ParseArchiveMembers p) -> StatusCode {
-    auto& [addresses, memSizes, archiveFileIndices] = p.in;
+    auto& [addresses, memSizes, archiveFileIndices, archiveIndices] = p.in;
     auto& [archiveMemberSortKeys, archiveMemberStates, archiveSymbolTable] = p.out;
     archiveMemberSortKeys.reserve(archiveFileIndices.size());
     archiveMemberStates.reserve(archiveFileIndices.size());
     archiveSymbolTable.reserve(archiveFileIndices.size());
 
     for (auto fileIndex : archiveFileIndices) {
-        auto address = static_cast<std::byte*>(addresses[fileIndex]);
-        auto memSize = memSizes[fileIndex];
-        auto badFileError = [&]() { return report(StatusCode::bad_input_file, " input file #", fileIndex); };
-
-        if (memSize < (SARMAG + sizeof(ar_hdr))) return StatusCode::not_ok;
-        auto& symTableHdr = *estd::start_lifetime_as<ar_hdr>(address + SARMAG);
-        constexpr std::string_view expectedName{"/               "};
-        constexpr auto arNameSize = sizeof(symTableHdr.ar_name);
-        static_assert(expectedName.size() == arNameSize);
-        if (std::memcmp(symTableHdr.ar_name, expectedName.data(), arNameSize) != 0)
-            return badFileError();
-
-        // Get the size of the entry in bytes
-        size_t symTableSize{0};
-        auto ar_sizeEndPtr = symTableHdr.ar_size + sizeof(symTableHdr.ar_size);
-        if (auto ec = std::from_chars(symTableHdr.ar_size, ar_sizeEndPtr, symTableSize).ec;
-            ec != std::errc{}) return badFileError();
-        if (memSize < (SARMAG + sizeof(ar_hdr) + symTableSize)) return badFileError();
-
-        auto symTableFileOffset = SARMAG + sizeof(ar_hdr);
-        auto symTablePtr = address + symTableFileOffset;
-        struct ArchiveWord {
-            std::array<uint8_t, 4> mem;
-            operator uint32_t() const {
-                return (uint32_t{mem[0]} << 24) | (uint32_t{mem[1]} << 16) | (uint32_t{mem[2]} << 8) | (uint32_t{mem[3]} << 0);
-            }
-        };
-        uint32_t totalNumberOfSymbols = *estd::start_lifetime_as<ArchiveWord>(symTablePtr);
-
-        if (totalNumberOfSymbols == 0) return badFileError();
-        if (symTableSize < (totalNumberOfSymbols * sizeof(ArchiveWord) + sizeof(ArchiveWord))) return badFileError();
-
-        symTablePtr += sizeof(ArchiveWord);
-        auto memberOffsets = view_as_span<ArchiveWord>(symTablePtr, totalNumberOfSymbols);
-
-        auto symStrTabSize = symTableSize - sizeof(ArchiveWord) * (totalNumberOfSymbols + 1);
-        auto symStrTabPtr = estd::start_lifetime_as_array<char>(symTablePtr + memberOffsets.size_bytes(),
-                                                                symStrTabSize);
-        size_t symStrTabPtrOffset{0};
-        uint32_t currMemberOffset = memberOffsets[0] - 1;
+        ArchiveIndex decodedIndex;
+        auto archiveIndex = fileIndex < archiveIndices.size() ? archiveIndices[fileIndex] : nullptr;
+        if (!archiveIndex) {
+            if (auto status = decodeArchiveIndex({.in{static_cast<std::byte*>(addresses[fileIndex]), memSizes[fileIndex], fileIndex}, .out{decodedIndex}});
+                status != StatusCode::ok) return status;
+            archiveIndex = &decodedIndex;
+        }
 
-        for (uint32_t memberOffset : memberOffsets) {
-            if (currMemberOffset != memberOffset) {
-                currMemberOffset = memberOffset;
+        // The members get ids among all archives of this link
+        auto firstMemberID = archiveMemberStates.size();
+        for (auto memberOffset : archiveIndex->memberOffsets) {
+            archiveMemberSortKeys.push_back(makeSortKey(fileIndex, memberOffset));
+            archiveMemberStates.push_back(ArchiveMemberState::lazy);
+        }
+        for (auto& [symbolName, memberPosition] : archiveIndex->symbols)
+            archiveSymbolTable[symbolName].push_back(firstMemberID + memberPosition);
+    }
+    return StatusCode::ok;
+}
 
-                archiveMemberSortKeys.push_back(makeSortKey(fileIndex, memberOffset));
-                archiveMemberStates.push_back(ArchiveMemberState::lazy);
-            }
-            std::string_view currentSymbolName{symStrTabPtr + symStrTabPtrOffset};
-            archiveSymbolTable[currentSymbolName].push_back(archiveMemberStates.size() - 1);
-            symStrTabPtrOffset += currentSymbolName.size() + 1;
-            if (symStrTabPtrOffset > symStrTabSize) return badFileError();
+auto decodeArchiveIndex(parametersFor::DecodeArchiveIndex p) -> StatusCode {
+    auto& [address, memSize, fileIndex] = p.in;
+    auto& [archiveIndex] = p.out;
+    auto badFileError = [&]() { return report(StatusCode::bad_input_file, " input file #", fileIndex); };
+
+    if (memSize < (SARMAG + sizeof(ar_hdr))) return StatusCode::not_ok;
+    auto& symTableHdr = *estd::start_lifetime_as<ar_hdr>(address + SARMAG);
+    constexpr std::string_view expectedName{"/               "};
+    constexpr auto arNameSize = sizeof(symTableHdr.ar_name);
+    static_assert(expectedName.size() == arNameSize);
+    if (std::memcmp(symTableHdr.ar_name, expectedName.data(), arNameSize) != 0)
+        return badFileError();
+
+    // Get the size of the entry in bytes
+    size_t symTableSize{0};
+    auto ar_sizeEndPtr = symTableHdr.ar_size + sizeof(symTableHdr.ar_size);
+    if (auto ec = std::from_chars(symTableHdr.ar_size, ar_sizeEndPtr, symTableSize).ec;
+        ec != std::errc{}) return badFileError();
+    if (memSize < (SARMAG + sizeof(ar_hdr) + symTableSize)) return badFileError();
+
+    auto symTableFileOffset = SARMAG + sizeof(ar_hdr);
+    auto symTablePtr = address + symTableFileOffset;
+    struct ArchiveWord {
+        std::array<uint8_t, 4> mem;
+        operator uint32_t() const {
+            return (uint32_t{mem[0]} << 24) | (uint32_t{mem[1]} << 16) | (uint32_t{mem[2]} << 8) | (uint32_t{mem[3]} << 0);
         }
+    };
+    uint32_t totalNumberOfSymbols = *estd::start_lifetime_as<ArchiveWord>(symTablePtr);
+
+    if (totalNumberOfSymbols == 0) return badFileError();
+    if (symTableSize < (totalNumberOfSymbols * sizeof(ArchiveWord) + sizeof(ArchiveWord))) return badFileError();
+
+    symTablePtr += sizeof(ArchiveWord);
+    auto memberOffsets = view_as_span<ArchiveWord>(symTablePtr, totalNumberOfSymbols);
+
+    auto symStrTabSize = symTableSize - sizeof(ArchiveWord) * (totalNumberOfSymbols + 1);
+    auto symStrTabPtr = estd::start_lifetime_as_array<char>(symTablePtr + memberOffsets.size_bytes(),
+                                                            symStrTabSize);
+    size_t symStrTabPtrOffset{0};
+    uint32_t currMemberOffset = memberOffsets[0] - 1;
+    archiveIndex.symbols.reserve(totalNumberOfSymbols);
+
+    for (uint32_t memberOffset : memberOffsets) {
+        if (currMemberOffset != memberOffset) {
+            currMemberOffset = memberOffset;
+
+            // The member has to fit into the archive, extraction relies on that
+            size_t memberSize{0};
+            if (memSize < (size_t{memberOffset} + sizeof(ar_hdr))) return badFileError();
+            auto& memberHdr = *estd::start_lifetime_as<ar_hdr>(address + memberOffset);
+            if (auto ec = std::from_chars(memberHdr.ar_size, memberHdr.ar_size + sizeof(memberHdr.ar_size), memberSize).ec;
+                ec != std::errc{} || memSize < (size_t{memberOffset} + sizeof(ar_hdr) + memberSize)) return badFileError();
+            archiveIndex.memberOffsets.push_back(memberOffset);
+        }
+        std::string_view currentSymbolName{symStrTabPtr + symStrTabPtrOffset};
+        archiveIndex.symbols.emplace_back(currentSymbolName, static_cast<uint32_t>(archiveIndex.memberOffsets.size() - 1));
+        symStrTabPtrOffset += currentSymbolName.size() + 1;
+        if (symStrTabPtrOffset > symStrTabSize) return badFileError();
     }
     return StatusCode::ok;
 }
@@ -268,25 +326,29 @@ auto insertSymbolsIntoSymbolTable(parametersFor::InsertSymbolsIntoSymbolTable p)
 
     std::vector<readonly_span<Elf64_Sym>> symbols;
     std::vector<const char*> symbolStringTables;
+    std::vector<readonly_span<Elf64_Shdr>> symbolSectionHeaders;
     std::vector<size_t> elfIDs;
 
     constexpr size_t averageNumberOfSymbolsInChromePerFile{350}; // See https://github.com/rui314/mold/blob/main/docs/design.md
     symbols.reserve(baseAddresses.size() * averageNumberOfSymbolsInChromePerFile);
     symbolStringTables.reserve(baseAddresses.size());
+    symbolSectionHeaders.reserve(baseAddresses.size());
     elfIDs.reserve(baseAddresses.size());
 
     StatusCode status{StatusCode::ok};
-    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> secHeaders, size_t elfID) {
+    auto newSectionHeaders = sectionHeaders.subspan(startID);
+    for_each_indexed(newSectionHeaders, [&](readonly_span<Elf64_Shdr> secHeaders, size_t elfID) {
         for (auto& secHdr : secHeaders) {
             if (secHdr.sh_type != SHT_SYMTAB) continue;
             if (secHdr.sh_entsize != sizeof(Elf64_Sym)) {
-                status = report(StatusCode::bad_input_file, " object file #", elfID);
+                status = report(StatusCode::bad_input_file, " object file #", elfID + startID);
                 return;
             }
-            auto baseAddress = baseAddresses[elfID];
+            auto baseAddress = baseAddresses[elfID + startID];
             auto& strTabHdr = secHeaders[secHdr.sh_link];
             symbols.push_back(view_as_span<Elf64_Sym>(baseAddress + secHdr.sh_offset, secHdr.sh_size / secHdr.sh_entsize));
             symbolStringTables.push_back(estd::start_lifetime_as_array<char>(baseAddress + strTabHdr.sh_offset, strTabHdr.sh_size));
+            symbolSectionHeaders.push_back(secHeaders);
             elfIDs.push_back(elfID + startID);
         }
     });
@@ -305,6 +367,12 @@ auto insertSymbolsIntoSymbolTable(parametersFor::InsertSymbolsIntoSymbolTable p)
         return ELF64_ST_BIND(sym.st_info) == STB_GLOBAL;
     };
 
+    // Groups are resolved after all symbols are known. Definitions of the same symbol in groups are allowed,
+    // like inline functions that every object file has. The first one wins, just like the first group of a signature does
+    auto isInGroup = [](Elf64_Sym const& sym, readonly_span<Elf64_Shdr> secHeaders) {
+        return sym.st_shndx < secHeaders.size() && (secHeaders[sym.st_shndx].sh_flags & SHF_GROUP);
+    };
+
     auto replaceIfAppropriate = [&](SymbolRef& entry, Elf64_Sym const& sym, size_t elfID) {
         if (!entry.symbol) {
             entry = {&sym, elfID};
@@ -322,6 +390,7 @@ auto insertSymbolsIntoSymbolTable(parametersFor::InsertSymbolsIntoSymbolTable p)
 
     for_each_indexed(symbols, [&](readonly_span<Elf64_Sym> syms, size_t index) {
         auto elfID = elfIDs[index];
+        auto secHeaders = symbolSectionHeaders[index];
         for_each_indexed(syms, [&](Elf64_Sym const& sym, size_t symIndex) {
             if (symIndex == STN_UNDEF) return; // Skips the dummy symbol
             if (isLocal(sym)) return; // Don't insert any local symbols
@@ -335,7 +404,8 @@ auto insertSymbolsIntoSymbolTable(parametersFor::InsertSymbolsIntoSymbolTable p)
             }
             // Symbol Definition
             auto& entry = symbolTable[name].firstLoad;
-            if (entry.symbol && (isGlobal(sym) && isGlobal(*entry.symbol))) {
+            if (entry.symbol && (isGlobal(sym) && isGlobal(*entry.symbol)) &&
+                !(isInGroup(sym, secHeaders) && isInGroup(*entry.symbol, sectionHeaders[entry.elfID]))) {
                 status = report(StatusCode::symbol_redefined, name);
                 return /*failure*/;
             }
@@ -428,4 +498,70 @@ auto extractArchiveMembers(parametersFor::ExtractArchiveMembers p) -> StatusCode
     return StatusCode::ok;
 }
 
-} // namespace cppld
\ No newline at end of file
+auto resolveComdatGroups(parametersFor::ResolveComdatGroups p) -> StatusCode {
+    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables] = p.in;
+    auto& [sectionStates] = p.out;
+
+    struct ComdatGroup {
+        size_t headerID;
+        std::string_view signature;
+        readonly_span<Elf64_Word> members;
+    };
+    Vector2D<ComdatGroup> groups(sectionHeaders.size());
+    sectionStates.resize(sectionHeaders.size());
+
+    StatusCode status{StatusCode::ok};
+    parallel_for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        sectionStates[elfID].resize(headers.size(), InputSectionState::live);
+        auto address = elfAddresses[elfID];
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (header.sh_type != SHT_GROUP) return;
+            auto words = view_as_span<Elf64_Word>(address + header.sh_offset, header.sh_size / sizeof(Elf64_Word));
+            if (!(words[0] & GRP_COMDAT)) return;
+
+            auto& symTabHeader = headers[header.sh_link];
+            auto symbols = view_as_span<Elf64_Sym>(address + symTabHeader.sh_offset, symTabHeader.sh_size / sizeof(Elf64_Sym));
+            if (header.sh_info >= symbols.size() || symTabHeader.sh_link >= headers.size() || symbols[header.sh_info].st_shndx >= headers.size()) {
+                std::atomic_ref{status}.store(report(StatusCode::bad_input_file, "group signature out of bounds in object file #", elfID));
+                return;
+            }
+            auto& signatureSymbol = symbols[header.sh_info];
+            auto& symStrTabHeader = headers[symTabHeader.sh_link];
+            // A section symbol as signature stands for the name of its section
+            auto signature = ELF64_ST_TYPE(signatureSymbol.st_info) == STT_SECTION
+                                 ? std::string_view{sectionStringTables[elfID] + headers[signatureSymbol.st_shndx].sh_name}
+                                 : std::string_view{estd::start_lifetime_as_array<char>(address + symStrTabHeader.sh_offset, symStrTabHeader.sh_size) + signatureSymbol.st_name};
+            groups[elfID].push_back({.headerID = headerID, .signature = signature, .members = words.subspan(1)});
+        });
+    });
+    if (status != StatusCode::ok) return status;
+
+    std::unordered_map<std::string_view, uint32_t> signatureIDs;
+    Vector2D<uint32_t> groupSignatureIDs(groups.size());
+    for_each_indexed(groups, [&](std::vector<ComdatGroup> const& elfGroups, size_t elfID) {
+        for (auto& group : elfGroups)
+            groupSignatureIDs[elfID].push_back(signatureIDs.emplace(group.signature, signatureIDs.size()).first->second);
+    });
+    if (signatureIDs.empty()) return StatusCode::ok;
+
+    std::vector<SortKey> winners(signatureIDs.size(), std::numeric_limits<SortKey>::max());
+    parallel_for_each_indexed(groupSignatureIDs, [&](std::vector<uint32_t> const& signatureIDsOfElf, size_t elfID) {
+        for (auto signatureID : signatureIDsOfElf) {
+            std::atomic_ref winner{winners[signatureID]};
+            auto current = winner.load();
+            while (sortKeys[elfID] < current && !winner.compare_exchange_weak(current, sortKeys[elfID])) {}
+        }
+    });
+
+    parallel_for_each_indexed(groups, [&](std::vector<ComdatGroup> const& elfGroups, size_t elfID) {
+        for_each_indexed(elfGroups, [&](ComdatGroup const& group, size_t groupIndex) {
+            if (winners[groupSignatureIDs[elfID][groupIndex]] == sortKeys[elfID]) return;
+            for (auto member : group.members) {
+                if (member < sectionStates[elfID].size()) sectionStates[elfID][member] = InputSectionState::discarded;
+            }
+        });
+    });
+    return StatusCode::ok;
+}
+
+} // namespace cppld
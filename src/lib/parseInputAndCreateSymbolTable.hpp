@@ -1,24 +1,29 @@
 #pragma once
-#include "cppld_api_types.hpp"
+#include "cppld.hpp"
+#include "cppld_internal_types.hpp"
 #include "elf.h"
 #include <cstdint>
 
-#include "reference_types.hpp"
 #include <memory_resource>
 #include <unordered_map>
 namespace cppld {
 
 namespace parametersFor {
 struct ParseInputAndCreateSymbolTable;
+// The two halves of it
+struct ParseInputFiles;
+struct CreateSymbolTable;
 // Substeps
 struct ClassifyInput;
 struct ParseElfFiles;
 struct ParseArchiveMembers;
+struct DecodeArchiveIndex;
 // These steps are repeated until no more archives are extracted
 struct InsertSymbolsIntoSymbolTable;
 struct DetermineArchiveMembersToExtract;
 struct ExtractArchiveMembers;
 // End loop
+struct ResolveComdatGroups;
 
 }; // namespace parametersFor
 
@@ -30,12 +35,14 @@ struct ExtractArchiveMembers;
  * If a stateless allocator is used, the additional memory can be identified by virtue of the pointer not being equal to a source addresse
  * 
  * SortKeys are returned since they are potentially needed by section merging later
+ * Sections of COMDAT groups that lost against an earlier group with the same signature are marked as discarded
  */
 auto parseInputAndCreateSymbolTable(parametersFor::ParseInputAndCreateSymbolTable) -> StatusCode;
 struct parametersFor::ParseInputAndCreateSymbolTable {
     struct {
         readonly_span<void*> addresses;
         readonly_span<size_t> memSizes;
+        readonly_span<ArchiveIndex const*> archiveIndices;
     } in;
     struct {
         out<std::vector<std::byte*>> elfAddresses;
@@ -44,6 +51,7 @@ struct parametersFor::ParseInputAndCreateSymbolTable {
         out<std::vector<const char*>> sectionStringTables;
         out<std::pmr::memory_resource> archiveExtractionMemory;
         out<SymbolTable> symbolTable;
+        out<Vector2D<InputSectionState>> sectionStates;
     } out;
 };
 
@@ -58,6 +66,55 @@ enum class ArchiveMemberState : uint8_t {
 // Using a pmr map to have the potential for more local memory management
 using ArchiveSymbolTable = std::pmr::unordered_map<std::string_view, std::pmr::vector<size_t>>;
 
+/**
+ * @brief The half of parseInputAndCreateSymbolTable() that only depends on the input files
+ * Object files are checked and the symbol tables of archives are read. The results are only read from then on,
+ * so links of several outputs over the same inputs can share them
+ */
+auto parseInputFiles(parametersFor::ParseInputFiles) -> StatusCode;
+struct parametersFor::ParseInputFiles {
+    struct {
+        readonly_span<void*> addresses;
+        readonly_span<size_t> memSizes;
+        readonly_span<ArchiveIndex const*> archiveIndices;
+    } in;
+    struct {
+        out<std::vector<std::byte*>> elfAddresses;
+        out<std::vector<SortKey>> sortKeys;
+        out<std::vector<readonly_span<Elf64_Shdr>>> sectionHeaders;
+        out<std::vector<const char*>> sectionStringTables;
+        out<std::vector<SortKey>> archiveMemberSortKeys;
+        out<std::vector<ArchiveMemberState>> archiveMemberStates;
+        out<ArchiveSymbolTable> archiveSymbolTable;
+    } out;
+};
+
+/**
+ * @brief The half of parseInputAndCreateSymbolTable() that resolves symbols
+ * Archive members are extracted and appended to the object files until no more are needed, then COMDAT groups are resolved
+ */
+auto createSymbolTable(parametersFor::CreateSymbolTable) -> StatusCode;
+struct parametersFor::CreateSymbolTable {
+    struct {
+        readonly_span<void*> addresses;
+        readonly_span<size_t> memSizes;
+        readonly_span<SortKey> archiveMemberSortKeys;
+        in<ArchiveSymbolTable> archiveSymbolTable;
+    } in;
+    struct {
+        inout<std::vector<std::byte*>> elfAddresses;
+        inout<std::vector<SortKey>> sortKeys;
+        inout<std::vector<readonly_span<Elf64_Shdr>>> sectionHeaders;
+        inout<std::vector<const char*>> sectionStringTables;
+        inout<std::vector<ArchiveMemberState>> archiveMemberStates;
+    } inout;
+    struct {
+        out<std::pmr::memory_resource> archiveExtractionMemory;
+        out<SymbolTable> symbolTable;
+        out<Vector2D<InputSectionState>> sectionStates;
+    } out;
+};
+
 /**
  * @brief The initial bytes of the input are checked to differentiate archive files from object files
  * The two can then be handled seperately
@@ -100,6 +157,7 @@ struct parametersFor::ParseElfFiles {
  * 
  * A special Symbol Table for Archive files is built, too. 
  * It is later used to determine which archive file should be extracted
+ * Archives with an entry in archiveIndices (by file index, may be empty or nullptr) are not decoded again, only their members are numbered
  * 
  */
 auto parseArchiveMembers(parametersFor::ParseArchiveMembers) -> StatusCode;
@@ -108,6 +166,7 @@ struct parametersFor::ParseArchiveMembers {
         readonly_span<void*> addresses;
         readonly_span<size_t> memSizes;
         readonly_span<uint32_t> archiveFileIndices;
+        readonly_span<ArchiveIndex const*> archiveIndices;
     } in;
     struct {
         out<std::vector<SortKey>> archiveMemberSortKeys;
@@ -116,10 +175,27 @@ struct parametersFor::ParseArchiveMembers {
     } out;
 };
 
+/**
+ * @brief Reads the symbol table of an archive and checks the headers of the members it refers to
+ * fileIndex is only used for error messages
+ */
+auto decodeArchiveIndex(parametersFor::DecodeArchiveIndex) -> StatusCode;
+struct parametersFor::DecodeArchiveIndex {
+    struct {
+        std::byte* address;
+        size_t memSize;
+        size_t fileIndex;
+    } in;
+    struct {
+        out<ArchiveIndex> archiveIndex;
+    } out;
+};
+
 /**
  * @brief Function to insert the global symbols of elf files into the global symbol table
  * 
- * Since this function is called several times with partial results, an offset parameter is given to insert the correct IDs
+ * Since this function is called several times with partial results, only the files from elfIDOffset on are inserted, the ones before are in the table already
+ * A global symbol may be defined more than once if all definitions are in sections of groups, the first definition wins
  */
 auto insertSymbolsIntoSymbolTable(parametersFor::InsertSymbolsIntoSymbolTable) -> StatusCode;
 struct parametersFor::InsertSymbolsIntoSymbolTable {
@@ -187,4 +263,24 @@ struct parametersFor::ExtractArchiveMembers {
     } out;
 };
 
+/**
+ * @brief Of all COMDAT groups with the same signature, only the first one by SortKey is kept. The member sections of the others get discarded
+ * 
+ * This matches the resolution of weak symbols, which also prefers the first definition, so the symbols defined in a group point to the kept copy.
+ * Groups are collected and their winners determined in parallel per file, only assigning IDs to the signatures is sequential
+ * Groups without the GRP_COMDAT flag are kept as they are
+ */
+auto resolveComdatGroups(parametersFor::ResolveComdatGroups) -> StatusCode;
+struct parametersFor::ResolveComdatGroups {
+    struct {
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<SortKey> sortKeys;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+    } in;
+    struct {
+        out<Vector2D<InputSectionState>> sectionStates;
+    } out;
+};
+
 } // namespace cppld
\ No newline at end of file
@@ -0,0 +1,481 @@
+#include "relocatableOutput.hpp"
+#include "convenient_functions.hpp"
+#include "mapInputSectionsToOutputSections.hpp"
+#include "statusreport.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+// The symbol table of an input file, empty if it has none
+struct InputSymbols {
+    readonly_span<Elf64_Sym> symbols;
+    const char* strings{nullptr};
+    size_t numLocals{0};
+};
+
+auto inputSymbolsOf(std::byte* address, readonly_span<Elf64_Shdr> headers) -> InputSymbols {
+    for (auto& header : headers) {
+        if (header.sh_type != SHT_SYMTAB) continue;
+        auto& stringTableHeader = headers[header.sh_link];
+        return {.symbols = view_as_span<Elf64_Sym>(address + header.sh_offset, header.sh_size / sizeof(Elf64_Sym)),
+                .strings = estd::start_lifetime_as_array<char>(address + stringTableHeader.sh_offset, stringTableHeader.sh_size),
+                .numLocals = header.sh_info};
+    }
+    return {};
+}
+
+// Copies a table into memory that lives as long as the output
+template <typename T>
+auto materialize(std::pmr::memory_resource& memory, std::vector<T> const& table) -> std::byte* {
+    auto view = static_cast<std::byte*>(memory.allocate(std::max<size_t>(table.size() * sizeof(T), 1), alignof(T)));
+    std::memcpy(view, table.data(), table.size() * sizeof(T));
+    return view;
+}
+
+} // namespace
+
+auto mapInputSectionsToRelocatableOutput(parametersFor::MapInputSectionsToRelocatableOutput p) -> StatusCode {
+    auto& [elfAddresses, sortKeys, sectionHeaders, sectionStringTables, symbolTable, sectionStates, options] = p.in;
+    auto& [materializedSectionMemory, outputSectionHeaders, elfHeader, outputToInputSections,
+           inputToOutputSection, outputSectionTypes, outputSectionSizes, inputSectionCopyCommands,
+           materializedViews, programHeaders, outputSectionAddresses, outputSectionFileOffsets,
+           gotAddress, processedRelas] = p.out;
+
+    StatusCode status{StatusCode::ok};
+    std::vector<std::string_view> names;
+    std::vector<Elf64_Xword> alignments;
+    std::vector<Elf64_Xword> flags;
+    size_t totalNumberOfLocalSymbols{0};
+    size_t totalStringTableMemorySize{0};
+
+    // The final link still needs the section names, e.g. to sort .text.hot.* or to keep the sections of a group apart
+    status = initOutputSections({.in{sectionHeaders, sectionStringTables, sectionStates, options.reproducible, /*keepSectionNames*/ true},
+                                 .out{names, outputToInputSections, alignments,
+                                      outputSectionTypes, flags, inputToOutputSection,
+                                      totalNumberOfLocalSymbols,
+                                      totalStringTableMemorySize}});
+    if (status != StatusCode::ok) return status;
+
+    // Symbol ordering is left to the final link, it sees the sections of the object on its own anyway
+    Vector2D<uint32_t> noSectionPriorities;
+    size_t savedAlignmentPadding{0};
+    status = mergeAndSortInputSections({.in{elfAddresses,
+                                            sortKeys,
+                                            sectionHeaders,
+                                            sectionStringTables,
+                                            names,
+                                            flags,
+                                            noSectionPriorities,
+                                            /*tailMergeStrings*/ options.optimizationLevel >= 2,
+                                            options.sortSectionsByAlignment,
+                                            /*reserveIncrementalSlack*/ false},
+                                        .inout{outputToInputSections},
+                                        .out{outputSectionSizes,
+                                             inputSectionCopyCommands,
+                                             materializedViews,
+                                             materializedSectionMemory,
+                                             savedAlignmentPadding}});
+    if (status != StatusCode::ok) return status;
+    if (options.printStatistics && options.sortSectionsByAlignment)
+        inform("saved ", savedAlignmentPadding, " bytes of alignment padding");
+
+    // The pieces are merged already. Relocations point into the merged sections now, so they must not be merged again
+    for (auto& flag : flags)
+        flag &= ~static_cast<Elf64_Xword>(SHF_MERGE | SHF_STRINGS);
+
+    size_t numRemovedDescriptions{0};
+    status = removeDeadFrameDescriptions({.in{elfAddresses, sectionHeaders, names, outputToInputSections, symbolTable, sectionStates},
+                                          .inout{inputSectionCopyCommands, outputSectionSizes, materializedViews},
+                                          .out{materializedSectionMemory, numRemovedDescriptions}});
+    if (status != StatusCode::ok) return status;
+    if (options.printStatistics && numRemovedDescriptions)
+        inform("removed ", numRemovedDescriptions, " unwind descriptions of discarded sections");
+
+    // Groups
+    // Groups that won (or were never COMDAT) are written again, so the final link can pick one copy among several relocatable outputs.
+    // Groups that lost have no members in the output. Group sections come before their members, so they get the first section indices
+
+    std::vector<SectionRef> outputGroups;
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (header.sh_type != SHT_GROUP) return;
+            auto members = view_as_span<Elf64_Word>(elfAddresses[elfID] + header.sh_offset, header.sh_size / sizeof(Elf64_Word)).subspan(1);
+            if (std::any_of(members.begin(), members.end(), [&](Elf64_Word member) {
+                    return member < headers.size() && inputToOutputSection[elfID][member] != meta::notAnOutputSection;
+                }))
+                outputGroups.push_back({.elfIndex = elfID, .headerIndex = headerID});
+        });
+    });
+    auto numGroups = outputGroups.size();
+    auto firstDataSectionIndex = numGroups + 1;
+
+    auto numDataSections = names.size();
+    auto mapToOutput = [&](SectionRef secRef, size_t offsetInInput, size_t& offsetInOutput) {
+        return inputToOutputSectionOffset({.in{secRef, offsetInInput, inputSectionCopyCommands}, .out{offsetInOutput}});
+    };
+
+    // Symbol Table
+    // The null symbol and a section symbol per output section come first, relocations against section symbols are moved to those
+    // The section symbol of output section i is symbol i + 1, the section itself has index i + firstDataSectionIndex
+
+    std::vector<Elf64_Sym> symbols(numDataSections + 1);
+    symbols.reserve(numDataSections + 1 + totalNumberOfLocalSymbols + symbolTable.size());
+    for (size_t id{0}; id < numDataSections; ++id) {
+        symbols[id + 1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        symbols[id + 1].st_shndx = static_cast<Elf64_Section>(id + firstDataSectionIndex);
+    }
+    std::vector<char> symbolStrings{'\0'};
+    symbolStrings.reserve(totalStringTableMemorySize);
+    auto pushSymbol = [&](Elf64_Sym sym, std::string_view symName) -> Elf64_Word {
+        sym.st_name = symName.empty() ? 0 : static_cast<Elf64_Word>(symbolStrings.size());
+        if (!symName.empty()) {
+            symbolStrings.insert(symbolStrings.end(), symName.begin(), symName.end());
+            symbolStrings.push_back('\0');
+        }
+        symbols.push_back(sym);
+        return static_cast<Elf64_Word>(symbols.size() - 1);
+    };
+    // False if the section of the symbol didn't make it to the output. Absolute and common symbols stay as they are
+    auto moveToOutputSection = [&](Elf64_Sym& sym, size_t elfID) -> bool {
+        if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= SHN_LORESERVE) return true;
+        auto outSectionID = inputToOutputSection[elfID][sym.st_shndx];
+        if (outSectionID == meta::notAnOutputSection) return false;
+        if (auto symbolStatus = mapToOutput({elfID, sym.st_shndx}, sym.st_value, sym.st_value); symbolStatus != StatusCode::ok) {
+            status = symbolStatus;
+            return false;
+        }
+        sym.st_shndx = static_cast<Elf64_Section>(outSectionID + firstDataSectionIndex);
+        return true;
+    };
+
+    std::vector<InputSymbols> inputSymbols(sectionHeaders.size());
+    Vector2D<Elf64_Word> localSymbolIndices(sectionHeaders.size());
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        auto& [fileSymbols, symStrings, numLocals] = inputSymbols[elfID] = inputSymbolsOf(elfAddresses[elfID], headers);
+        // Zero for symbols that are not in the output
+        localSymbolIndices[elfID].resize(numLocals, 0);
+        for (size_t i = 1; i < numLocals; ++i) {
+            auto sym = fileSymbols[i];
+            if (sym.st_shndx == SHN_XINDEX) {
+                status = report(StatusCode::bad_input_file, " symbol points to a section with a too high index");
+                continue;
+            }
+            if (ELF64_ST_TYPE(sym.st_info) == STT_SECTION) {
+                if (sym.st_shndx < SHN_LORESERVE && inputToOutputSection[elfID][sym.st_shndx] != meta::notAnOutputSection)
+                    localSymbolIndices[elfID][i] = inputToOutputSection[elfID][sym.st_shndx] + 1U;
+                continue;
+            }
+            if (!moveToOutputSection(sym, elfID)) continue;
+            localSymbolIndices[elfID][i] = pushSymbol(sym, std::string_view{symStrings + sym.st_name});
+        }
+    });
+    if (status != StatusCode::ok) return status;
+    auto numLocalSymbols = static_cast<Elf64_Word>(symbols.size());
+
+    std::vector<std::pair<std::string_view, GlobalSymbolTableEntry>> globalSymbols{symbolTable.begin(), symbolTable.end()};
+    if (options.reproducible) {
+        // In the order they were resolved, like the global symbols of an executable. Undefined symbols by their first reference
+        auto resolution = [](GlobalSymbolTableEntry const& entry) { return entry.firstLoad.symbol ? entry.firstLoad : entry.firstSearch; };
+        auto resolvedBefore = [&](SymbolRef const& a, SymbolRef const& b) {
+            if (!a.symbol || !b.symbol) return b.symbol != nullptr && a.symbol == nullptr;
+            if (a.elfID == b.elfID) return a.symbol < b.symbol;
+            return sortKeys[a.elfID] != sortKeys[b.elfID] ? sortKeys[a.elfID] < sortKeys[b.elfID] : a.elfID < b.elfID;
+        };
+        std::sort(globalSymbols.begin(), globalSymbols.end(), [&](auto const& a, auto const& b) {
+            auto aRef = resolution(a.second);
+            auto bRef = resolution(b.second);
+            if (aRef.symbol == bRef.symbol) return a.first < b.first;
+            return resolvedBefore(aRef, bRef);
+        });
+    }
+    std::unordered_map<std::string_view, Elf64_Word> globalSymbolIndices;
+    globalSymbolIndices.reserve(globalSymbols.size());
+    for (auto& [symName, entry] : globalSymbols) {
+        Elf64_Sym sym{};
+        if (entry.firstLoad.symbol) {
+            sym = *entry.firstLoad.symbol;
+            if (sym.st_shndx == SHN_XINDEX) return report(StatusCode::bad_input_file, " symbol points to a section with a too high index");
+        }
+        // Not defined by the inputs, or only in a section that is not in the output: left to the final link
+        if (!entry.firstLoad.symbol || !moveToOutputSection(sym, entry.firstLoad.elfID)) {
+            if (status != StatusCode::ok) return status;
+            auto& reference = entry.firstSearch.symbol ? *entry.firstSearch.symbol : sym;
+            sym = Elf64_Sym{.st_name = 0,
+                            .st_info = static_cast<unsigned char>(ELF64_ST_INFO(ELF64_ST_BIND(reference.st_info) == STB_WEAK ? STB_WEAK : STB_GLOBAL, ELF64_ST_TYPE(reference.st_info))),
+                            .st_other = reference.st_other,
+                            .st_shndx = SHN_UNDEF,
+                            .st_value = 0,
+                            .st_size = 0};
+        }
+        globalSymbolIndices.emplace(symName, pushSymbol(sym, symName));
+    }
+
+    // Relocations
+    // The relocation sections of an output section are collected first, then every output section gets its relocations on its own, in parallel
+
+    Vector2D<SectionRef> relaSectionsOfOutput(numDataSections);
+    for_each_indexed(sectionHeaders, [&](readonly_span<Elf64_Shdr> headers, size_t elfID) {
+        for_each_indexed(headers, [&](Elf64_Shdr const& header, size_t headerID) {
+            if (header.sh_type == SHT_REL) {
+                status = report(StatusCode::bad_input_file, "relocations without addend are not supported");
+                return;
+            }
+            if (header.sh_type != SHT_RELA || header.sh_info >= headers.size()) return;
+            if (sectionStates[elfID][header.sh_info] != InputSectionState::live) return;
+            auto outSectionID = inputToOutputSection[elfID][header.sh_info];
+            if (outSectionID == meta::notAnOutputSection) return;
+            relaSectionsOfOutput[outSectionID].push_back({.elfIndex = elfID, .headerIndex = headerID});
+        });
+    });
+    if (status != StatusCode::ok) return status;
+
+    Vector2D<Elf64_Rela> outputRelas(numDataSections);
+    parallel_for_each_indexed(outputRelas, [&](std::vector<Elf64_Rela>& relasOfOutput, size_t outSectionID) {
+        auto translateRelas = [&](SectionRef relaSecRef) -> StatusCode {
+            auto elfID = relaSecRef.elfIndex;
+            auto& relaHeader = sectionHeaders[elfID][relaSecRef.headerIndex];
+            SectionRef targetRef{elfID, relaHeader.sh_info};
+            auto relas = view_as_span<Elf64_Rela>(elfAddresses[elfID] + relaHeader.sh_offset, relaHeader.sh_size / sizeof(Elf64_Rela));
+            auto& [fileSymbols, symStrings, numLocals] = inputSymbols[elfID];
+
+            for (auto& rela : relas) {
+                auto symIndex = ELF64_R_SYM(rela.r_info);
+                auto type = ELF64_R_TYPE(rela.r_info);
+                // Relocations of removed FDEs go with them
+                if (isInDroppedPiece(inputSectionCopyCommands[elfID][targetRef.headerIndex], rela.r_offset)) continue;
+                Elf64_Rela movedRela{.r_offset = 0, .r_info = 0, .r_addend = rela.r_addend};
+                if (auto offsetStatus = mapToOutput(targetRef, rela.r_offset, movedRela.r_offset); offsetStatus != StatusCode::ok) return offsetStatus;
+                if (symIndex >= fileSymbols.size() && symIndex != STN_UNDEF) return report(StatusCode::bad_input_file, "relocation refers to symbol ", symIndex, " which does not exist");
+
+                Elf64_Word movedSymIndex{STN_UNDEF};
+                if (symIndex == STN_UNDEF) {
+                    // Nothing to move
+                } else if (symIndex < numLocals) {
+                    auto& sym = fileSymbols[symIndex];
+                    movedSymIndex = localSymbolIndices[elfID][symIndex];
+                    // Symbol of a discarded section
+                    if (movedSymIndex == STN_UNDEF) continue;
+                    if (ELF64_ST_TYPE(sym.st_info) == STT_SECTION) {
+                        // A section symbol plus addend may refer to any piece of a merged section, so the addend selects the piece before mapping, like for executables
+                        auto isMerged = std::holds_alternative<std::vector<PartCopy>>(inputSectionCopyCommands[elfID][sym.st_shndx]);
+                        auto symbolOffset = isMerged ? static_cast<size_t>(static_cast<int64_t>(sym.st_value) + rela.r_addend) : size_t{sym.st_value};
+                        size_t outputOffset{};
+                        if (auto symbolStatus = mapToOutput({elfID, sym.st_shndx}, symbolOffset, outputOffset); symbolStatus != StatusCode::ok) return symbolStatus;
+                        movedRela.r_addend = isMerged ? static_cast<int64_t>(outputOffset) : static_cast<int64_t>(outputOffset) + rela.r_addend;
+                    }
+                } else {
+                    std::string_view symName{fileSymbols[symIndex].st_name + symStrings};
+                    auto it = globalSymbolIndices.find(symName);
+                    if (it == globalSymbolIndices.end())
+                        return report(StatusCode::symbol_undefined, symName, " (not even present in symbol table, something went horribly wrong)");
+                    movedSymIndex = it->second;
+                }
+                movedRela.r_info = ELF64_R_INFO(movedSymIndex, type);
+                relasOfOutput.push_back(movedRela);
+            }
+            return StatusCode::ok;
+        };
+        for (auto relaSecRef : relaSectionsOfOutput[outSectionID]) {
+            if (auto relaStatus = translateRelas(relaSecRef); relaStatus != StatusCode::ok) {
+                std::atomic_ref{status}.store(relaStatus);
+                return;
+            }
+        }
+    });
+    if (status != StatusCode::ok) return status;
+
+    // Section Headers
+    // The groups come first, then the output sections with index id + firstDataSectionIndex. The .rela sections, .symtab, .strtab and .shstrtab follow
+
+    std::vector<Elf64_Word> relaSectionIndices(numDataSections, 0);
+    auto numRelaSections = size_t{0};
+    for_each_indexed(outputRelas, [&](std::vector<Elf64_Rela> const& relas, size_t id) {
+        if (!relas.empty()) relaSectionIndices[id] = static_cast<Elf64_Word>(firstDataSectionIndex + numDataSections + numRelaSections++);
+    });
+    auto symTabIndex = firstDataSectionIndex + numDataSections + numRelaSections;
+    if (symTabIndex + 2 >= SHN_LORESERVE)
+        return report(StatusCode::not_ok, "too many output sections: ", symTabIndex + 3);
+
+    // The members of a group are its output sections and their .rela sections, its signature is moved like any other symbol
+    Vector2D<Elf64_Word> groupContents(numGroups);
+    std::vector<Elf64_Word> groupSignatures(numGroups, STN_UNDEF);
+    for_each_indexed(outputGroups, [&](SectionRef groupRef, size_t groupID) {
+        auto elfID = groupRef.elfIndex;
+        auto& header = sectionHeaders[elfID][groupRef.headerIndex];
+        auto words = view_as_span<Elf64_Word>(elfAddresses[elfID] + header.sh_offset, header.sh_size / sizeof(Elf64_Word));
+        auto& contents = groupContents[groupID];
+        contents.push_back(words[0]);
+        for (auto member : words.subspan(1)) {
+            if (member >= sectionHeaders[elfID].size() || inputToOutputSection[elfID][member] == meta::notAnOutputSection) continue;
+            auto outSectionID = inputToOutputSection[elfID][member];
+            contents.push_back(static_cast<Elf64_Word>(outSectionID + firstDataSectionIndex));
+            if (relaSectionIndices[outSectionID] != 0) contents.push_back(relaSectionIndices[outSectionID]);
+        }
+
+        auto& [fileSymbols, symStrings, numLocals] = inputSymbols[elfID];
+        if (header.sh_info >= fileSymbols.size()) return;
+        if (header.sh_info < numLocals) {
+            groupSignatures[groupID] = localSymbolIndices[elfID][header.sh_info];
+        } else if (auto it = globalSymbolIndices.find(std::string_view{symStrings + fileSymbols[header.sh_info].st_name}); it != globalSymbolIndices.end()) {
+            groupSignatures[groupID] = it->second;
+        }
+    });
+    if (auto missing = std::find(groupSignatures.begin(), groupSignatures.end(), STN_UNDEF); missing != groupSignatures.end())
+        return report(StatusCode::bad_input_file, "the signature of group #", outputGroups[static_cast<size_t>(missing - groupSignatures.begin())].headerIndex,
+                      " in object file #", outputGroups[static_cast<size_t>(missing - groupSignatures.begin())].elfIndex, " is not in the output");
+
+    std::vector<char> sectionNameStrings{'\0'};
+    auto pushSectionName = [&](std::string_view prefix, std::string_view name) -> Elf64_Word {
+        auto sh_name = static_cast<Elf64_Word>(sectionNameStrings.size());
+        sectionNameStrings.insert(sectionNameStrings.end(), prefix.begin(), prefix.end());
+        sectionNameStrings.insert(sectionNameStrings.end(), name.begin(), name.end());
+        sectionNameStrings.push_back('\0');
+        return sh_name;
+    };
+
+    outputSectionHeaders.assign(1, Elf64_Shdr{});
+    outputSectionHeaders.reserve(symTabIndex + 3);
+    for_each_indexed(outputGroups, [&](SectionRef groupRef, size_t groupID) {
+        auto& groupHeader = sectionHeaders[groupRef.elfIndex][groupRef.headerIndex];
+        outputSectionHeaders.push_back({.sh_name = pushSectionName("", std::string_view{sectionStringTables[groupRef.elfIndex] + groupHeader.sh_name}),
+                                        .sh_type = SHT_GROUP,
+                                        .sh_flags = 0,
+                                        .sh_addr = 0,
+                                        .sh_offset = 0,
+                                        .sh_size = groupContents[groupID].size() * sizeof(Elf64_Word),
+                                        .sh_link = static_cast<Elf64_Word>(symTabIndex),
+                                        .sh_info = groupSignatures[groupID],
+                                        .sh_addralign = alignof(Elf64_Word),
+                                        .sh_entsize = sizeof(Elf64_Word)});
+    });
+    for_each_indexed(names, [&](std::string_view name, size_t id) {
+        outputSectionHeaders.push_back({.sh_name = pushSectionName("", name),
+                                        .sh_type = outputSectionTypes[id],
+                                        .sh_flags = flags[id],
+                                        .sh_addr = 0,
+                                        .sh_offset = 0,
+                                        .sh_size = outputSectionSizes[id],
+                                        .sh_link = 0,
+                                        .sh_info = 0,
+                                        .sh_addralign = std::max(alignments[id], Elf64_Xword{1}),
+                                        .sh_entsize = 0});
+    });
+    // The arrays of the output sections follow the order of the headers, the groups are put in front of the output sections
+    auto prependGroups = [&](auto& perOutputSection, auto&& valueOfGroup) {
+        for (size_t groupID = numGroups; groupID-- > 0;)
+            perOutputSection.insert(perOutputSection.begin(), valueOfGroup(groupID));
+    };
+    prependGroups(outputToInputSections, [](size_t) { return std::vector<SectionRef>{/*no source sections*/}; });
+    prependGroups(outputSectionTypes, [](size_t) { return Elf64_Word{SHT_GROUP}; });
+    prependGroups(outputSectionSizes, [&](size_t groupID) { return groupContents[groupID].size() * sizeof(Elf64_Word); });
+    prependGroups(materializedViews, [&](size_t groupID) { return materialize(materializedSectionMemory, groupContents[groupID]); });
+    for (auto& outSectionIDs : inputToOutputSection) {
+        for (auto& outSectionID : outSectionIDs)
+            if (outSectionID != meta::notAnOutputSection) outSectionID = static_cast<OutSectionID>(outSectionID + numGroups);
+    }
+    // Sections that are not copied from the inputs
+    auto pushSyntheticSection = [&](Elf64_Shdr header, std::byte* view) {
+        outputSectionHeaders.push_back(header);
+        outputToInputSections.emplace_back(/*no source sections*/);
+        outputSectionTypes.push_back(header.sh_type);
+        outputSectionSizes.push_back(header.sh_size);
+        materializedViews.push_back(view);
+    };
+    for_each_indexed(outputRelas, [&](std::vector<Elf64_Rela> const& relas, size_t id) {
+        if (relas.empty()) return;
+        pushSyntheticSection({.sh_name = pushSectionName(".rela", names[id]),
+                              .sh_type = SHT_RELA,
+                              .sh_flags = SHF_INFO_LINK | (flags[id] & SHF_GROUP),
+                              .sh_addr = 0,
+                              .sh_offset = 0,
+                              .sh_size = relas.size() * sizeof(Elf64_Rela),
+                              .sh_link = static_cast<Elf64_Word>(symTabIndex),
+                              .sh_info = static_cast<Elf64_Word>(id + firstDataSectionIndex),
+                              .sh_addralign = alignof(Elf64_Rela),
+                              .sh_entsize = sizeof(Elf64_Rela)},
+                             materialize(materializedSectionMemory, relas));
+    });
+    pushSyntheticSection({.sh_name = pushSectionName("", ".symtab"),
+                          .sh_type = SHT_SYMTAB,
+                          .sh_flags = 0,
+                          .sh_addr = 0,
+                          .sh_offset = 0,
+                          .sh_size = symbols.size() * sizeof(Elf64_Sym),
+                          .sh_link = static_cast<Elf64_Word>(symTabIndex + 1),
+                          .sh_info = numLocalSymbols,
+                          .sh_addralign = alignof(Elf64_Sym),
+                          .sh_entsize = sizeof(Elf64_Sym)},
+                         materialize(materializedSectionMemory, symbols));
+    pushSyntheticSection({.sh_name = pushSectionName("", ".strtab"),
+                          .sh_type = SHT_STRTAB,
+                          .sh_flags = 0,
+                          .sh_addr = 0,
+                          .sh_offset = 0,
+                          .sh_size = symbolStrings.size(),
+                          .sh_link = 0,
+                          .sh_info = 0,
+                          .sh_addralign = alignof(char),
+                          .sh_entsize = 0},
+                         materialize(materializedSectionMemory, symbolStrings));
+    // Its own name has to be in it before it's copied
+    auto shstrtabName = pushSectionName("", ".shstrtab");
+    pushSyntheticSection({.sh_name = shstrtabName,
+                          .sh_type = SHT_STRTAB,
+                          .sh_flags = 0,
+                          .sh_addr = 0,
+                          .sh_offset = 0,
+                          .sh_size = sectionNameStrings.size(),
+                          .sh_link = 0,
+                          .sh_info = 0,
+                          .sh_addralign = alignof(char),
+                          .sh_entsize = 0},
+                         materialize(materializedSectionMemory, sectionNameStrings));
+
+    // File Layout
+    // The sections follow the elf header in order, nothing is loaded so there are no segments to pad for
+
+    auto numOutputSections = outputSectionSizes.size();
+    outputSectionFileOffsets.assign(numOutputSections, 0);
+    size_t fileOffset{sizeof(Elf64_Ehdr)};
+    for (size_t id{0}; id < numOutputSections; ++id) {
+        auto& header = outputSectionHeaders[id + 1];
+        fileOffset = alignup(fileOffset, header.sh_addralign);
+        header.sh_offset = fileOffset;
+        outputSectionFileOffsets[id] = fileOffset;
+        if (header.sh_type != SHT_NOBITS) fileOffset += header.sh_size;
+    }
+
+    programHeaders.clear();
+    outputSectionAddresses.assign(numOutputSections, 0);
+    gotAddress = 0;
+    processedRelas.assign(numOutputSections, {});
+
+    elfHeader = Elf64_Ehdr{
+        .e_ident = {0x7f, 'E', 'L', 'F', ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_NONE},
+        .e_type = ET_REL,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_entry = 0,
+        .e_phoff = 0,
+        .e_shoff = alignup(fileOffset, alignof(Elf64_Shdr)),
+        .e_flags = 0,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_phentsize = 0,
+        .e_phnum = 0,
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = static_cast<Elf64_Half>(outputSectionHeaders.size()),
+        .e_shstrndx = static_cast<Elf64_Half>(outputSectionHeaders.size() - 1),
+    };
+
+    if (options.printStatistics)
+        inform("relocatable output with ", numDataSections, " sections, ", symbols.size(), " symbols and ", numRelaSections, " relocation sections");
+    return StatusCode::ok;
+}
+
+} // namespace cppld
@@ -0,0 +1,58 @@
+#pragma once
+#include "cppld.hpp"
+#include "cppld_internal_types.hpp"
+
+#include <memory_resource>
+
+namespace cppld {
+
+namespace parametersFor {
+struct MapInputSectionsToRelocatableOutput;
+} // namespace parametersFor
+
+/**
+ * @brief The counterpart of mapInputSectionsToOutputSections() for -r, the inputs become one relocatable object instead of an executable
+ *
+ * Input sections are mapped to output sections and merged like for an executable, but nothing gets an address.
+ * Sections keep their input names, only sections with the same name are concatenated. Every member of a group keeps a section of its own.
+ * Groups that won (and groups that aren't COMDAT) are copied to the output, with their members moved to the output sections and their .rela sections,
+ * so the final link still drops duplicates between several relocatable outputs. The groups come first in the section header table.
+ * After merging, the output sections lose SHF_MERGE and SHF_STRINGS, the final link only has to concatenate them.
+ * The symbol table has a section symbol per output section, the local symbols of every input and the global symbols of the symbol table.
+ * Global symbols that are not defined by any input stay undefined.
+ * Every output section with relocations gets a .rela section, the relocations are moved along with their sections and refer to the new symbol table.
+ * Relocations against section symbols refer to the section symbol of the output section, the addend is moved along with the section.
+ * Relocations against discarded sections (e.g. of COMDAT groups that lost) are dropped, they resolve to zero in the final link either way.
+ * The results have the shape of those of mapInputSectionsToOutputSections(), so writeLinkingResultsToFile() writes them:
+ * no program headers, all addresses zero and no relocations to apply
+ */
+auto mapInputSectionsToRelocatableOutput(parametersFor::MapInputSectionsToRelocatableOutput) -> StatusCode;
+struct parametersFor::MapInputSectionsToRelocatableOutput {
+    struct {
+        readonly_span<std::byte*> elfAddresses;
+        readonly_span<SortKey> sortKeys;
+        readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
+        readonly_span<const char*> sectionStringTables;
+        in<SymbolTable> symbolTable;
+        in<Vector2D<InputSectionState>> sectionStates;
+        in<LinkerOptions> options;
+    } in;
+    struct {
+        out<std::pmr::memory_resource> materializedSectionMemory;
+        out<std::vector<Elf64_Shdr>> outputSectionHeaders;
+        out<Elf64_Ehdr> elfHeader;
+        out<Vector2D<SectionRef>> outputToInputSections;
+        out<Vector2D<OutSectionID>> inputToOutputSection;
+        out<std::vector<Elf64_Word>> outputSectionTypes;
+        out<std::vector<size_t>> outputSectionSizes;
+        out<Vector2D<SectionMemCopies>> inputSectionCopyCommands;
+        out<std::vector<std::byte*>> materializedViews;
+        out<std::vector<Elf64_Phdr>> programHeaders;
+        out<std::vector<size_t>> outputSectionAddresses;
+        out<std::vector<size_t>> outputSectionFileOffsets;
+        out<size_t> gotAddress;
+        out<Vector2D<ProcessedRela>> processedRelas;
+    } out;
+};
+
+} // namespace cppld
@@ -0,0 +1,150 @@
+#include "splitSectionIntoPieces.hpp"
+#include "statusreport.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace cppld {
+
+namespace /*internal*/ {
+
+// The primes of xxh64
+constexpr uint64_t hashPrime1{0x9e3779b185ebca87ull};
+constexpr uint64_t hashPrime2{0xc2b2ae3d27d4eb4full};
+constexpr uint64_t hashPrime3{0x165667b19e3779f9ull};
+constexpr uint64_t hashPrime4{0x85ebca77c2b2ae63ull};
+constexpr uint64_t hashPrime5{0x27d4eb2f165667c5ull};
+
+// Avalanche, so the upper bits are usable as well (they pick the shard during merging)
+constexpr uint64_t finalizeHash(uint64_t h) {
+    h ^= h >> 33u;
+    h *= hashPrime2;
+    h ^= h >> 29u;
+    h *= hashPrime3;
+    h ^= h >> 32u;
+    return h;
+}
+
+// The step xxh64 takes for every 8 bytes of short inputs, the state stays 64 bits wide all the way
+constexpr uint64_t mixWord(uint64_t h, uint64_t word) {
+    h ^= std::rotl(word * hashPrime2, 31) * hashPrime1;
+    return std::rotl(h, 27) * hashPrime1 + hashPrime4;
+}
+
+// Null terminators in a block of blockSize bytes as a bit mask
+#if defined(__AVX2__)
+constexpr size_t blockSize{32};
+inline uint32_t nullTerminatorMask(const char* block) {
+    auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    auto zeros = _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256());
+    return static_cast<uint32_t>(_mm256_movemask_epi8(zeros));
+}
+#elif defined(__SSE2__)
+constexpr size_t blockSize{16};
+inline uint32_t nullTerminatorMask(const char* block) {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    auto zeros = _mm_cmpeq_epi8(bytes, _mm_setzero_si128());
+    return static_cast<uint32_t>(_mm_movemask_epi8(zeros));
+}
+#else
+constexpr size_t blockSize{8};
+inline uint32_t nullTerminatorMask(const char* block) {
+    uint32_t mask{0};
+    for (size_t i = 0; i < blockSize; ++i)
+        mask |= static_cast<uint32_t>(block[i] == '\0') << i;
+    return mask;
+}
+#endif
+
+} // namespace
+
+auto hashPiece(readonly_span<char> piece) -> uint64_t {
+    uint64_t h{hashPrime5 + piece.size()};
+    auto data = piece.data();
+    auto remaining = piece.size();
+    for (; remaining >= sizeof(uint64_t); remaining -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        h = mixWord(h, word);
+    }
+    if (remaining) {
+        uint64_t word{0};
+        std::memcpy(&word, data, remaining);
+        h = mixWord(h, word);
+    }
+    return finalizeHash(h);
+}
+
+auto splitSectionIntoPieces(parametersFor::SplitSectionIntoPieces p) -> StatusCode {
+    auto& [sectionData, entrySize, mergeType] = p.in;
+    auto& [pieces] = p.out;
+    auto& [offsets, hashes] = pieces;
+
+    offsets.clear();
+    hashes.clear();
+    if (sectionData.size() > std::numeric_limits<uint32_t>::max())
+        return report(StatusCode::not_ok, "mergeable section larger than 4 GiB");
+
+    auto size = sectionData.size();
+    auto data = sectionData.data();
+    auto emitPiece = [&](size_t start, size_t end) {
+        offsets.push_back(static_cast<uint32_t>(start));
+        hashes.push_back(hashPiece(sectionData.subspan(start, end - start)));
+    };
+    auto finish = [&](size_t end) {
+        offsets.push_back(static_cast<uint32_t>(end));
+        if (end != size) return report(StatusCode::not_ok, "section merger encountered out of bounds element");
+        return StatusCode::ok;
+    };
+
+    if (mergeType == MergeType::fixedLength) {
+        if (entrySize == 0) return report(StatusCode::bad_input_file, "mergeable section with an entry size of zero");
+        offsets.reserve(size / entrySize + 1);
+        hashes.reserve(size / entrySize);
+        size_t start{0};
+        for (; start + entrySize <= size; start += entrySize) {
+            emitPiece(start, start + entrySize);
+        }
+        return finish(start);
+    }
+
+    // Strings of wider characters end with a null character of entrySize bytes that is aligned to entrySize
+    if (entrySize > 1) {
+        size_t start{0};
+        for (size_t pos{0}; pos + entrySize <= size; pos += entrySize) {
+            if (std::all_of(data + pos, data + pos + entrySize, [](char c) { return c == '\0'; })) {
+                emitPiece(start, pos + entrySize);
+                start = pos + entrySize;
+            }
+        }
+        return finish(start);
+    }
+
+    // Guess the number of strings, most of them are short
+    offsets.reserve(size / 16 + 1);
+    hashes.reserve(size / 16);
+
+    size_t start{0};
+    size_t pos{0};
+    for (; pos + blockSize <= size; pos += blockSize) {
+        for (auto mask = nullTerminatorMask(data + pos); mask; mask &= mask - 1) {
+            auto end = pos + static_cast<size_t>(std::countr_zero(mask)) + 1;
+            emitPiece(start, end);
+            start = end;
+        }
+    }
+    for (; pos < size; ++pos) {
+        if (data[pos] != '\0') continue;
+        emitPiece(start, pos + 1);
+        start = pos + 1;
+    }
+    return finish(start);
+}
+
+} // namespace cppld
@@ -0,0 +1,53 @@
+#pragma once
+#include "cppld_api_types.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace cppld {
+
+namespace parametersFor {
+struct SplitSectionIntoPieces;
+} // namespace parametersFor
+
+// SHF_MERGE sections either consist of fixed size entries or of null terminated strings (SHF_STRINGS)
+enum class MergeType {
+    fixedLength,
+    variableLength
+};
+
+/**
+ * @brief Compact description of the pieces of a mergeable section
+ * Piece i covers the bytes [offsets[i], offsets[i+1]), so there is always one more offset than there are pieces
+ * 32 Bit offsets are enough since sections larger than 4 GiB are rejected
+ */
+struct SectionPieces {
+    std::vector<uint32_t> offsets;
+    std::vector<uint64_t> hashes;
+};
+
+/**
+ * @brief Splits the content of a mergeable section into its elements and hashes them in the same pass
+ *
+ * Null terminators are searched block wise with SIMD compares (AVX2 or SSE2, scalar otherwise)
+ * and every piece is hashed right after its end was found, while it is still in the cache.
+ * The hash only depends on the bytes of a piece, so equal pieces from different sections get equal hashes
+ */
+auto splitSectionIntoPieces(parametersFor::SplitSectionIntoPieces) -> StatusCode;
+struct parametersFor::SplitSectionIntoPieces {
+    struct {
+        readonly_span<char> sectionData;
+        uint64_t entrySize;
+        MergeType mergeType;
+    } in;
+    struct {
+        out<SectionPieces> pieces;
+    } out;
+};
+
+/**
+ * @brief The hash function used for section pieces
+ * xxh64 over the 8 byte words of the piece, the last one zero padded, seeded with the length
+ */
+auto hashPiece(readonly_span<char> piece) -> uint64_t;
+
+} // namespace cppld
@@ -4,6 +4,12 @@
 #include <mutex>
 namespace cppld {
 
+// Output from several threads should not get mixed up
+inline auto ioMutex() -> std::mutex& {
+    static std::mutex mutex{};
+    return mutex;
+}
+
 template <typename... TArgs>
 auto report(StatusCode status, TArgs&&... to_print) -> StatusCode {
     auto statusToErrorString = [](StatusCode s) {
@@ -18,12 +24,19 @@ auto report(StatusCode status, TArgs&&... to_print) -> StatusCode {
         }
     };
 
-    static std::mutex ioMutex{};
-    std::unique_lock ioLock{ioMutex};
+    std::unique_lock ioLock{ioMutex()};
 
     std::cerr << "[Error] " << statusToErrorString(status) << ": ";
     (std::cerr << ... << to_print) << '\n';
     return status;
 }
 
+// For things that are not an error but still good to know, e.g. statistics
+template <typename... TArgs>
+auto inform(TArgs&&... to_print) -> void {
+    std::unique_lock ioLock{ioMutex()};
+    std::cerr << "[Info] ";
+    (std::cerr << ... << to_print) << '\n';
+}
+
 } // namespace cppld
\ No newline at end of file
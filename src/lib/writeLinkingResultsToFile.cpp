@@ -9,27 +9,11 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <utility>
 
 namespace cppld {
 
-namespace /*internal*/ {
-
-struct PrepareRelaWrite {
-    struct {
-        in<ProcessedRela> rela;
-        size_t gotAddress;
-        readonly_span<size_t> outputSectionAddresses;
-        size_t outputAddress;
-        off_t fileOffset;
-    } in;
-
-    struct {
-        out<size_t> relaValue;
-        out<size_t> relaValueSize;
-        out<off_t> filePos;
-    } out;
-};
-auto prepareRelaWrite(PrepareRelaWrite p) -> StatusCode {
+auto prepareRelaWrite(parametersFor::PrepareRelaWrite p) -> StatusCode {
     auto& [rela, gotAddress, outputSectionAddresses, outputAddress, fileOffset] = p.in;
     auto& [relaValue, relaValueSize, filePos] = p.out;
 
@@ -172,14 +156,103 @@ auto prepareRelaWrite(PrepareRelaWrite p) -> StatusCode {
 
     return StatusCode::ok;
 }
-} // namespace
 
 auto writeLinkingResultsToFile(parametersFor::WriteLinkingResultsToFile p) -> StatusCode {
-    auto& [elfAddresses, sectionHeaders, outputFileName, elfHeader, programHeaders,
+    auto& [elfAddresses, sectionHeaders, target, elfHeader, programHeaders,
            outputSectionHeaders, outputToInputSections, materializedViews,
            outputSectionAddresses, outputSectionFileOffsets, outputSectionSizes,
            outputSectionTypes, inputSectionCopyCommands, gotAddress, processedRelas] = p.in;
-    auto _outputFileNameString = std::string(outputFileName);
+    auto& [outputSize, memoryFileDescriptor] = p.out;
+
+    auto fileSize = (elfHeader.e_shoff + outputSectionHeaders.size() * sizeof(Elf64_Shdr));
+    outputSize = fileSize;
+    memoryFileDescriptor = -1;
+
+    auto writeOutput = [&](std::byte* destination) -> StatusCode {
+        StatusCode status{StatusCode::ok};
+
+        // memcpy is faster than a bunch of system calls
+        // it might not be the most ideal method to write something to a file,
+        // but it is close enough to lld that it doesn't matter 
+        std::memcpy(destination, &elfHeader, sizeof(Elf64_Ehdr));
+        // Relocatable output has no program headers
+        if (!programHeaders.empty())
+            std::memcpy(destination + sizeof(Elf64_Ehdr), programHeaders.data(), programHeaders.size() * sizeof(Elf64_Phdr));
+
+        parallel_for_each_indexed(materializedViews, [&](std::byte* mem, size_t outSecID) {
+            if (outputSectionTypes[outSecID] == SHT_NOBITS) return;
+
+            auto& relas = processedRelas[outSecID];
+            auto outputAddress = outputSectionAddresses[outSecID];
+            auto fileOffset = static_cast<off_t>(outputSectionFileOffsets[outSecID]);
+            auto sectionSize = outputSectionSizes[outSecID];
+
+            if (mem) {
+                std::memcpy(destination + fileOffset, mem, sectionSize);
+            } else {
+                for (auto secRef : outputToInputSections[outSecID]) {
+                    auto& section = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
+                    auto sectionAddress = elfAddresses[secRef.elfIndex] + section.sh_offset;
+
+                    auto& copyCmds = inputSectionCopyCommands[secRef.elfIndex][secRef.headerIndex];
+                    auto performCopy = overloaded{
+                        [&](std::vector<PartCopy> const& copyCmdVec) {
+                            size_t inSectionOffset{0};
+                            for (auto& cmd : copyCmdVec) {
+                                if (cmd.dstOffset != droppedPieceOffset)
+                                    std::memcpy(destination + fileOffset + cmd.dstOffset, sectionAddress + inSectionOffset, cmd.size);
+                                inSectionOffset += cmd.size;
+                            }
+                        },
+                        [&](PartCopy const& cmd) {
+                            std::memcpy(destination + fileOffset + cmd.dstOffset, sectionAddress, cmd.size);
+                        },
+                        [](auto&&) {
+                            //std::unreachable();
+                        }};
+                    std::visit(performCopy, copyCmds);
+                }
+            }
+
+            for_each_indexed(relas, [&](ProcessedRela const& rela, size_t) {
+                size_t relaValue{};
+                size_t relaValueSize{};
+                off_t relaFilePos{};
+                auto relaStatus = prepareRelaWrite({.in{rela,
+                                                        gotAddress,
+                                                        outputSectionAddresses,
+                                                        outputAddress,
+                                                        fileOffset},
+                                                    .out{relaValue,
+                                                         relaValueSize,
+                                                         relaFilePos}});
+                if (relaStatus != StatusCode::ok) {
+                    std::atomic_ref{status}.store(relaStatus);
+                    return;
+                }
+
+                if (relaValueSize) {
+                    std::memcpy(destination + relaFilePos, &relaValue, relaValueSize);
+                }
+            });
+        });
+
+        if (status != StatusCode::ok) return status;
+
+        std::memcpy(destination + elfHeader.e_shoff, outputSectionHeaders.data(), outputSectionHeaders.size() * sizeof(Elf64_Shdr));
+
+        return status;
+    };
+
+    if (target.kind == OutputTarget::Kind::buffer) {
+        if (target.buffer.size() < fileSize)
+            return report(StatusCode::not_ok, "the output buffer holds ", target.buffer.size(), " bytes, but the executable needs ", fileSize);
+        // A new file is all zeros, the padding between the sections in the buffer has to be, too
+        std::memset(target.buffer.data(), 0, fileSize);
+        return writeOutput(target.buffer.data());
+    }
+
+    auto _outputFileNameString = std::string(target.fileName);
     auto _outputFileCstring = _outputFileNameString.c_str();
 
     constexpr auto filePermissions = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH;
@@ -192,13 +265,13 @@ auto writeLinkingResultsToFile(parametersFor::WriteLinkingResultsToFile p) -> St
             }
         }
         // Set file permissions to make it immediately executable after the linker has run
-    } outFD{::open(_outputFileCstring, O_CREAT | O_RDWR | O_TRUNC, filePermissions)};
+    } outFD{target.kind == OutputTarget::Kind::memoryFile ? ::memfd_create(_outputFileCstring, MFD_CLOEXEC)
+                                                          : ::open(_outputFileCstring, O_CREAT | O_RDWR | O_TRUNC, filePermissions)};
     if (outFD == -1) {
-        return report(StatusCode::system_failure, "Could not open file \"", outputFileName, "\2 to write output");
+        return report(StatusCode::system_failure, "Could not open file \"", target.fileName, "\" to write output");
     }
-    auto fileSize = (elfHeader.e_shoff + outputSectionHeaders.size() * sizeof(Elf64_Shdr));
     if (::ftruncate(outFD, static_cast<off_t>(fileSize)) == -1) {
-        return report(StatusCode::system_failure, "Could not resize file \"", outputFileName, "\" to expected size: ", fileSize);
+        return report(StatusCode::system_failure, "Could not resize file \"", target.fileName, "\" to expected size: ", fileSize);
     }
 
     struct UnMapOnExit {
@@ -213,75 +286,10 @@ auto writeLinkingResultsToFile(parametersFor::WriteLinkingResultsToFile p) -> St
     } destination{static_cast<std::byte*>(::mmap(nullptr, fileSize, PROT_WRITE, MAP_SHARED, outFD, 0)), fileSize};
     if (!destination)
         return report(StatusCode::system_failure, "Could not map file to write output");
-    StatusCode status{StatusCode::ok};
-
-    // memcpy is faster than a bunch of system calls
-    // it might not be the most ideal method to write something to a file,
-    // but it is close enough to lld that it doesn't matter 
-    std::memcpy(destination, &elfHeader, sizeof(Elf64_Ehdr));
-    std::memcpy(destination + sizeof(Elf64_Ehdr), programHeaders.data(), programHeaders.size() * sizeof(Elf64_Phdr));
-
-    parallel_for_each_indexed(materializedViews, [&](std::byte* mem, size_t outSecID) {
-        if (outputSectionTypes[outSecID] == SHT_NOBITS) return;
-
-        auto& relas = processedRelas[outSecID];
-        auto outputAddress = outputSectionAddresses[outSecID];
-        auto fileOffset = static_cast<off_t>(outputSectionFileOffsets[outSecID]);
-        auto sectionSize = outputSectionSizes[outSecID];
-
-        if (mem) {
-            std::memcpy(destination + fileOffset, mem, sectionSize);
-        } else {
-            for (auto secRef : outputToInputSections[outSecID]) {
-                auto& section = sectionHeaders[secRef.elfIndex][secRef.headerIndex];
-                auto sectionAddress = elfAddresses[secRef.elfIndex] + section.sh_offset;
-
-                auto& copyCmds = inputSectionCopyCommands[secRef.elfIndex][secRef.headerIndex];
-                auto performCopy = overloaded{
-                    [&](std::vector<PartCopy> const& copyCmdVec) {
-                        size_t inSectionOffset{0};
-                        for (auto& cmd : copyCmdVec) {
-                            std::memcpy(destination + fileOffset + cmd.dstOffset, sectionAddress + inSectionOffset, cmd.size);
-                            inSectionOffset += cmd.size;
-                        }
-                    },
-                    [&](PartCopy const& cmd) {
-                        std::memcpy(destination + fileOffset + cmd.dstOffset, sectionAddress, cmd.size);
-                    },
-                    [](auto&&) {
-                        //std::unreachable();
-                    }};
-                std::visit(performCopy, copyCmds);
-            }
-        }
-
-        for_each_indexed(relas, [&](ProcessedRela const& rela, size_t) {
-            size_t relaValue{};
-            size_t relaValueSize{};
-            off_t relaFilePos{};
-            auto relaStatus = prepareRelaWrite({.in{rela,
-                                                    gotAddress,
-                                                    outputSectionAddresses,
-                                                    outputAddress,
-                                                    fileOffset},
-                                                .out{relaValue,
-                                                     relaValueSize,
-                                                     relaFilePos}});
-            if (relaStatus != StatusCode::ok) {
-                std::atomic_ref{status}.store(relaStatus);
-                return;
-            }
-
-            if (relaValueSize) {
-                std::memcpy(destination + relaFilePos, &relaValue, relaValueSize);
-            }
-        });
-    });
-
-    if (status != StatusCode::ok) return status;
-
-    std::memcpy(destination + elfHeader.e_shoff, outputSectionHeaders.data(), outputSectionHeaders.size() * sizeof(Elf64_Shdr));
 
+    auto status = writeOutput(destination);
+    if (status == StatusCode::ok && target.kind == OutputTarget::Kind::memoryFile)
+        memoryFileDescriptor = std::exchange(outFD.fd, -1);
     return status;
 }
 } // namespace cppld
\ No newline at end of file
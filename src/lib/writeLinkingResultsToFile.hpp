@@ -1,22 +1,25 @@
 #pragma once
+#include "cppld.hpp"
 #include "cppld_internal_types.hpp"
 
 namespace cppld {
 namespace parametersFor {
 struct WriteLinkingResultsToFile;
+struct PrepareRelaWrite;
 } // namespace parametersFor
 
 /**
  * @brief This function manifests the linking results to a file in a platform specific way
  * 
- * 
+ * Files and memory files are resized to the output size and mapped, buffers are written to directly.
+ * The output size is known before anything is written, a buffer that is too small is left untouched
  */
 auto writeLinkingResultsToFile(parametersFor::WriteLinkingResultsToFile) -> StatusCode;
 struct parametersFor::WriteLinkingResultsToFile {
     struct {
         readonly_span<std::byte*> elfAddresses;
         readonly_span<readonly_span<Elf64_Shdr>> sectionHeaders;
-        std::string_view outputFileName;
+        in<OutputTarget> target;
         in<Elf64_Ehdr> elfHeader;
         in<std::vector<Elf64_Phdr>> programHeaders;
         readonly_span<Elf64_Shdr> outputSectionHeaders;
@@ -30,5 +33,30 @@ struct parametersFor::WriteLinkingResultsToFile {
         size_t gotAddress;
         in<Vector2D<ProcessedRela>> processedRelas;
     } in;
+    struct {
+        out<size_t> outputSize;
+        out<int> memoryFileDescriptor;
+    } out;
+};
+
+/**
+ * @brief Calculates the value of a relocation and where in the file it goes
+ * A relaValueSize of 0 means there is nothing to write
+ */
+auto prepareRelaWrite(parametersFor::PrepareRelaWrite) -> StatusCode;
+struct parametersFor::PrepareRelaWrite {
+    struct {
+        in<ProcessedRela> rela;
+        size_t gotAddress;
+        readonly_span<size_t> outputSectionAddresses;
+        size_t outputAddress;
+        off_t fileOffset;
+    } in;
+
+    struct {
+        out<size_t> relaValue;
+        out<size_t> relaValueSize;
+        out<off_t> filePos;
+    } out;
 };
 } // namespace cppld
\ No newline at end of file
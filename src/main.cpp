@@ -6,6 +6,7 @@ int main(int argc, char** argv) {
 
     cppld::LinkerOptions linkerOptions;
     cppld::MemoryMappings filemappings;
+    cppld::MemoryMappings extraFileMappings;
     {
         std::vector<std::string_view> inputFilePaths;
         std::pmr::monotonic_buffer_resource libraryFilePathStringMemory{std::pmr::get_default_resource()};
@@ -16,11 +17,45 @@ int main(int argc, char** argv) {
             return -1;
         }
 
+        if (!linkerOptions.serverSocket.empty()) {
+            cppld::runLinkServer({.in{linkerOptions.serverSocket}});
+            std::cerr << "Link Server Failed\n";
+            return -1;
+        }
+        if (!linkerOptions.connectSocket.empty()) {
+            cppld::StatusCode linkStatus{cppld::StatusCode::ok};
+            status = cppld::forwardToLinkServer({.in{linkerOptions.connectSocket, {argv + 1, argv + argc}}, .out{linkStatus}});
+            if (status != cppld::StatusCode::ok || linkStatus != cppld::StatusCode::ok) {
+                std::cerr << "Linking Failed\n";
+                return -1;
+            }
+            return 0;
+        }
+
         status = cppld::filePathsToMemoryMappings({.in{inputFilePaths}, .out{filemappings}});
         if (status != cppld::StatusCode::ok) {
             std::cerr << "Loading Input Files Failed\n";
             return -1;
         }
+
+        std::vector<std::string_view> extraFilePaths;
+        for (auto& spec : linkerOptions.outputSpecs)
+            extraFilePaths.insert(extraFilePaths.end(), spec.extraFilePaths.begin(), spec.extraFilePaths.end());
+        status = cppld::filePathsToMemoryMappings({.in{extraFilePaths}, .out{extraFileMappings}});
+        if (status != cppld::StatusCode::ok) {
+            std::cerr << "Loading Input Files Failed\n";
+            return -1;
+        }
+    }
+
+    if (!linkerOptions.outputSpecs.empty()) {
+        status = cppld::linkSourcesToExecutableElfFiles({.in{filemappings.addresses, filemappings.memSizes,
+                                                             extraFileMappings.addresses, extraFileMappings.memSizes, linkerOptions}});
+        if (status != cppld::StatusCode::ok) {
+            std::cerr << "Linking Failed\n";
+            return -1;
+        }
+        return 0;
     }
 
     status = cppld::linkSourcesToExecutableElfFile({.in{filemappings.addresses, filemappings.memSizes, linkerOptions}});
@@ -1,10 +1,16 @@
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <gtest/gtest.h>
 
+#include "cppld.hpp"
+#include "splitSectionIntoPieces.hpp"
+
+#include <unistd.h>
+
 
 TEST(Simple, Reject_EH_Frame_Hdr) {
     std::ignore = std::system("echo '.global _start; .section .text; _start: call exit' | as -o a.o");
@@ -112,4 +118,500 @@ TEST(Unit, FixedSize_Merge) {
     ASSERT_EQ(std::system("[ $(strings a.out | grep 'DDD' | wc -l) = 1 ]"), 0);
     ASSERT_EQ(std::system("[ $(strings a.out | grep 'EEEE' | wc -l) = 1 ]"), 0);
     ASSERT_EQ(std::system("[ $(strings a.out | grep 'FFF' | wc -l) = 1 ]"), 0);
-}
\ No newline at end of file
+}
+TEST(Unit, String_Merge_Large) {
+    for (size_t n = 0; n < 2; n++) {
+        std::ofstream asmFile("large_strings_" + std::to_string(n) + ".s", std::ios::trunc | std::ios::binary);
+        if (n == 0)
+            asmFile << ".global _start; .section .text; _start: mov $60,%eax; syscall;\n";
+        asmFile << ".section .rodata.str1.1,\"aMS\",@progbits,1\n";
+        // Half of the strings are shared between both files
+        for (size_t i = n * 5000; i < n * 5000 + 10000; ++i) {
+            asmFile << ".string \"merge piece number " << i << "\"\n";
+        }
+    }
+    ASSERT_EQ(std::system("as -o large_strings_0.o large_strings_0.s && as -o large_strings_1.o large_strings_1.s"), 0);
+    ASSERT_EQ(std::system("./../src/ld large_strings_0.o large_strings_1.o -o large_strings_a.out"), 0);
+    ASSERT_EQ(std::system("[ $(strings large_strings_a.out | grep 'merge piece number' | wc -l) = 15000 ]"), 0);
+    // The layout must not depend on how the threads were scheduled
+    ASSERT_EQ(std::system("./../src/ld large_strings_0.o large_strings_1.o -o large_strings_b.out"), 0);
+    ASSERT_EQ(std::system("cmp large_strings_a.out large_strings_b.out"), 0);
+}
+
+TEST(Unit, SplitSectionIntoPieces) {
+    // Strings of every length around the block sizes, so terminators land everywhere inside and across blocks
+    std::string data;
+    std::vector<uint32_t> expectedOffsets;
+    for (size_t length = 0; length < 70; ++length) {
+        expectedOffsets.push_back(static_cast<uint32_t>(data.size()));
+        data.append(length, static_cast<char>('a' + length % 26));
+        data.push_back('\0');
+    }
+    expectedOffsets.push_back(static_cast<uint32_t>(data.size()));
+    data += data; // every piece appears twice
+    for (size_t i = 1; i < 71; ++i)
+        expectedOffsets.push_back(static_cast<uint32_t>(data.size() / 2 + expectedOffsets[i]));
+
+    cppld::SectionPieces pieces;
+    ASSERT_EQ(cppld::splitSectionIntoPieces({.in{{data.data(), data.size()}, 1, cppld::MergeType::variableLength},
+                                             .out{pieces}}),
+              cppld::StatusCode::ok);
+    ASSERT_EQ(pieces.offsets, expectedOffsets);
+    ASSERT_EQ(pieces.hashes.size(), 140u);
+    for (size_t i = 0; i < 70; ++i) {
+        EXPECT_EQ(pieces.hashes[i], pieces.hashes[i + 70]);
+        EXPECT_NE(pieces.hashes[i], pieces.hashes[(i + 1) % 70]);
+    }
+
+    data.pop_back(); // unterminated string
+    ASSERT_NE(cppld::splitSectionIntoPieces({.in{{data.data(), data.size()}, 1, cppld::MergeType::variableLength},
+                                             .out{pieces}}),
+              cppld::StatusCode::ok);
+}
+
+TEST(Unit, FixedSize_Merge_MixedEntrySizes) {
+    // .rodata.cst4, .rodata.cst8 and .rodata.cst16 all end up in .rodata, but get merged separately
+    std::ignore = std::system("echo '.global _start; .section .text; _start: movq eight(%rip), %rax; addl four(%rip), %eax; addq sixteen+8(%rip), %rax;"
+                              " cmp $42, %rax; setne %dil; mov $60,%eax; syscall;"
+                              " .section .rodata.cst4,\"aM\",@progbits,4; .long 7; four: .long 2;"
+                              " .section .rodata.cst8,\"aM\",@progbits,8; .quad 5; eight: .quad 30;"
+                              " .section .rodata.cst16,\"aM\",@progbits,16; .quad 1, 2; sixteen: .quad 0, 10;' | as -o mixed_cst_1.o");
+    std::ignore = std::system("echo '.section .rodata.cst8,\"aM\",@progbits,8; .quad 30, 5, 9;"
+                              " .section .rodata.cst4,\"aM\",@progbits,4; .long 2, 2, 3;"
+                              " .section .rodata.cst16,\"aM\",@progbits,16; .quad 0, 10;' | as -o mixed_cst_2.o");
+    ASSERT_EQ(std::system("./../src/ld mixed_cst_2.o mixed_cst_1.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | grep ' \\.rodata' | awk '{print $7}') = 000044 ]"), 0);
+}
+
+TEST(Unit, String_TailMerge) {
+    // With -O2 "bar" and "yz" are stored inside of "foobar" and "xyz"
+    std::ignore = std::system("echo '.global _start; .section .text; _start: lea foobar(%rip), %rax; lea bar(%rip), %rdx; sub %rax, %rdx;"
+                              " cmp $3, %rdx; setne %dil; mov $60,%eax; syscall;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; foobar: .string \"foobar\"; .string \"xyz\";' | as -o tail_1.o");
+    std::ignore = std::system("echo '.global bar; .section .rodata.str1.1,\"aMS\",@progbits,1; .string \"unused\"; bar: .string \"bar\"; .string \"yz\";'"
+                              " | as -o tail_2.o");
+    ASSERT_EQ(std::system("./../src/ld tail_1.o tail_2.o"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | grep ' \\.rodata' | awk '{print $7}') = 000019 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld -O2 tail_1.o tail_2.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | grep ' \\.rodata' | awk '{print $7}') = 000012 ]"), 0);
+}
+
+TEST(Unit, String_Merge_MixedWithPlainSections) {
+    // The plain .rodata input must not stop the strings from being deduplicated
+    std::ignore = std::system("echo '.global _start; .section .text; _start: movzbl hello2+4(%rip), %edi; sub $0x6f, %edi; add plain(%rip), %edi;"
+                              " mov $60,%eax; syscall;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; .string \"hello merged world\"; .string \"other\";"
+                              " .section .rodata,\"a\"; plain: .long 0;' | as -o mixed_merge_1.o");
+    std::ignore = std::system("echo '.global hello2; .section .rodata,\"a\"; .quad 1, 2;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; .string \"other\"; hello2: .string \"hello merged world\";'"
+                              " | as -o mixed_merge_2.o");
+    ASSERT_EQ(std::system("./../src/ld mixed_merge_1.o mixed_merge_2.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(strings a.out | grep 'hello merged world' | wc -l) = 1 ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | grep ' \\.rodata' | awk '{print $7}') = 00002d ]"), 0);
+}
+
+TEST(Unit, String_Merge_DropUnreferencedPieces) {
+    // "second" is referenced through the section symbol plus an addend, the "dead" strings by nobody
+    std::ignore = std::system("echo '.global _start; .section .text; _start: lea used(%rip), %rax; movzbl (%rax), %edi; mov $second, %esi;"
+                              " movzbl (%rsi), %esi; sub %esi, %edi; sub $2, %edi; mov $60,%eax; syscall;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; .string \"dead one\"; used: .string \"used\"; second: .string \"second\";'"
+                              " | as -o gc_pieces_1.o");
+    std::ignore = std::system("echo '.section .rodata.str1.1,\"aMS\",@progbits,1; .string \"dead two\"; .string \"used\"; in_second: .string \"cond\";'"
+                              " | as -o gc_pieces_2.o");
+    ASSERT_EQ(std::system("./../src/ld gc_pieces_2.o gc_pieces_1.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(strings a.out | grep 'dead' | wc -l) = 2 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld --gc-merged-pieces gc_pieces_2.o gc_pieces_1.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(strings a.out | grep 'dead' | wc -l) = 0 ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | grep ' \\.rodata' | awk '{print $7}') = 00000c ]"), 0);
+    // "cond" is not referenced, but with -O2 it is a tail of "second" and its local symbol points there
+    ASSERT_EQ(std::system("./../src/ld -O2 --gc-merged-pieces gc_pieces_2.o gc_pieces_1.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $((0x$(readelf -sW a.out | awk '$8==\"in_second\" {print $2}') - 0x$(readelf -sW a.out | awk '$8==\"second\" {print $2}'))) = 2 ]"), 0);
+    // table_end points right behind the last live range of .rodata, it moves with it
+    std::ignore = std::system("echo '.global _start; .section .text; _start: lea table_end(%rip), %rdi; lea table(%rip), %rax; sub %rax, %rdi; mov $60,%eax; syscall;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; .string \"dead\"; .section .rodata,\"a\"; table: .quad 1, 2;"
+                              " .global table_end; table_end:' | as -o gc_pieces_end.o");
+    ASSERT_EQ(std::system("./../src/ld gc_pieces_end.o; ./a.out"), 16 << 8);
+    ASSERT_EQ(std::system("./../src/ld --gc-merged-pieces gc_pieces_end.o; ./a.out"), 16 << 8);
+}
+
+TEST(Unit, GC_Sections) {
+    // unused and unused_data are only reachable from each other and from the unloaded info section
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: call used; mov $60,%eax; syscall;"
+                              " .section .text.used,\"ax\"; used: xor %edi, %edi; ret;"
+                              " .section .text.unused,\"ax\"; unused: mov unused_data(%rip), %edi; ret;"
+                              " .section .data.unused_data,\"aw\"; unused_data: .long 1;"
+                              " .section .text.ctor,\"ax\"; ctor: ret; .section .init_array,\"aw\"; .quad ctor;"
+                              " .section .info,\"\"; .quad unused;' | as -o gc_sections.o");
+    ASSERT_EQ(std::system("./../src/ld gc_sections.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -sW a.out | grep -c -w -e unused -e unused_data) = 2 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld --gc-sections gc_sections.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -sW a.out | grep -c -w -e unused -e unused_data) = 0 ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -sW a.out | grep -c -w -e used -e ctor) = 2 ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | grep -c '\\.data') = 0 ]"), 0);
+}
+
+TEST(Unit, Comdat_FirstGroupWins) {
+    // Both files define inl in a COMDAT group, the first one on the command line gets linked
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: call inl; sub $3, %eax; mov %eax, %edi; mov $60, %eax; syscall;"
+                              " .section .text.inl,\"axG\",@progbits,inl,comdat; .weak inl; inl: mov $3, %eax; ret;"
+                              " .section .rodata.inl,\"aG\",@progbits,inl,comdat; local_in_group: .quad 1;' | as -o comdat1.o");
+    std::ignore = std::system("echo '.section .text.inl,\"axG\",@progbits,inl,comdat; .weak inl; inl: mov $4, %eax; ret;"
+                              " .section .rodata.inl,\"aG\",@progbits,inl,comdat; local_in_group: .quad 2;' | as -o comdat2.o");
+    ASSERT_EQ(std::system("./../src/ld comdat1.o comdat2.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -sW a.out | grep -c local_in_group) = 1 ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | awk '$3==\".rodata\" {print $7}') = 000008 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld comdat2.o comdat1.o && ./a.out"), 1 << 8);
+}
+
+TEST(Unit, Comdat_GlobalDefinitionsInGroups) {
+    // Inline functions and template instances are global definitions in COMDAT groups, the duplicates are no redefinition
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: call inl; sub $3, %eax; mov %eax, %edi; mov $60, %eax; syscall;"
+                              " .section .text.inl,\"axG\",@progbits,inl,comdat; .global inl; inl: mov $3, %eax; ret;' | as -o comdat_global1.o");
+    std::ignore = std::system("echo '.section .text.inl,\"axG\",@progbits,inl,comdat; .global inl; inl: mov $4, %eax; ret;' | as -o comdat_global2.o");
+    ASSERT_EQ(std::system("./../src/ld comdat_global1.o comdat_global2.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("./../src/ld comdat_global2.o comdat_global1.o && ./a.out"), 1 << 8);
+    // Outside of groups it still is one
+    std::ignore = std::system("echo '.section .text.inl,\"ax\"; .global inl; inl: mov $4, %eax; ret;' | as -o comdat_global3.o");
+    ASSERT_NE(std::system("./../src/ld comdat_global1.o comdat_global3.o 2>/dev/null"), 0);
+}
+
+TEST(Unit, EH_Frame_DropsDescriptionsOfDiscardedSections) {
+    // The FDEs of the unused function and of the losing copy of inl describe nothing that gets linked
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: .cfi_startproc; call helper; call inl; mov %eax, %edi; mov $60, %eax; syscall; .cfi_endproc;"
+                              " .section .text.unused,\"ax\"; unused: .cfi_startproc; ret; .cfi_endproc;"
+                              " .section .text.inl,\"axG\",@progbits,inl,comdat; .global inl; inl: .cfi_startproc; mov $7, %eax; ret; .cfi_endproc;' | as -o eh_frame1.o");
+    std::ignore = std::system("echo '.section .text.inl,\"axG\",@progbits,inl,comdat; .global inl; inl: .cfi_startproc; mov $7, %eax; ret; .cfi_endproc;"
+                              " .section .text.helper,\"ax\"; .global helper; helper: .cfi_startproc; nop; ret; .cfi_endproc;' | as -o eh_frame2.o");
+    ASSERT_EQ(std::system("./../src/ld --gc-sections eh_frame1.o eh_frame2.o; ./a.out"), 7 << 8);
+    ASSERT_EQ(std::system("[ $(readelf --debug-dump=frames a.out | grep -c FDE) = 3 ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf --debug-dump=frames a.out 2>&1 | grep -c -i -e warning -e error) = 0 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld -r eh_frame1.o eh_frame2.o -o eh_frame_relocatable.o && ./../src/ld eh_frame_relocatable.o; ./a.out"), 7 << 8);
+    ASSERT_EQ(std::system("[ $(readelf --debug-dump=frames eh_frame_relocatable.o | grep -c FDE) = 4 ]"), 0);
+}
+
+TEST(Unit, Relocation_AgainstAbsoluteSymbol) {
+    // Relocatable output keeps the relocation against the absolute answer, at offset 8 of .data and with an addend
+    std::ignore = std::system("echo '.global _start; .section .text; _start: mov value(%rip), %rdi; add first(%rip), %rdi; mov $60,%eax; syscall;"
+                              " .section .data; first: .quad 0; value: .quad answer+2;' | as -o absolute_use.o");
+    std::ignore = std::system("echo '.global answer; .set answer, 40;' | as -o absolute_def.o");
+    ASSERT_EQ(std::system("./../src/ld -r absolute_use.o absolute_def.o -o absolute.o"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -rW absolute.o | grep -c 'R_X86_64_64 .* answer + 2') = 1 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld absolute.o; ./a.out"), 42 << 8);
+}
+
+TEST(Unit, SymbolOrderingFile) {
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: call a; call b; call c; xor %edi, %edi; mov $60, %eax; syscall;"
+                              " .section .text.a,\"ax\"; a: ret; .section .text.b,\"ax\"; b: ret; .section .text.c,\"ax\"; c: ret;' | as -o ordering.o");
+    std::ignore = std::system("printf 'c\\n  \\nmissing\\nb \\nc\\n' > ordering.txt");
+    ASSERT_EQ(std::system("./../src/ld --symbol-ordering-file=ordering.txt ordering.o && ./a.out"), 0);
+    // c and b come first in the given order, the others keep their order
+    ASSERT_EQ(std::system("[ \"$(readelf -sW a.out | awk '$8==\"a\" || $8==\"b\" || $8==\"c\" || $8==\"_start\" {print $2, $8}' | sort | awk '{print $2}' | tr -d '\\n')\" = cb_starta ]"), 0);
+}
+
+TEST(Unit, CallGraphSort) {
+    // b is called from a, which is called from _start. cold is never called and ends up behind them
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: call a; xor %edi, %edi; mov $60, %eax; syscall;"
+                              " .section .text.a,\"ax\"; a: call b; call b; call b; ret; .section .text.cold,\"ax\"; cold: ret;"
+                              " .section .text.b,\"ax\"; b: ret;' | as -o callgraph.o");
+    auto layout = [](std::string_view expected) {
+        return "[ \"$(readelf -sW a.out | awk '$8==\"a\" || $8==\"b\" || $8==\"cold\" || $8==\"_start\" {print $2, $8}' | sort | awk '{print $2}' | tr '\\n' ' ')\" = \"" +
+               std::string{expected} + "\" ]";
+    };
+    ASSERT_EQ(std::system("./../src/ld callgraph.o && ./a.out"), 0);
+    ASSERT_EQ(std::system(layout("_start a cold b ").c_str()), 0);
+    ASSERT_EQ(std::system("./../src/ld --call-graph-profile-sort --stats callgraph.o 2>&1 | grep -q '2 edges in 2 clusters' && ./a.out"), 0);
+    ASSERT_EQ(std::system(layout("_start a b cold ").c_str()), 0);
+    // A profile replaces the static call counts
+    std::ignore = std::system("echo '_start cold 100' > callgraph.txt");
+    ASSERT_EQ(std::system("./../src/ld --call-graph-ordering-file=callgraph.txt callgraph.o && ./a.out"), 0);
+    ASSERT_EQ(std::system(layout("_start cold a b ").c_str()), 0);
+}
+
+TEST(Unit, TextPrefixGroups) {
+    std::ignore = std::system("echo '.global _start; .section .text.unlikely.u,\"ax\"; u: ret; .section .text.startup,\"ax\"; s: ret;"
+                              " .section .text._start,\"ax\"; _start: call u; call s; call h; call f; xor %edi, %edi; mov $60, %eax; syscall;"
+                              " .section .text.hotter,\"ax\"; f: ret; .section .text.hot.h,\"ax\"; h: ret;' | as -o text_groups.o");
+    ASSERT_EQ(std::system("./../src/ld text_groups.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ \"$(readelf -sW a.out | awk '$8==\"u\" || $8==\"s\" || $8==\"_start\" || $8==\"f\" || $8==\"h\" {print $2, $8}' | sort | awk '{print $2}' | tr '\\n' ' ')\" = \"h _start f s u \" ]"), 0);
+}
+
+TEST(Unit, SegmentAlignment) {
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: mov value(%rip), %edi; mov $60, %eax; syscall;"
+                              " .section .data; .p2align 13; value: .long 0;' | as -o segment_alignment.o");
+    // Section alignments above the page size end up in p_align
+    ASSERT_EQ(std::system("./../src/ld segment_alignment.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("readelf -lW a.out | grep LOAD | grep RW | grep -q '0x2000$'"), 0);
+    ASSERT_EQ(std::system("./../src/ld -z max-page-size=0x10000 segment_alignment.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -lW a.out | grep LOAD | grep -c -v '0x10000$') = 0 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld --huge-page-text segment_alignment.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("readelf -lW a.out | grep -q -E 'LOAD +0x[0-9a-f]*[02468ace]00000 0x[0-9a-f]*[02468ace]00000 .* R E 0x200000$'"), 0);
+    ASSERT_NE(std::system("./../src/ld -z max-page-size=1000 segment_alignment.o"), 0);
+}
+
+TEST(Unit, PackedSegments) {
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: mov value(%rip), %edi; add seven(%rip), %edi; sub $7, %edi;"
+                              " mov $60, %eax; syscall; .section .rodata; seven: .long 7; .section .data; value: .long 0; .section .bss; .zero 64' | as -o packed.o");
+    ASSERT_EQ(std::system("./../src/ld -o separate.out packed.o && ./separate.out"), 0);
+    // Without padding between the segments, the file stays below a page. The bss still has to be zero
+    ASSERT_EQ(std::system("./../src/ld -z noseparate-code packed.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(stat -c%s a.out) -lt 4096 ] && [ $(stat -c%s a.out) -lt $(stat -c%s separate.out) ]"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -lW a.out | grep -c LOAD) = 3 ]"), 0);
+    // Read only data shares the executable segment
+    ASSERT_EQ(std::system("./../src/ld -z noseparate-code --no-rosegment packed.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ $(readelf -lW a.out | grep -c LOAD) = 2 ]"), 0);
+    ASSERT_EQ(std::system("readelf -lW a.out | grep -q -E 'LOAD .* R E 0x1000$'"), 0);
+}
+
+TEST(Unit, SortSectionsByAlignment) {
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: mov a(%rip), %edi; add b(%rip), %edi; add c(%rip), %edi; sub $6, %edi;"
+                              " mov $60, %eax; syscall; .section .data.a,\"aw\"; a: .byte 1; .section .data.b,\"aw\"; .p2align 6; b: .quad 2;"
+                              " .section .data.c,\"aw\"; c: .byte 3; .section .bss.x,\"aw\",@nobits; .byte 0; .section .bss.y,\"aw\",@nobits; .p2align 6; .zero 8' | as -o sort_alignment.o");
+    auto sectionSize = [](std::string_view name) { return "$(readelf -SW a.out | awk '$3==\"" + std::string{name} + "\" {print $7}')"; };
+    ASSERT_EQ(std::system("./../src/ld sort_alignment.o && ./a.out"), 0);
+    ASSERT_EQ(std::system(("[ " + sectionSize(".data") + " = 000049 ] && [ " + sectionSize(".bss") + " = 000048 ]").c_str()), 0);
+    // The 64 byte aligned inputs go first, the single bytes fill up behind them
+    ASSERT_EQ(std::system("./../src/ld --sort-section=alignment --stats sort_alignment.o 2>&1 | grep -q 'saved 126 bytes of alignment padding' && ./a.out"), 0);
+    ASSERT_EQ(std::system(("[ " + sectionSize(".data") + " = 00000a ] && [ " + sectionSize(".bss") + " = 000009 ]").c_str()), 0);
+    ASSERT_NE(std::system("./../src/ld --sort-section=name sort_alignment.o"), 0);
+}
+
+TEST(Unit, ChunkedConcatenation) {
+    // Enough inputs for several chunks, with mixed alignments so that the chunks have to be fixed up
+    std::ignore = std::system("awk 'BEGIN { print \".global _start; .section .text._start,\\\"ax\\\"; _start: call f39999; mov %eax, %edi; mov $60, %eax; syscall\";"
+                              " for (i = 0; i < 40000; ++i) printf \".section .text.f%d,\\\"ax\\\"; .p2align %d; f%d: mov $%d, %%al; ret; .zero %d\\n\", i, (i * 7) % 5, i, i % 200, i % 3 + 1 }'"
+                              " | as -o chunked.o");
+    ASSERT_EQ(std::system("./../src/ld chunked.o; ./a.out; [ $? = 199 ]"), 0);
+    // The size of placing every input serially after the 14 bytes of _start
+    ASSERT_EQ(std::system("[ $(readelf -SW a.out | awk '$3==\".text\" {print $7}') = $(awk 'BEGIN { s = 14; for (i = 0; i < 40000; ++i) {"
+                          " a = 2 ^ ((i * 7) % 5); s = int((s + a - 1) / a) * a + 4 + i % 3 }; printf \"%06x\", s }') ]"),
+              0);
+}
+
+TEST(Unit, SortManyInputsByPriority) {
+    // A shuffled order of many inputs is not a few sorted runs, so the priorities get radix sorted
+    std::ignore = std::system("awk 'BEGIN { print \".global _start; .section .text._start,\\\"ax\\\"; _start: call f0; mov %eax, %edi; mov $60, %eax; syscall\";"
+                              " for (i = 0; i < 20000; ++i) printf \".section .text.f%d,\\\"ax\\\"; f%d: mov $%d, %%al; ret\\n\", i, i, i % 200 }'"
+                              " | as -o many_inputs.o");
+    std::ignore = std::system("awk 'BEGIN { for (i = 0; i < 20000; ++i) print \"f\" (i * 7919) % 20000 }' > many_inputs.order");
+    ASSERT_EQ(std::system("./../src/ld --symbol-ordering-file many_inputs.order many_inputs.o && ./a.out"), 0);
+    // The addresses increase in the order of the file
+    ASSERT_EQ(std::system("readelf -sW a.out | awk 'NR == FNR { if ($8 ~ /^f/) address[$8] = $2; next }"
+                          " { if (address[$1] <= last) exit 1; last = address[$1] }' - many_inputs.order"),
+              0);
+}
+
+TEST(Unit, OutputSectionNames) {
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: mov $60, %eax; xor %edi, %edi; syscall;"
+                              " .section .data.rel.ro.a,\"aw\"; .byte 1; .section .data.b,\"aw\"; .byte 1; .section .rodata.c,\"a\"; .byte 1;"
+                              " .section .bss.rel.ro.d,\"aw\",@nobits; .byte 0; .section .tdata.e,\"awT\"; .byte 1; .section .lbss.f,\"aw\",@nobits; .byte 0;"
+                              " .section .init_array.g,\"aw\",@init_array; .quad 0; .section .mine.h,\"a\"; .byte 1' | as -o section_names.o");
+    ASSERT_EQ(std::system("./../src/ld section_names.o && ./a.out"), 0);
+    ASSERT_EQ(std::system("[ \"$(readelf -SW a.out | sed -n 's/^ *\\[ *[0-9]*\\] \\(\\.[^ ]*\\) .*/\\1/p' | sort | tr '\\n' ' ')\" ="
+                          " '.bss .bss.rel.ro .data .data.rel.ro .got .init_array .lbss .mine.h .rodata .shstrtab .strTab .symtab .tdata .text ' ]"),
+              0);
+}
+
+TEST(Unit, Reproducible) {
+    std::ignore = std::system("echo '.global _start, zeta, alpha, mid; .section .text._start,\"ax\"; _start: mov $60, %eax; xor %edi, %edi; syscall;"
+                              " zeta: ret; alpha: ret; mid: ret; .section .zz,\"a\"; .byte 3; .section .rodata; .byte 1; .section .aa,\"a\"; .byte 4' | as -o reproducible.o");
+    ASSERT_EQ(std::system("./../src/ld --reproducible -o first.out reproducible.o && ./../src/ld --reproducible reproducible.o && cmp a.out first.out && ./a.out"), 0);
+    // Output sections by name, also in the segment. Global symbols in the order they were defined
+    ASSERT_EQ(std::system("[ \"$(readelf -SW a.out | sed -n 's/^ *\\[ *[0-9]*\\] \\(\\.[^ ]*\\) .*/\\1/p' | head -5 | tr '\\n' ' ')\" = '.aa .bss .data .rodata .text ' ]"), 0);
+    ASSERT_EQ(std::system("[ \"$(readelf -SW a.out | awk '$3 ~ /^\\.(aa|rodata|zz)$/ {print $4, $3}' | sort | awk '{print $2}' | tr '\\n' ' ')\" = '.aa .rodata .zz ' ]"), 0);
+    ASSERT_EQ(std::system("[ \"$(readelf -sW a.out | awk '$5==\"GLOBAL\" {print $8}' | tr '\\n' ' ')\" = '_start zeta alpha mid ' ]"), 0);
+}
+
+TEST(Unit, LinkResultCache) {
+    std::ignore = std::system("rm -rf link_cache; echo '.global _start; _start: mov $60, %eax; mov $7, %edi; syscall' | as -o cached.o");
+    ASSERT_EQ(std::system("./../src/ld --cache-dir=link_cache --stats cached.o 2>&1 | grep -q 'link cache miss' && ./a.out; [ $? = 7 ]"), 0);
+    ASSERT_EQ(std::system("cp a.out uncached.out && rm a.out"), 0);
+    ASSERT_EQ(std::system("./../src/ld --cache-dir=link_cache --stats cached.o 2>&1 | grep -q 'link cache hit' && cmp a.out uncached.out"), 0);
+    // Other options are another link
+    ASSERT_EQ(std::system("./../src/ld --cache-dir=link_cache --stats --gc-sections cached.o 2>&1 | grep -q 'link cache miss'"), 0);
+    // Overwriting the output doesn't touch the cache
+    std::ignore = std::system("echo '.global _start; _start: mov $60, %eax; mov $8, %edi; syscall' | as -o changed.o");
+    ASSERT_EQ(std::system("./../src/ld changed.o && ./../src/ld --cache-dir=link_cache cached.o && cmp a.out uncached.out"), 0);
+    ASSERT_EQ(std::system("./../src/ld --cache-dir=link_cache --stats changed.o 2>&1 | grep -q 'link cache miss' && ./a.out; [ $? = 8 ]"), 0);
+}
+
+TEST(Unit, IncrementalLink) {
+    std::ignore = std::system("rm -f a.out.cppld-state; echo '.global _start; .section .text._start,\"ax\"; _start: .cfi_startproc; call value; mov %eax, %edi; mov $60, %eax; syscall; .cfi_endproc' | as -o incremental_main.o");
+    auto assembleValue = [](std::string_view body) {
+        return std::system(("echo '.global value; .section .text.value,\"ax\"; value: .cfi_startproc; " + std::string{body} + "; ret; .cfi_endproc' | as -o incremental_value.o").c_str());
+    };
+    auto link = [](std::string_view expectedInfo, int expectedExitCode) {
+        return std::system(("./../src/ld --incremental --stats incremental_main.o incremental_value.o 2>&1 | grep -q '" + std::string{expectedInfo} +
+                            "' && ./a.out; [ $? = " + std::to_string(expectedExitCode) + " ]")
+                               .c_str());
+    };
+    ASSERT_EQ(assembleValue("mov $3, %eax"), 0);
+    ASSERT_EQ(link("incremental link not possible, there is no state", 3), 0);
+    // No slack between the inputs of .eh_frame, zeros would end it after the first object
+    ASSERT_EQ(std::system("[ $(readelf --debug-dump=frames a.out | grep -c FDE) = 2 ] && ! readelf --debug-dump=frames a.out | grep -q ZERO"), 0);
+    // A few more instructions fit into the slot behind the section
+    ASSERT_EQ(assembleValue("mov $4, %eax; add $1, %eax"), 0);
+    ASSERT_EQ(link("incremental link patched 5 sections of 1 changed files", 5), 0);
+    ASSERT_EQ(link("incremental link patched 0 sections of 0 changed files", 5), 0);
+    // More does not, that is a full link
+    ASSERT_EQ(assembleValue("mov $6, %eax; .fill 100, 1, 0x90"), 0);
+    ASSERT_EQ(link("incremental link not possible, a changed section outgrew its slot", 6), 0);
+    ASSERT_EQ(assembleValue("mov $7, %eax; .fill 110, 1, 0x90"), 0);
+    ASSERT_EQ(link("incremental link patched", 7), 0);
+    // An output that was written by another link is not patched
+    ASSERT_EQ(std::system("./../src/ld incremental_main.o incremental_value.o"), 0);
+    ASSERT_EQ(link("incremental link not possible, the output was changed by something else", 7), 0);
+}
+
+TEST(Unit, LinkServer) {
+    std::ignore = std::system("rm -f link_server_value.a; echo '.global value; value: mov $3, %eax; ret' | as -o link_server_value.o && ar rcs link_server_value.a link_server_value.o;"
+                              "echo '.global _start; _start: call value; mov %eax, %edi; mov $60, %eax; syscall' | as -o link_server_main.o");
+    ASSERT_EQ(std::system("./../src/ld --server=link_server.sock & echo $! > link_server.pid;"
+                          "for i in 1 2 3 4 5 6 7 8 9 10; do [ -S link_server.sock ] && break; sleep 0.1; done; [ -S link_server.sock ]"),
+              0);
+    auto link = [](std::string_view expectedInfo) {
+        return std::system(("./../src/ld --connect=link_server.sock --stats link_server_main.o link_server_value.a 2>&1 | grep -q '" +
+                            std::string{expectedInfo} + "' && ./a.out; [ $? = 3 ]")
+                               .c_str());
+    };
+    EXPECT_EQ(link("link server reused 0 archive mappings"), 0);
+    EXPECT_EQ(link("link server reused 1 archive mappings"), 0);
+    // A rebuilt archive is mapped again, the old one is unmapped
+    std::ignore = std::system("rm link_server_value.a; ar rcs link_server_value.a link_server_value.o");
+    EXPECT_EQ(link("link server reused 0 archive mappings, 1 archives are mapped"), 0);
+    // Errors go to the client, so does the status
+    EXPECT_EQ(std::system("./../src/ld --connect=link_server.sock link_server_main.o 2>&1 | grep -q 'undefined symbol: value'"), 0);
+    EXPECT_NE(std::system("./../src/ld --connect=link_server.sock link_server_main.o 2>/dev/null"), 0);
+    // Neither a running server nor a file that is no socket gets replaced
+    EXPECT_NE(std::system("./../src/ld --server=link_server.sock 2>/dev/null"), 0);
+    EXPECT_NE(std::system("./../src/ld --server=link_server_main.o 2>/dev/null"), 0);
+    EXPECT_EQ(std::system("[ -f link_server_main.o ]"), 0);
+    EXPECT_EQ(link("link server reused 1 archive mappings"), 0);
+    std::ignore = std::system("kill $(cat link_server.pid); rm -f link_server.sock link_server.pid");
+}
+
+TEST(Unit, MultiOutputLink) {
+    std::ignore = std::system("rm -f multi_output_lib.a; echo '.global f; .section .text.f,\"ax\"; f: mov $3, %eax; ret' | as -o multi_output_f.o;"
+                              "echo '.global g; .section .text.g,\"ax\"; g: mov $4, %eax; ret' | as -o multi_output_g.o;"
+                              "ar rcs multi_output_lib.a multi_output_f.o multi_output_g.o;"
+                              "echo '.global _start; _start: call f; mov %eax, %edi; mov $60, %eax; syscall' | as -o multi_output_a.o;"
+                              "echo '.global main2; main2: call f; mov %eax, %ebx; call g; add %ebx, %eax; mov %eax, %edi; mov $60, %eax; syscall' | as -o multi_output_b.o");
+    ASSERT_EQ(std::system("./../src/ld --stats multi_output_lib.a --output-spec=_start:multi_output_a.o:multi_output_a --output-spec=main2:multi_output_b.o:multi_output_b"
+                          " 2>&1 | grep -q 'parsed the shared inputs once for 2 outputs'"),
+              0);
+    EXPECT_EQ(std::system("./multi_output_a; [ $? = 3 ]"), 0);
+    EXPECT_EQ(std::system("./multi_output_b; [ $? = 7 ]"), 0);
+    // Each output is the same as its own link with the extra objects after the shared inputs
+    EXPECT_EQ(std::system("./../src/ld multi_output_lib.a multi_output_a.o && cmp -s a.out multi_output_a"), 0);
+    EXPECT_EQ(std::system("./../src/ld -e main2 multi_output_lib.a multi_output_b.o && cmp -s a.out multi_output_b"), 0);
+    // g is only extracted for the output that needs it
+    EXPECT_NE(std::system("readelf -sW multi_output_a | grep -qw g"), 0);
+    EXPECT_NE(std::system("./../src/ld multi_output_lib.a --output-spec=_start:multi_output_a.o:multi_output_a --output-spec=missing::multi_output_c 2>/dev/null"), 0);
+}
+
+TEST(Unit, InMemoryLink) {
+    std::ignore = std::system("echo '.global _start; _start: mov value(%rip), %edi; mov $60, %eax; syscall; .data; value: .long 3; .section .rodata.str1.1,\"aMS\",@progbits,1; .asciz \"text\"' | as -o in_memory.o");
+    ASSERT_EQ(std::system("./../src/ld -o in_memory_reference in_memory.o"), 0);
+    std::ifstream referenceFile{"in_memory_reference", std::ios::binary};
+    std::vector<char> reference{std::istreambuf_iterator<char>{referenceFile}, std::istreambuf_iterator<char>{}};
+
+    std::vector<std::string_view> inputPaths{"in_memory.o"};
+    cppld::MemoryMappings mappings;
+    ASSERT_EQ(cppld::filePathsToMemoryMappings({.in{inputPaths}, .out{mappings}}), cppld::StatusCode::ok);
+
+    // The arenas of the link come from the caller
+    struct CountingResource : std::pmr::memory_resource {
+        size_t numAllocations{0};
+        auto do_allocate(size_t bytes, size_t alignment) -> void* override {
+            ++numAllocations;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+        auto do_deallocate(void* address, size_t bytes, size_t alignment) -> void override {
+            std::pmr::new_delete_resource()->deallocate(address, bytes, alignment);
+        }
+        auto do_is_equal(std::pmr::memory_resource const& other) const noexcept -> bool override { return this == &other; }
+    } countingResource;
+    cppld::LinkerOptions options;
+    options.memoryResource = &countingResource;
+
+    // A buffer that is too small stays untouched, but tells how large it has to be
+    std::vector<std::byte> buffer(16);
+    size_t outputSize{0};
+    int memoryFileDescriptor{-1};
+    using Kind = cppld::OutputTarget::Kind;
+    ASSERT_NE(cppld::linkSourcesToExecutableElfImage({.in{mappings.addresses, mappings.memSizes, options, {.kind = Kind::buffer, .fileName = {}, .buffer = buffer}},
+                                                      .out{outputSize, memoryFileDescriptor}}),
+              cppld::StatusCode::ok);
+    ASSERT_EQ(outputSize, reference.size());
+    buffer.assign(outputSize, std::byte{0xff});
+    ASSERT_EQ(cppld::linkSourcesToExecutableElfImage({.in{mappings.addresses, mappings.memSizes, options, {.kind = Kind::buffer, .fileName = {}, .buffer = buffer}},
+                                                      .out{outputSize, memoryFileDescriptor}}),
+              cppld::StatusCode::ok);
+    EXPECT_EQ(memoryFileDescriptor, -1);
+    EXPECT_EQ(std::memcmp(buffer.data(), reference.data(), reference.size()), 0);
+    EXPECT_GT(countingResource.numAllocations, 0u);
+
+    ASSERT_EQ(cppld::linkSourcesToExecutableElfImage({.in{mappings.addresses, mappings.memSizes, options, {.kind = Kind::memoryFile, .fileName = "in_memory", .buffer = {}}},
+                                                      .out{outputSize, memoryFileDescriptor}}),
+              cppld::StatusCode::ok);
+    ASSERT_GE(memoryFileDescriptor, 0);
+    std::vector<char> memoryFileContents(outputSize);
+    EXPECT_EQ(::pread(memoryFileDescriptor, memoryFileContents.data(), memoryFileContents.size(), 0), static_cast<ssize_t>(reference.size()));
+    EXPECT_EQ(memoryFileContents, reference);
+    ::close(memoryFileDescriptor);
+}
+
+TEST(Unit, RelocatableOutput) {
+    // Both objects have the same merged string, "one" is only referenced through a section symbol and an addend
+    std::ignore = std::system("echo '.global f; .section .text.f,\"ax\"; f: lea first(%rip), %rax; movzbl 4(%rax), %eax; sub $0x6f, %eax; add g_value(%rip), %eax; ret;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; first: .string \"hello\"; .string \"one\"' | as -o relocatable_1.o;"
+                              "echo '.global g; .global g_value; .section .text.g,\"ax\"; g: lea .rodata.str1.1+6(%rip), %rax; movzbl (%rax), %eax; sub $0x6f, %eax; ret;"
+                              " .section .rodata.str1.1,\"aMS\",@progbits,1; .string \"hello\"; .string \"one\"; .data; g_value: .long 2' | as -o relocatable_2.o;"
+                              "echo '.global _start; _start: call f; mov %eax, %ebx; call g; add %ebx, %eax; mov %eax, %edi; mov $60, %eax; syscall' | as -o relocatable_main.o");
+    ASSERT_EQ(std::system("./../src/ld -r relocatable_1.o relocatable_2.o -o relocatable_combined.o"), 0);
+    ASSERT_EQ(std::system("readelf -hW relocatable_combined.o | grep -q 'REL (Relocatable file)'"), 0);
+    // The strings are merged once, the final link only concatenates them
+    EXPECT_EQ(std::system("[ $(strings relocatable_combined.o | grep -c hello) = 1 ]"), 0);
+    // The sections keep their names, .text.f and .text.g have their own relocations
+    EXPECT_EQ(std::system("[ $(readelf -SW relocatable_combined.o | grep -c ' \\.rela\\.text\\.[fg] ') = 2 ]"), 0);
+    ASSERT_EQ(std::system("./../src/ld relocatable_main.o relocatable_combined.o -o relocatable_a.out; ./relocatable_a.out; [ $? = 2 ]"), 0);
+    EXPECT_EQ(std::system("./../src/ld relocatable_main.o relocatable_1.o relocatable_2.o -o relocatable_b.out; ./relocatable_b.out; [ $? = 2 ]"), 0);
+    // Undefined symbols are left to the final link
+    ASSERT_EQ(std::system("./../src/ld -r relocatable_main.o relocatable_1.o -o relocatable_partial.o && readelf -sW relocatable_partial.o | grep -q 'UND g$'"), 0);
+    EXPECT_EQ(std::system("./../src/ld relocatable_partial.o relocatable_2.o -o relocatable_c.out; ./relocatable_c.out; [ $? = 2 ]"), 0);
+    EXPECT_NE(std::system("./../src/ld -r --gc-sections relocatable_1.o relocatable_2.o -o relocatable_gc.o 2>/dev/null"), 0);
+    // Only exactly -r asks for relocatable output
+    EXPECT_NE(std::system("./../src/ld -rpath=/foo relocatable_main.o relocatable_1.o relocatable_2.o -o relocatable_d.out 2>/dev/null"), 0);
+    EXPECT_NE(std::system("./../src/ld -rdynamic relocatable_main.o relocatable_1.o relocatable_2.o -o relocatable_d.out 2>/dev/null"), 0);
+}
+
+TEST(Unit, RelocatableOutput_KeepsComdatGroups) {
+    // Both relocatable outputs have a copy of the inline function, only the groups tell the final link that one of them is enough
+    std::ignore = std::system("echo '.global _start; .text; _start: call inl; mov %eax, %ebx; call f; add %ebx, %eax; mov %eax, %edi; mov $60, %eax; syscall;"
+                              " .section .text.inl,\"axG\",@progbits,inl,comdat; .global inl; inl: mov $3, %eax; ret' | as -o relocatable_group_1.o;"
+                              "echo '.global f; .text; f: call inl; add $1, %eax; ret;"
+                              " .section .text.inl,\"axG\",@progbits,inl,comdat; .global inl; inl: mov $3, %eax; ret' | as -o relocatable_group_2.o");
+    ASSERT_EQ(std::system("./../src/ld -r relocatable_group_1.o -o relocatable_group_r1.o && ./../src/ld -r relocatable_group_2.o -o relocatable_group_r2.o"), 0);
+    EXPECT_EQ(std::system("readelf -gW relocatable_group_r1.o | grep -q 'COMDAT group section \\[    1\\] `.group. \\[inl\\]'"), 0);
+    EXPECT_EQ(std::system("readelf -SW relocatable_group_r1.o | grep -q ' \\.text\\.inl '"), 0);
+    ASSERT_EQ(std::system("./../src/ld relocatable_group_r1.o relocatable_group_r2.o -o relocatable_group.out; ./relocatable_group.out; [ $? = 7 ]"), 0);
+}
+
+TEST(Unit, ICF_FoldsIdenticalSections) {
+    // f and g only become equal once h1 and h2 are known to be equal. The address of taken is used, so safe folding keeps it
+    std::ignore = std::system("echo '.global _start; .section .text._start,\"ax\"; _start: call f; mov %eax, %ebx; call g; add %eax, %ebx;"
+                              " lea taken(%rip), %rcx; call *%rcx; add %ebx, %eax; sub $9, %eax; mov %eax, %edi; mov $60, %eax; syscall;"
+                              " .section .text.f,\"ax\"; f: call h1; ret; .section .text.g,\"ax\"; g: call h2; ret;"
+                              " .section .text.h1,\"ax\"; h1: mov $3, %eax; ret; .section .text.h2,\"ax\"; h2: mov $3, %eax; ret;"
+                              " .section .text.taken,\"ax\"; taken: mov $3, %eax; ret;' | as -o icf.o");
+    auto numAddresses = [](std::string_view symbols) {
+        return "[ $(readelf -sW a.out | awk '" + std::string{symbols} + " {print $2}' | sort -u | wc -l)";
+    };
+    ASSERT_EQ(std::system("./../src/ld icf.o && ./a.out"), 0);
+    ASSERT_EQ(std::system((numAddresses("$8==\"f\" || $8==\"g\"") + " = 2 ]").c_str()), 0);
+    ASSERT_EQ(std::system("./../src/ld --icf=all --stats icf.o 2>&1 | grep -q 'folded 3 identical sections' && ./a.out"), 0);
+    ASSERT_EQ(std::system((numAddresses("$8==\"f\" || $8==\"g\"") + " = 1 ]").c_str()), 0);
+    ASSERT_EQ(std::system((numAddresses("$8==\"h1\" || $8==\"h2\" || $8==\"taken\"") + " = 1 ]").c_str()), 0);
+    ASSERT_EQ(std::system("./../src/ld --icf=safe icf.o && ./a.out"), 0);
+    ASSERT_EQ(std::system((numAddresses("$8==\"f\" || $8==\"g\"") + " = 1 ]").c_str()), 0);
+    ASSERT_EQ(std::system((numAddresses("$8==\"h1\" || $8==\"h2\" || $8==\"taken\"") + " = 2 ]").c_str()), 0);
+}